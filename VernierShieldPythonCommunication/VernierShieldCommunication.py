@@ -12,7 +12,15 @@ import logging
 import bitstring
 import time
 import json
+import re
+import queue
+import threading
+from collections import deque
 from functools import reduce
+try:  # only needed for Capture
+    import numpy as np
+except ImportError:
+    np = None
 
 class Commands:
     # If a command is valid and the data acquisition conditions set by the mode commands
@@ -32,6 +40,8 @@ class Commands:
     # while the other is scaled to ±10.  Standard Vernier probes are configured to use
     # one or the other but not both. The software can handle both in the event a
     # customized probe requires this.
+    TAG = 0x88 | 0x01  # 0b10001000  137   ⇨ tag the next command with a 7 bit sequence number
+    # the tagged command is answered with a 0x06 tag (ACK) or 0x15 tag (NAK) record
     BLINKLED = 0xA8 | 0x01  # 0b10101000  168   ⇨ blink led n times with period k
     # param 1: high nibble is # blinks 1-7, low nibble<<6 is period
 
@@ -42,6 +52,8 @@ class Commands:
     IMM_AN052 = 0x9C  # 0b10011100  156   ⇨ read analog  5V port 2
     IMM_AN102 = 0xA0  # 0b10100000  160   ⇨ read analog 10V port 2
     # all of the above commands will return a single datablob with seq#': 0
+    IMM_SNAP = 0xDC | 0x01  # 0b11011100  221   ⇨ read several ports at once
+    # param: port mask as ST_PORTS, answered with one snapshot record (Records.SNAPSHOT)
 
     IMM_BUTSTATE = 0xA4  # 0b10100100  164   ⇨ get button press
     MDE_SYNC = 0xD0      # 0b11010000  208   ⇨ sync the clocks
@@ -73,11 +85,28 @@ class Commands:
     # on one port. With this configuration there is no way to distinguish which gate
     # triggered the event.
 
+    MDE_DEVENT = 0xD4 | 0x01  # 0b11010100  212  ⇨ set the digital event encoding
+    # param: 0 digital events come back as 8 byte data blobs [default]
+    #        1 digital events come back as compact varint encoded event records
+
+    MDE_LINK = 0xD8 | 0x01   # 0b11011000  216  ⇨ change the link speed
+    # param: LinkSpeed index. The ACK comes at the old speed, after that the shield expects
+    # a LINK_ECHO at the new speed within a second or it falls back.
+    LINK_ECHO = 0xD8 | 0x02  # 0b11011000  218  ⇨ echo two parameters back (confirms a link speed)
+
+    MDE_CONFIG = 0xE0 | 0x01  # 0b11100000  225  ⇨ configure every port in one frame
+    # variable length: 0xE1 N b0..bN-1 checksum, see configure_experiment()
+
     ST_PORTS = 0xC8 | 0x01   # 0b11001000  200   ⇨ Status of AnalogPorts
-    #  STASTOP = 0xC4        # 0b11000100  196   ⇨ stop status
+    ST_PORTSB = 0xC4 | 0x01  # 0b11000100  196   ⇨ binary status of ports, one record per port
     ST_VER = 0xC8            # 0b11001000  200   ⇨ version info
-    # STASTATE = 0xCC        # 0b11001100  204   ⇨ state
-    # NOP = 0x88             # 0b10001000  136   ⇨ not used currently
+    ST_LINK = 0xCC           # 0b11001100  204   ⇨ transmit link status
+    CLK_PING = 0xE4 | 0x02   # 0b11100100  230   ⇨ clock ping, params: 14 bit id (no ACK, answered by Records.PING)
+    ST_STATS = 0xE8 | 0x01   # 0b11101000  233   ⇨ loop and latency histograms, param: 1 empties them
+    ST_TRACE = 0xEC | 0x01   # 0b11101100  237   ⇨ dump the trace ring (SHIELD_TRACE builds), param: 1 empties it
+    MDE_RELIABLE = 0xF0 | 0x01  # 0b11110000  241   ⇨ reliable streaming, param: 1 on, 0 off (see set_reliable)
+    RTX_ACK = 0xF4 | 0x02       # 0b11110100  246   ⇨ 14 bit number of the first batch we don't have (no ACK)
+    RTX_NAK = 0xF8 | 0x03       # 0b11111000  251   ⇨ 14 bit first batch missing, how many (no ACK)
 
 class Trigger:
     IMMEDIATE = 0x00
@@ -104,6 +133,10 @@ class SampleRates:
     S_500_HZ = 3
     S_1K_HZ = 2
     FASTEST = 1  # approx 1.5 ms per sample
+    # requested μs between samples, FASTEST has none, it goes as fast as the loop does
+    PERIOD_US = {S_30_S: 30000000, S_10_S: 10000000, S_5_S: 5000000, S_2_S: 2000000, S_1_HZ: 1000000,
+                 S_5_HZ: 200000, S_10_HZ: 100000, S_20_HZ: 50000, S_40_HZ: 25000, S_50_HZ: 20000,
+                 S_100_HZ: 10000, S_200_HZ: 5000, S_500_HZ: 2000, S_1K_HZ: 1000}
 
 class Sources:
     STR = 0x0
@@ -115,6 +148,784 @@ class Sources:
     ANA210 = 0x6
     BTN = 0x7
 
+class EventEncoding:
+    BLOB = 0x0
+    COMPACT = 0x1
+
+class LinkSpeed:
+    DEFAULT = 0   # 460800
+    M1 = 1        # 1M baud
+    M2 = 2        # 2M baud
+    BAUD = {DEFAULT: 4*115200, M1: 1000000, M2: 2000000}
+    CONFIRM_S = 1.0  # the shield falls back if it doesn't hear from us in this time
+
+class Records:
+    BLOB = 0xAA     # 8 byte datablob
+    STRING = 0x20   # string terminated with CR LF
+    STATUS = 0xAB   # binary status record: 0xAB, src, len, (tag, len, value)...
+    SNAPSHOT = 0xAC # 0xAC, mask, time(4), raw analogs (2 each), digital bits (if any asked for)
+    PING = 0xAD     # 0xAD, id(2), rx time(4), tx time(4), bytes queued ahead(2)
+    BEACON = 0xAE   # 0xAE, mask, clock wraps(2), time(4), count(4) for each port in the mask
+    STATS = 0xAF    # 0xAF, id, len, histogram: max(4) counts(2 each) / RAM: free(2) low water(2)
+    TRACE = 0xA8    # 0xA8, n, total(2), micros(4), ticks(3), then n of id, ticks(3)
+    BATCH = 0xA9    # 0xA9, seq(2), n, n bytes of records, CRC-CCITT(2) of all before it (reliable streaming)
+    ACK = 0x06      # tagged acknowledge, followed by the tag
+    NAK = 0x15      # tagged negative acknowledge, followed by the tag
+    EVENT = 0xC0    # compact digital event 0b110APSSS
+    EVENT_MASK = 0xE0
+    EVENT_ANCHOR = 0x10  # payload is 4 byte absolute time otherwise a varint delta
+    EVENT_RISE = 0x08    # LOW2HIGH transition otherwise HIGH2LOW
+    OK = 0x21       # '!' plain acknowledge
+    BAD = 0x3F      # '?' plain negative acknowledge
+
+class StatusTag:
+    # fields of a binary status record, name and whether the value is a string
+    FIELDS = {0x01: ('state', False), 0x02: ('period', False), 0x03: ('trigger', False),
+              0x04: ('level', False), 0x05: ('stop', False), 0x06: ('count', False),
+              0x07: ('units', True), 0x08: ('name', True), 0x09: ('shortname', True),
+              0x0A: ('button', False), 0x0B: ('dropped', False), 0x0C: ('missed', False)}
+
+class Stats:
+    # ids of the stats records (see ST_STATS), POLL | source for each port's poll cost
+    RAM = 0x00
+    LOOP = 0x01
+    STALL = 0x02
+    COMMAND = 0x03
+    POLL = 0x10
+    NAMES = {LOOP: 'loop', STALL: 'stall', COMMAND: 'command'}
+    # lower edge of each bucket in μs: < 4μs, 4-7, 8-15 ... 4096 and up
+    BUCKETS = [0] + [1 << (b + 1) for b in range(1, 12)]
+
+class Trace:
+    # trace points (see ST_TRACE), the names shieldtrace prints
+    NAMES = {0x01: 'loop', 0x02: 'command', 0x03: 'blob', 0x04: 'event',
+             0x10: 'analog poll', 0x11: 'analog armed', 0x12: 'analog run', 0x13: 'analog stop',
+             0x14: 'analog read', 0x15: 'analog idle',
+             0x20: 'digital poll', 0x21: 'digital read', 0x22: 'digital fired'}
+    HEADER = 11
+
+class Timeline:
+    """
+    Puts back the bits the wire leaves out: times are 32 bit μs since SYNC (they wrap after ~71.6
+    minutes) and blob seq#s are 11 bits (they wrap every 2048 samples). The shield sends a beacon at
+    least once a second while anything is armed with the number of clock wraps and the full count of
+    each armed port, between beacons a time is taken as the nearest one to the latest time seen and a
+    seq# as the next one on from the port's count. A beacon earlier than the one before it means the
+    clocks were synced and every count starts again from 0.
+
+    A marker byte in damaged data can look like a beacon, so one has to fit (see fits()): its time
+    no more than two idle periods after the last beacon's (not measured from the latest time, one
+    damaged sample can move that anywhere), or after 0 if it is earlier (a SYNC), its counts no
+    further back than a seq# wrap and no further on than the ports can count, and only ports that
+    have been armed. One that doesn't is junk, unless the beacon before it was turned down too and
+    this one follows on from it: then it is us that is off (a long stretch lost) and it is taken.
+    """
+    AHEAD_US = 120000000   # twice the idle beacon period
+    COUNT_SLACK = 0x800    # a damaged seq# can move a count on by less than a wrap
+    US_PER_COUNT = 8       # faster than any port can count
+
+    def __init__(self):
+        self.armed = None   # mask of the ports armed since the shield started, None if we can't know
+        self.reset()
+
+    def reset(self):
+        self.now = 0        # latest time seen, μs
+        self._count = {}    # last count by source
+        self._beacon_at = 0
+        self._held = None   # time of the last beacon turned down
+
+    # whether a beacon can be right, see above
+    def fits(self, mask, time, counts):
+        if mask & ~0x3F or (self.armed is not None and mask & ~self.armed):
+            return False
+        synced = time < self._beacon_at   # a SYNC we weren't told about, times and counts start from 0
+        since = 0 if synced else self._beacon_at
+        ok = time <= since + self.AHEAD_US
+        limit = self.COUNT_SLACK + (time - since) // self.US_PER_COUNT
+        for src, n in counts.items():
+            last = 0 if synced else self._count.get(src, 0)
+            ok = ok and last - self.COUNT_SLACK <= n <= last + limit
+        if ok:
+            return True
+        follows = self._held is not None and self._held <= time <= self._held + self.AHEAD_US
+        self._held = time
+        return follows
+
+    def beacon(self, time, counts):
+        if time < self._beacon_at:
+            self._count = {}
+        self.now = time
+        self._count.update(counts)
+        self._beacon_at = time
+        self._held = None
+
+    # μs since SYNC with the wraps put back
+    def time(self, t):
+        v = self.now + ((t - self.now + 0x80000000) & 0xFFFFFFFF) - 0x80000000
+        if v < 0:
+            return t
+        if v > self.now:
+            self.now = v
+        return v
+
+    # a port's 11 bit seq# as its count since SYNC, a seq# behind the last one leaves the count
+    # alone and a 0 that isn't the next one after 0x7FF is an immediate read and stays 0
+    def count(self, src, seq):
+        last = self._count.get(src, 0)
+        if seq == 0 and last & 0x7FF != 0x7FF:
+            return 0
+        ahead = (seq - last) & 0x7FF
+        if ahead < 0x400:
+            self._count[src] = last + ahead
+            return last + ahead
+        back = 0x800 - ahead
+        return last - back if last >= back else seq
+
+    # the next count on a port whose records don't carry one (compact events)
+    def next(self, src):
+        self._count[src] = self._count.get(src, 0) + 1
+        return self._count[src]
+
+def crc_ccitt(data, crc=0xFFFF):
+    """the shield's batch CRC (avr-libc's _crc_ccitt_update)"""
+    for b in data:
+        b ^= crc & 0xFF
+        b = (b ^ (b << 4)) & 0xFF
+        crc = ((b << 8) | (crc >> 8)) ^ (b >> 4) ^ (b << 3)
+    return crc & 0xFFFF
+
+class BatchWindow:
+    """
+    Our end of reliable streaming (see VernierShield.set_reliable). The shield numbers its batches
+    mod 2^14 and their records have to be decoded in order (the timeline and compact events carry on
+    from one record to the next), so a batch that turns up ahead of a gap is held until the gap is
+    filled. next is the batch to acknowledge and missing() the gaps to ask for again.
+    """
+    MASK = 0x3FFF
+    HOLD = 256  # furthest ahead a batch is taken as new, the shield has no more than 16 out
+
+    def __init__(self):
+        self.reset()
+
+    def reset(self):
+        self.next = 0        # first batch we don't have
+        self.held = {}       # seq: records, ahead of a gap
+        self.received = 0
+        self.duplicates = 0  # sent again when we already had them
+
+    def add(self, seq, payload):
+        """the payloads this batch lets through, in order"""
+        ahead = (seq - self.next) & self.MASK
+        if ahead >= self.HOLD or seq in self.held:
+            self.duplicates += 1
+            return []
+        self.received += 1
+        if ahead:
+            self.held[seq] = payload
+            return []
+        out = [payload]
+        self.next = (self.next + 1) & self.MASK
+        while self.next in self.held:
+            out.append(self.held.pop(self.next))
+            self.next = (self.next + 1) & self.MASK
+        return out
+
+    def missing(self):
+        """(first, count) of each gap before the furthest batch held"""
+        if not self.held:
+            return []
+        furthest = max((s - self.next) & self.MASK for s in self.held)
+        gaps, first = [], None
+        for i in range(furthest + 1):
+            seq = (self.next + i) & self.MASK
+            if seq not in self.held:
+                if first is None:
+                    first = seq
+            elif first is not None:
+                gaps.append((first, (seq - first) & self.MASK))
+                first = None
+        return gaps
+
+class StreamParser:
+    """
+    Turns the bytes from the shield into records. Bytes are fed in whatever pieces they arrive in,
+    complete records come out and an incomplete one at the end waits for the next feed. Bytes that
+    don't start a record are counted in junk and skipped until a marker turns up again.
+
+    Records are tuples that start with the marker that opened them:
+        (Records.BLOB, seq, data, deltime, src)       deltime in seconds, as decode_datablob
+        (Records.EVENT, seq, data, deltime, src)      deltime since the last event on the port
+        (Records.BEACON, time, counts)                time in μs, counts by source
+        (Records.STRING, bytes)                       without the CR LF
+        (Records.STATUS, fields)                      dictionary, see StatusTag
+        (Records.SNAPSHOT, readings)                  dictionary, see VernierShield.get_snapshot
+        (Records.PING, id, rx, tx, queued, stamp)     rx/tx in μs, stamp: host time the bytes were read
+        (Records.STATS, id, fields)                   see decode_stats
+        (Records.TRACE, points, overwritten)          see decode_trace
+        (Records.ACK, tag) (Records.NAK, tag)         tagged answers
+        (Records.OK, None) (Records.BAD, None)        plain '!' and '?'
+    Batches (reliable streaming) don't come out themselves, the records in them do once every batch
+    before them has arrived (see BatchWindow). A batch whose CRC doesn't match is skipped as junk.
+    With reliable set a blob, event or beacon outside a batch can only be a piece of a damaged one
+    and is junk too.
+    Blob and snapshot times and blob and event seq#s come out unwrapped by the timeline, so seq is
+    the port's count since SYNC (digital blobs keep the delta time they were sent with).
+    """
+    MAX_STRING = 256  # longer than anything the firmware sends
+    MAX_BATCH = 128   # most bytes of records in a batch, the shield closes them at 48
+    NOT_TEXT = re.compile(rb'[\x00-\x0c\x0e-\x1f\x7f]')  # in a string (UTF-8 units are fine)
+
+    def __init__(self):
+        self.buffer = bytearray()
+        self.junk = 0
+        self.timeline = Timeline()
+        self.batches = BatchWindow()
+        self.reliable = False
+        self.reset_events()
+
+    # clear the running event clocks. The firmware re-anchors after SYNC and ARM
+    def reset_events(self):
+        self._event_time = {}
+
+    # length of the record at pos, 0 if it isn't all here yet, -1 if pos isn't a record.
+    # framed: mv is the inside of a batch
+    def _length(self, mv, pos, framed=False):
+        left = len(mv) - pos
+        cc = mv[pos]
+        if self.reliable and not framed and (cc == Records.BLOB or cc == Records.BEACON or
+                                             (cc & Records.EVENT_MASK) == Records.EVENT):
+            return -1
+        if cc == Records.BLOB:
+            return 8 if left >= 8 else 0
+        if (cc & Records.EVENT_MASK) == Records.EVENT:
+            if cc & Records.EVENT_ANCHOR:
+                return 5 if left >= 5 else 0
+            for i in range(1, 6):  # varint, no more than 5 bytes
+                if i >= left:
+                    return 0
+                if not mv[pos+i] & 0x80:
+                    return i + 1
+            return -1
+        # The checks on strings, status, stats and trace records turn down a marker in the middle
+        # of something else with what is here already, rather than waiting for bytes that in
+        # reliable streaming won't come until we have acknowledged what is behind them. A beacon
+        # is checked against the timeline once it is all here.
+        if cc == Records.STRING:
+            end = mv.obj.find(b'\n', pos, pos + self.MAX_STRING)
+            if self.NOT_TEXT.search(mv.obj, pos, end if end >= 0 else pos + left):
+                return -1
+            if end >= 0:
+                try:
+                    mv.obj[pos+1:end].decode('utf-8')  # damaged bytes seldom are
+                except UnicodeDecodeError:
+                    return -1
+                return end - pos + 1
+            return 0 if left < self.MAX_STRING else -1
+        if cc == Records.STATUS:
+            return self._status_length(mv, pos)
+        if cc == Records.STATS:
+            if left < 3:
+                return 0
+            id, length = mv[pos+1], mv[pos+2]
+            if length != (4 if id == Stats.RAM else 4 + 2 * len(Stats.BUCKETS)) or \
+                    not (id <= Stats.COMMAND or Sources.DIG1 <= id - Stats.POLL <= Sources.BTN):
+                return -1
+            return 3 + length if left >= 3 + length else 0
+        if cc == Records.SNAPSHOT:
+            if left < 2:
+                return 0
+            mask = mv[pos+1]
+            length = 6 + 2 * bin(mask & 0x3C).count('1') + (1 if mask & 0x43 else 0)
+            return length if left >= length else 0
+        if cc == Records.ACK or cc == Records.NAK:
+            return 2 if left >= 2 else 0
+        if cc == Records.PING:
+            return 13 if left >= 13 else 0
+        if cc == Records.BEACON:
+            if left < 2:
+                return 0
+            length = 8 + 4 * bin(mv[pos+1] & 0x3F).count('1')
+            if left < length:
+                return 0
+            time, counts = self.decode_beacon(mv[pos:pos+length])
+            return length if self.timeline.fits(mv[pos+1], time, counts) else -1
+        if cc == Records.TRACE:
+            if left < 2:
+                return 0
+            length = Trace.HEADER + 4 * mv[pos+1]
+            for i in range(pos + Trace.HEADER, pos + min(left, length), 4):
+                if mv[i] not in Trace.NAMES:
+                    return -1
+            return length if left >= length else 0
+        if cc == Records.BATCH:
+            if left < 4:
+                return 0
+            ahead = (((mv[pos+1] << 8) | mv[pos+2]) - self.batches.next) & BatchWindow.MASK
+            if mv[pos+3] > self.MAX_BATCH or BatchWindow.HOLD <= ahead <= BatchWindow.MASK - BatchWindow.HOLD:
+                return -1  # nowhere near the batches we're expecting
+            length = 6 + mv[pos+3]
+            if left < length:
+                return 0
+            crc = crc_ccitt(mv[pos:pos+length-2])
+            return length if crc == (mv[pos+length-2] << 8) | mv[pos+length-1] else -1
+        if cc == Records.OK or cc == Records.BAD:
+            return 1
+        return -1
+
+    # a status record's fields have to add up to its length
+    def _status_length(self, mv, pos):
+        left = len(mv) - pos
+        if left < 3:
+            return 0
+        if not Sources.DIG1 <= mv[pos+1] <= Sources.BTN:
+            return -1
+        end = pos + 3 + mv[pos+2]
+        i = pos + 3
+        while i + 1 < min(end, pos + left):
+            if mv[i] not in StatusTag.FIELDS:
+                return -1
+            i += 2 + mv[i+1]
+        if i > end:
+            return -1
+        if left < end - pos:
+            return 0
+        return end - pos if i == end else -1
+
+    # add some bytes, returns the list of records they completed.
+    # stamp is the host time they were read, it is passed on with pings
+    def feed(self, data, stamp=None):
+        self._stamp = stamp
+        self.buffer += data
+        records = []
+        with memoryview(self.buffer) as mv:
+            pos = self._parse(mv, records)
+        del self.buffer[:pos]
+        return records
+
+    # the complete records in mv onto records, returns where the first incomplete one starts
+    def _parse(self, mv, records, framed=False):
+        pos = 0
+        while pos < len(mv):
+            length = self._length(mv, pos, framed)
+            if length == 0:
+                break
+            if length < 0:
+                self.junk += 1
+                pos += 1
+                continue
+            if mv[pos] == Records.BATCH:
+                seq = (mv[pos+1] << 8) | mv[pos+2]
+                for payload in self.batches.add(seq, bytes(mv[pos+4:pos+length-2])):
+                    with memoryview(payload) as inner:
+                        self.junk += len(inner) - self._parse(inner, records, True)  # a batch holds whole records
+            else:
+                records.append(self._decode(mv[pos:pos+length]))
+            pos += length
+        return pos
+
+    def _decode(self, rec):
+        cc = rec[0]
+        if cc == Records.BLOB:  # seq 11 | data 10 | src 3 | time 32
+            word = int.from_bytes(rec[1:4], 'big')
+            src = word & 0x07
+            t = int.from_bytes(rec[4:8], 'big')
+            if src != Sources.DIG1 and src != Sources.DIG2:
+                t = self.timeline.time(t)
+            return (cc, self.timeline.count(src, word >> 13), (word >> 3) & 0x3FF, t / 1.0E6, src)
+        if (cc & Records.EVENT_MASK) == Records.EVENT:
+            return self._decode_event(rec)
+        if cc == Records.STRING:
+            return (cc, bytes(rec[1:]).rstrip(b'\r\n'))
+        if cc == Records.STATUS:
+            return (cc, self.decode_status(rec[1], rec[3:]))
+        if cc == Records.SNAPSHOT:
+            snap = self.decode_snapshot(rec)
+            snap['time'] = self.timeline.time(snap['time'])
+            return (cc, snap)
+        if cc == Records.ACK or cc == Records.NAK:
+            return (cc, rec[1])
+        if cc == Records.PING:
+            return (cc, (rec[1] << 7) | rec[2], int.from_bytes(rec[3:7], 'big'), int.from_bytes(rec[7:11], 'big'),
+                    int.from_bytes(rec[11:13], 'big'), self._stamp)
+        if cc == Records.BEACON:
+            return (cc,) + self.decode_beacon(rec, self.timeline)
+        if cc == Records.STATS:
+            return (cc, rec[1], self.decode_stats(rec[1], rec[3:]))
+        if cc == Records.TRACE:
+            return (cc,) + self.decode_trace(rec)
+        return (cc, None)
+
+    # compact digital event into the same values a datablob gives us.
+    #         +---+---+---+---+---+---+---+---+
+    #     bit | 7 | 6 | 5 | 4 | 3 | 2 | 1 | 0 |
+    #         | 1 | 1 | 0 | A | P |    src    |   A: anchor, P: 1 for LOW2HIGH
+    #         +---+---+---+---+---+---+---+---+
+    # A=1: followed by 4 bytes of absolute microseconds since SYNC
+    # A=0: followed by microseconds since the last event on this port as a varint
+    def _decode_event(self, rec):
+        header = rec[0]
+        src = header & 0x07
+        data = Trigger.LOW_2_HIGH if header & Records.EVENT_RISE else Trigger.HIGH_2_LOW
+        last = self._event_time.get(src, 0)
+        if header & Records.EVENT_ANCHOR:
+            abstime = int.from_bytes(rec[1:5], 'big')
+            delta = (abstime - last) & 0xFFFFFFFF
+        else:
+            delta = 0
+            for i in range(1, len(rec)):
+                delta |= (rec[i] & 0x7F) << (7 * (i - 1))
+            abstime = (last + delta) & 0xFFFFFFFF
+        self._event_time[src] = abstime
+        self.timeline.time(abstime)
+        return (Records.EVENT, self.timeline.next(src), data, delta / 1.0E6, src)
+
+    # the fields of a binary status record
+    @staticmethod
+    def decode_status(src, body):
+        fields = {'src': src}
+        i = 0
+        while i + 2 <= len(body):
+            tag, size = body[i], body[i+1]
+            value = bytes(body[i+2:i+2+size])
+            name, is_str = StatusTag.FIELDS.get(tag, (f"tag{tag}", False))
+            fields[name] = value.decode('UTF-8') if is_str else int.from_bytes(value, 'big')
+            i += 2 + size
+        return fields
+
+    # a stats record: {'free', 'low'} bytes for the RAM, {'max' μs, 'counts' per bucket} otherwise
+    @staticmethod
+    def decode_stats(id, body):
+        if id == Stats.RAM:
+            return {'free': int.from_bytes(body[0:2], 'big'), 'low': int.from_bytes(body[2:4], 'big')}
+        return {'max': int.from_bytes(body[0:4], 'big'),
+                'counts': [int.from_bytes(body[i:i+2], 'big') for i in range(4, len(body), 2)]}
+
+    # the points in a trace record as (μs on the shield's micros() clock, id) oldest first, and how many
+    # the ring had lost. A point's time is micros() at the dump less the 0.5μs ticks since the point.
+    @staticmethod
+    def decode_trace(rec):
+        n = rec[1]
+        total = int.from_bytes(rec[2:4], 'big')
+        dumped = int.from_bytes(rec[4:8], 'big')
+        now = int.from_bytes(rec[8:11], 'big')
+        points = []
+        for i in range(Trace.HEADER, Trace.HEADER + 4 * n, 4):
+            ago = (now - int.from_bytes(rec[i+1:i+4], 'big')) & 0xFFFFFF
+            points.append((dumped - ago / 2, rec[i]))
+        return points, (total - n) & 0xFFFF
+
+    # the time (μs, wraps put back) and port counts in a beacon, handed to the timeline if there is one
+    @staticmethod
+    def decode_beacon(rec, timeline=None):
+        mask = rec[1]
+        time = (int.from_bytes(rec[2:4], 'big') << 32) | int.from_bytes(rec[4:8], 'big')
+        counts = {}
+        pos = 8
+        for src in range(Sources.DIG1, Sources.ANA210 + 1):
+            if mask & (1 << (src-1)):
+                counts[src] = int.from_bytes(rec[pos:pos+4], 'big')
+                pos += 4
+        if timeline is not None:
+            timeline.beacon(time, counts)
+        return time, counts
+
+    # the readings in a snapshot record: 'time' (μs since sync) and the raw reading by source,
+    # digital ports and the button as True/False
+    @staticmethod
+    def decode_snapshot(rec):
+        mask = rec[1]
+        ans = {'time': int.from_bytes(rec[2:6], 'big')}
+        pos = 6
+        for src in (Sources.ANA105, Sources.ANA205, Sources.ANA110, Sources.ANA210):
+            if mask & (1 << (src-1)):
+                ans[src] = int.from_bytes(rec[pos:pos+2], 'big')
+                pos += 2
+        for src in (Sources.DIG1, Sources.DIG2, Sources.BTN):
+            if mask & (1 << (src-1)):
+                ans[src] = bool(rec[pos] & (1 << (src-1)))
+        return ans
+
+class ClockSync:
+    """
+    Maps the shield's clock (seconds since SYNC) onto the host's time.monotonic(). The crystal on
+    the Arduino drifts tens of ppm so a fixed offset isn't enough for long runs or for putting
+    several shields on one timeline.
+
+    Each clock ping gives four times, as in NTP: host send, shield receive, shield send, host
+    receive. The midpoint on each side is taken to be the same moment, good to within half the
+    round trip less the time the shield held on to the ping. A straight line is fitted through the
+    pings with the shortest round trips, its slope is the drift.
+    """
+    def __init__(self, window=64):
+        self.samples = deque(maxlen=window)  # (shield midpoint, host midpoint, half the round trip)
+        self._last_us = None
+        self._wraps = 0
+
+    # the shield's clock starts again at SYNC
+    def reset(self):
+        self.samples.clear()
+        self._last_us = None
+        self._wraps = 0
+
+    # the μs counter wraps every 71 minutes
+    def _unwrap(self, us):
+        if self._last_us is not None and us < self._last_us - (1 << 31):
+            self._wraps += 1
+        self._last_us = us
+        return (us + (self._wraps << 32)) / 1.0E6
+
+    def add(self, sent, received, rx_us, tx_us, queued=0, baud=LinkSpeed.BAUD[LinkSpeed.DEFAULT]):
+        """Add a ping: host send and receive times (s), shield receive and send times (μs)
+        and the bytes queued ahead of the answer on the shield"""
+        byte = 10.0 / baud
+        rx = self._unwrap(rx_us)
+        tx = self._unwrap(tx_us) + (queued + 13) * byte  # when the last byte of the answer left
+        sent += 3 * byte                                  # when the last byte of the ping arrived
+        delay = (received - sent) - (tx - rx)
+        self.samples.append(((rx + tx) / 2, (sent + received) / 2, max(delay, 0.0) / 2))
+
+    def estimate(self):
+        """The current fit
+
+        Returns
+        -------
+        dictionary with offset (host time of the shield's zero, s), rate (host seconds per
+        shield second), drift_ppm (negative when the shield's clock runs fast), error (bound on a mapped time, s), pings used and the
+        shortest round trip (s), or None without any pings
+        """
+        if not self.samples:
+            return None
+        best = sorted(self.samples, key=lambda p: p[2])
+        best = best[:max(2, len(best) // 2)]  # the quickest half, they are the least disturbed
+        if len(best) < 2 or max(p[0] for p in best) - min(p[0] for p in best) < 1.0E-3:
+            x, y, half = best[0]
+            return {'offset': y - x, 'rate': 1.0, 'drift_ppm': 0.0, 'error': half,
+                    'pings': 1, 'rtt': 2 * half}
+        w = [1.0 / (p[2] + 1.0E-5) ** 2 for p in best]
+        sw = sum(w)
+        mx = sum(wi * p[0] for wi, p in zip(w, best)) / sw
+        my = sum(wi * p[1] for wi, p in zip(w, best)) / sw
+        sxx = sum(wi * (p[0] - mx) ** 2 for wi, p in zip(w, best))
+        sxy = sum(wi * (p[0] - mx) * (p[1] - my) for wi, p in zip(w, best))
+        rate = sxy / sxx
+        offset = my - rate * mx
+        resid = max(abs(p[1] - (offset + rate * p[0])) for p in best)
+        return {'offset': offset, 'rate': rate, 'drift_ppm': (rate - 1.0) * 1.0E6,
+                'error': resid + max(p[2] for p in best), 'pings': len(best),
+                'rtt': 2 * best[0][2]}
+
+    def to_host(self, shield_time):
+        """Shield time in seconds since SYNC (a number or numpy array) to host time.monotonic()"""
+        fit = self.estimate()
+        if fit is None:
+            raise ValueError("no clock pings yet")
+        return fit['offset'] + fit['rate'] * shield_time
+
+class Calibration:
+    """
+    Conversions from raw ADC readings to physical values, mirroring the firmware's sensor classes.
+    Each one takes a numpy array of raw readings and returns the values, the whole array at once.
+    """
+    @staticmethod
+    def linear(slope, intercept):
+        return lambda raw: slope * np.asarray(raw, dtype=np.float64) + intercept
+
+    # Steinhart-Hart for the TMP-BTA/STS-BTA thermistor on the 15k divider, °C (VernierThermistor)
+    @staticmethod
+    def thermistor(raw):
+        raw = np.asarray(raw, dtype=np.float64)
+        with np.errstate(divide='ignore', invalid='ignore'):
+            lnr = np.log(15000.0 * raw / (1024 - raw))
+            return 1 / (0.00102119 + 0.000222468 * lnr + 0.000000133342 * lnr**3) - 273.15
+
+Calibration.VOLTAGE = Calibration.linear(20.0/1024, -10.0)        # V, ±10V (VernierVoltage)
+Calibration.DIFF_VOLTAGE = Calibration.linear(10.0/1024, -5.0)    # V, ±5V (VernierDiffVoltage)
+Calibration.ACCEL_1D = Calibration.linear(-0.1134, 50.978)        # m/s² (Vernier1DAccelerometer)
+Calibration.THERMISTOR = Calibration.thermistor                   # °C (VernierThermistor)
+
+class SeqCheck:
+    """
+    Checks one source's counts. After a SYNC a port counts its samples from 1, so every count from
+    1 to the highest seen should turn up exactly once. Missing counts are kept as [first, last]
+    ranges, one that turns up later is taken out of its range (reordered) and one that was already
+    seen is a duplicate. In order arrivals only cost a compare.
+    """
+    def __init__(self):
+        self.highest = 0
+        self.received = 0     # distinct counts
+        self.duplicates = 0
+        self.reordered = 0
+        self.gaps = []        # [first, last] of each run of missing counts, oldest first
+
+    def add(self, seq):
+        if seq == self.highest + 1:
+            self.highest = seq
+            self.received += 1
+        elif seq > self.highest:
+            self.gaps.append([self.highest + 1, seq - 1])
+            self.highest = seq
+            self.received += 1
+        elif seq > 0:
+            self._late(seq)
+
+    # a block of counts, the usual unbroken run is checked in one go
+    def add_many(self, seqs):
+        seqs = np.asarray(seqs, dtype=np.int64)
+        if not len(seqs):
+            return
+        if seqs[0] == self.highest + 1 and np.all(np.diff(seqs) == 1):
+            self.highest = int(seqs[-1])
+            self.received += len(seqs)
+            return
+        for seq in seqs.tolist():
+            self.add(seq)
+
+    def _late(self, seq):
+        for i in range(len(self.gaps) - 1, -1, -1):
+            first, last = self.gaps[i]
+            if first <= seq <= last:
+                self.reordered += 1
+                self.received += 1
+                pieces = ([first, seq - 1] if seq > first else None, [seq + 1, last] if seq < last else None)
+                self.gaps[i:i+1] = [g for g in pieces if g]
+                return
+            if last < seq:
+                break
+        self.duplicates += 1
+
+    def missing(self):
+        return sum(last - first + 1 for first, last in self.gaps)
+
+    def report(self, status=None):
+        """
+        The counts as a dict. With the port's binary status from the shield (get_status_binary) the
+        losses are placed: 'dropped' never left the shield (no room on the link), 'lost' left it but
+        didn't arrive and 'missed' are sample periods the shield let go by without a reading.
+        """
+        rep = {'received': self.received, 'highest': self.highest, 'missing': self.missing(),
+               'gaps': [tuple(g) for g in self.gaps], 'duplicates': self.duplicates, 'reordered': self.reordered}
+        if status and 'count' in status:
+            sent = status['count']
+            rep['count'] = sent
+            rep['dropped'] = status.get('dropped', 0)
+            rep['missed'] = status.get('missed', 0)
+            if sent > self.highest:  # the last ones never came
+                rep['missing'] += sent - self.highest
+                rep['gaps'].append((self.highest + 1, sent))
+            rep['lost'] = sent - self.received - rep['dropped']
+            rep['complete'] = self.received == sent
+        return rep
+
+class Capture:
+    """
+    Collects the samples of a run into numpy arrays, one set per source. The arrays are allocated
+    up front for the expected number of points and double when they fill, so adding a sample is
+    just a store. Calibrations are applied to a whole array at once when the values are asked for.
+
+        cap = shield.start_capture([Sources.ANA105], {Sources.ANA105: Calibration.THERMISTOR})
+        ...
+        df = cap.to_dataframe()
+    """
+    def __init__(self, expected=1000, calibrations=None):
+        if np is None:
+            raise ImportError("Capture needs numpy")
+        self.expected = max(int(expected), 16)
+        self.calibrations = dict(calibrations or {})
+        self._seq, self._raw, self._time, self._count = {}, {}, {}, {}
+        self._checks = {}     # SeqCheck by source
+        self.status = {}      # the shield's binary status by source, see VernierShield.check_capture
+
+    # make room for n samples from a source
+    def reserve(self, src, n):
+        have = self._count.get(src, 0)
+        if src in self._raw and len(self._raw[src]) >= n:
+            return
+        size = max(n, self.expected)
+        seq, raw, tim = np.zeros(size, np.uint32), np.zeros(size, np.uint16), np.zeros(size, np.float64)
+        if src in self._raw:
+            seq[:have], raw[:have], tim[:have] = self._seq[src][:have], self._raw[src][:have], self._time[src][:have]
+        self._seq[src], self._raw[src], self._time[src] = seq, raw, tim
+        self._count[src] = have
+
+    # a handler for set_data_dataHandler, called once per sample
+    def add(self, seq, data, deltime, src):
+        n = self._count.get(src, 0)
+        if src not in self._raw or n >= len(self._raw[src]):
+            self.reserve(src, 2 * n)
+        self._seq[src][n] = seq
+        self._raw[src][n] = data
+        self._time[src][n] = deltime
+        self._count[src] = n + 1
+        check = self._checks.get(src)
+        if check is None:
+            check = self._checks[src] = SeqCheck()
+        check.add(seq)
+
+    # add a block of samples from one source (e.g. from shielddecode or a shieldcap file)
+    def add_many(self, src, seq, raw, deltime):
+        n = self._count.get(src, 0)
+        m = len(raw)
+        if src not in self._raw or n + m > len(self._raw[src]):
+            self.reserve(src, max(2 * n, n + m))
+        self._seq[src][n:n+m] = seq
+        self._raw[src][n:n+m] = raw
+        self._time[src][n:n+m] = deltime
+        self._count[src] = n + m
+        self._checks.setdefault(src, SeqCheck()).add_many(seq)
+
+    def clear(self):
+        self._count = {src: 0 for src in self._count}
+        self._checks = {}
+        self.status = {}
+
+    def integrity(self, src=None):
+        """Gaps, duplicates and reordering per source (see SeqCheck.report), for one source or all"""
+        if src is not None:
+            return self._checks.get(src, SeqCheck()).report(self.status.get(src))
+        return {s: self.integrity(s) for s in set(self._checks) | set(self.status)}
+
+    def complete(self):
+        """True if every source has every count from 1 up, to the shield's count if it was asked"""
+        return all(rep['missing'] == 0 for rep in self.integrity().values())
+
+    def sources(self):
+        return [src for src, n in self._count.items() if n]
+
+    def __len__(self):
+        return sum(self._count.values())
+
+    # views of what has been collected, no copies
+    def seq(self, src):
+        return self._seq[src][:self._count.get(src, 0)] if src in self._seq else np.zeros(0, np.uint32)
+
+    def raw(self, src):
+        return self._raw[src][:self._count.get(src, 0)] if src in self._raw else np.zeros(0, np.uint16)
+
+    def time(self, src):
+        return self._time[src][:self._count.get(src, 0)] if src in self._time else np.zeros(0, np.float64)
+
+    # calibrated values for a source (raw as float if it has no calibration)
+    def values(self, src):
+        cal = self.calibrations.get(src)
+        raw = self.raw(src)
+        return cal(raw) if cal is not None else raw.astype(np.float64)
+
+    def to_dataframe(self, sources=None):
+        """The capture as a pandas DataFrame: src, seq, time, raw and value columns"""
+        import pandas as pd
+        sources = self.sources() if sources is None else sources
+        if isinstance(sources, int):
+            sources = [sources]
+        frames = [pd.DataFrame({'src': np.full(self._count.get(src, 0), src, np.uint8), 'seq': self.seq(src),
+                                'time': self.time(src), 'raw': self.raw(src), 'value': self.values(src)})
+                  for src in sources]
+        if not frames:
+            df = pd.DataFrame(columns=['src', 'seq', 'time', 'raw', 'value'])
+        else:
+            df = pd.concat(frames, ignore_index=True)
+        df.attrs['integrity'] = {src: self.integrity(src) for src in sources}
+        return df
+
 class VernierShield:
     """
     This is the object that handles all the communication. We want to minimize the number of blocking routines so
@@ -164,6 +975,47 @@ class VernierShield:
       self.ana02_handler = self.default_blobhandler
       self.string_handler = self.default_stringhandler
 
+      # incoming bytes become records here, see StreamParser
+      self._parser = StreamParser()
+      self._junk_seen = 0
+      self._backlog = deque()         # records parsed but not handled yet
+      self.response_timeout = 2.0     # seconds to wait for an answer to a command
+
+      # analog points per run, sizes the arrays of a Capture
+      self.stop_count = 0
+
+      # clock correlation, see ping() and sync_clock()
+      self.clock = ClockSync()
+      self.ping_interval = None       # seconds between pings sent by loop() or the reader, None for none
+      self._pings = {}                # id: host time the ping was sent
+      self._next_ping = 0
+      self._last_ping = 0.0
+      self._write_lock = threading.Lock()
+      self._read_lock = threading.Lock()   # held from reading the port to queueing the records
+
+      # background reader, see start_reader()
+      self._reader = None
+      self._reader_stop = threading.Event()
+      self._records = queue.Queue()
+
+      # link speed and the bytes we couldn't make sense of since it was set
+      self.link_speed = LinkSpeed.DEFAULT
+      self.link_errors = 0
+      self.link_error_limit = 32
+
+      # tagged commands: next tag to hand out and answers that came back, by tag
+      self._next_tag = 0
+      self._acks = {}
+
+      # reliable streaming, see set_reliable()
+      self.reliable = False
+      self.ack_interval = 0.005       # seconds between acknowledgements while batches come in
+      self.nak_interval = 0.02        # before a missing batch is asked for again
+      self._acked = 0                 # batch we last told the shield we were up to
+      self._ack_time = 0.0
+      self._duplicates = 0
+      self._naks = {}                 # missing batch: when we last asked for it
+
     # context methods for the with construction
     def __enter__(self):
       # future note, if we use context manager library we can expand this a bit:
@@ -197,19 +1049,10 @@ class VernierShield:
     # acknowledgement doesn't mean the command was carried out, it merely means the predicate and its parameters
     # are valid.
     def _acknowledge(self):
-        cc = b''
-        for tries in range(5):
-            cc = self.serPort.read(1)
-            if cc == b'!':
-                return True
-            if cc == b'?':
-                return False
-            time.sleep(0.25)  # wait 1/4 a second
-
-        if cc == b'':
-            raise Exception("Acknowledge timeout", cc)
-        else:
-            raise Exception("Don't understand ack/nak response.", cc)
+        rec = self._await((Records.OK, Records.BAD))
+        if rec is None:
+            raise Exception("Acknowledge timeout")
+        return rec[0] == Records.OK
 
     # if we restarted our machine then this is the string that signals the Arduino is ready
     def open(self, portname="/dev/ttyACM0", wait=2):
@@ -227,15 +1070,17 @@ class VernierShield:
         True if successful
         """
         try:
-            self.serPort = serial.Serial(portname, baudrate=4*115200, timeout=wait)
+            self.serPort = serial.Serial(portname, baudrate=LinkSpeed.BAUD[LinkSpeed.DEFAULT], timeout=wait)
+            self.link_speed = LinkSpeed.DEFAULT
             time.sleep(wait) # the act of opening a port causes the arduino to reset.
             self.logger.info("  open waiting for start", end='')
             for i in range(5):  # Take three shots at this.
                 self.logger.info('.', end='')  # visual feedback
                 if self.serPort.inWaiting() >= len(self.BOOTMSG):
                     handshake = self.serPort.readline()
-                    if self.BOOTMSG in handshake.decode():
-                        self.logger.info(handshake.decode()[:-2] + "-Good")
+                    if self.BOOTMSG in handshake.decode(errors='replace'):
+                        self.logger.info(handshake.decode(errors='replace')[:-2] + "-Good")
+                        self._parser.timeline.armed = 0  # it has just started, nothing is armed
                         return True
                 time.sleep(1.0)  # snooze for a short while
             self.logger.info("Timed out")
@@ -243,38 +1088,254 @@ class VernierShield:
             print(f"Cannot open {portname}. '{err.strerror}' Not found?")
         return False
 
-    # send a command, low level. Builds parameters and waits for response.
-    def send_command(self, predicate, params=[]):
-        self.serPort.write(predicate.to_bytes(1, 'big'))
+    # everything sent to the shield goes through here, the reader thread sends pings too
+    def _write(self, data):
+        with self._write_lock:
+            self.serPort.write(data)
+
+    # send a clock ping, the answer is added to self.clock when it is dispatched. Doesn't wait.
+    def ping(self):
+        ping_id = self._next_ping
+        self._next_ping = (self._next_ping + 1) & 0x3FFF
+        with self._write_lock:
+            self._pings[ping_id] = time.monotonic()
+            self.serPort.write(bytes([Commands.CLK_PING, ping_id >> 7, ping_id & 0x7F]))
+        self._last_ping = time.monotonic()
+        return ping_id
+
+    # ping when ping_interval has passed
+    def _ping_if_due(self):
+        if self.ping_interval and time.monotonic() - self._last_ping >= self.ping_interval:
+            self.ping()
+
+    def sync_clock(self, count=16, interval=0.02):
+        """Ping the shield a number of times to correlate its clock with the host's
+
+        Parameters
+        ----------
+        count : number of pings (default 16)
+        interval : seconds between them (default 0.02)
+
+        Returns
+        -------
+        the ClockSync estimate (see ClockSync.estimate), use shield.clock.to_host() to convert times
+        """
+        for i in range(count):
+            self.ping()
+            rec = self._await((Records.PING,))
+            if rec is not None:
+                self._dispatch(rec)
+            time.sleep(interval)
+        return self.clock.estimate()
+
+    # the bytes for a command, optionally preceded by a TAG
+    @staticmethod
+    def _command_bytes(predicate, params=[], tag=None):
         if isinstance(params, int):  # this handles the case wehere one parameter in a tuple or list is just the value.
             params = [params]
+        cmd = bytearray()
+        if tag is not None:
+            cmd += bytes([Commands.TAG, tag & 0x7F])
+        cmd.append(predicate)
         for i in range(predicate & 0x3):
-            self.serPort.write((params[i] & 0x7F).to_bytes(1, 'big'))
+            cmd.append(params[i] & 0x7F)
+        return bytes(cmd)
+
+    # the ports an ARM arms, the timeline takes a beacon for any other as damage
+    def _track_arming(self, predicate, params):
+        if predicate != Commands.ARM:
+            return
+        with self._read_lock:
+            if self._parser.timeline.armed is not None:
+                self._parser.timeline.armed |= (params if isinstance(params, int) else params[0]) & 0x3F
+
+    # send a command, low level. Builds parameters and waits for response.
+    def send_command(self, predicate, params=[]):
+        self._track_arming(predicate, params)
+        self._write(self._command_bytes(predicate, params))
         return self._acknowledge()
 
+    # send a command with a sequence tag and don't wait. Returns the tag, the answer
+    # turns up in the data stream and is collected by loop()
+    def send_tagged(self, predicate, params=[]):
+        tag = self._next_tag
+        self._next_tag = (self._next_tag + 1) & 0x7F
+        self._acks.pop(tag, None)
+        self._write(self._command_bytes(predicate, params, tag))
+        return tag
+
+    # wait for the answers to tagged commands, data that arrives meanwhile is dispatched as usual
+    def wait_for_acks(self, tags, timeout=2.0):
+        if isinstance(tags, int):
+            tags = [tags]
+        stop = time.monotonic() + timeout
+        while any(t not in self._acks for t in tags):
+            left = stop - time.monotonic()
+            if left <= 0:
+                raise Exception("Acknowledge timeout", [t for t in tags if t not in self._acks])
+            rec = self._next_record(min(left, 0.1))
+            if rec is not None:
+                self._dispatch(rec)
+        return [self._acks.pop(t) for t in tags]
+
+    # send a list of (predicate, params) back to back in one write and collect the answers.
+    def send_batch(self, commands, timeout=2.0):
+        """Send several commands without waiting for each acknowledgement
+
+        Parameters
+        ----------
+        commands : list of (predicate, params) tuples
+        timeout : float, optional
+            seconds to wait for all the answers (default is 2)
+
+        Returns
+        -------
+        list of True (ACK) or False (NAK) in the same order as the commands
+        """
+        tags, batch = [], bytearray()
+        for predicate, params in commands:
+            tag = self._next_tag
+            self._next_tag = (self._next_tag + 1) & 0x7F
+            self._acks.pop(tag, None)
+            tags.append(tag)
+            self._track_arming(predicate, params)
+            batch += self._command_bytes(predicate, params, tag)
+        self._write(bytes(batch))
+        return self.wait_for_acks(tags, timeout)
+
+    # forget everything received so far, including a partly parsed record and whatever the
+    # reader has queued. Takes the read lock so the reader can't be halfway through some bytes.
+    def _flush_input(self):
+        with self._read_lock:
+            self.serPort.reset_input_buffer()
+            self._parser.buffer.clear()
+            self._backlog.clear()
+            while True:
+                try:
+                    self._records.get_nowait()
+                except queue.Empty:
+                    break
+
+    # ask the shield to echo at the current speed
+    def _link_echo(self, pattern=(0x55, 0x2A)):
+        self._flush_input()
+        try:
+            if not self.send_command(Commands.LINK_ECHO, list(pattern)):
+                return False
+            bstr = self.wait_for_response()
+            return bstr is not None and json.loads(bstr.decode('UTF-8'))['echo'] == list(pattern)
+        except Exception:
+            return False
+
+    # switch both ends to a link speed, True if the shield echoes at the new speed
+    def set_link_speed(self, speed=LinkSpeed.M1):
+        """Change the baud rate of the link
+
+        Parameters
+        ----------
+        speed : LinkSpeed index (default is 1M baud)
+
+        Returns
+        -------
+        True if both ends are running at the new speed. If not both ends are
+        returned to the speed they had before.
+        """
+        previous = self.link_speed
+        if not self.send_command(Commands.MDE_LINK, speed):
+            return False
+        self.serPort.baudrate = LinkSpeed.BAUD[speed]
+        time.sleep(0.01)  # let the shield finish switching
+        if self._link_echo():
+            self.link_speed = speed
+            self.link_errors = 0
+            self.logger.info(f"link at {LinkSpeed.BAUD[speed]} baud")
+            return True
+        # the shield falls back on its own, wait for it and go back too
+        self.serPort.baudrate = LinkSpeed.BAUD[previous]
+        time.sleep(LinkSpeed.CONFIRM_S + 0.1)
+        self._flush_input()
+        self.logger.info(f"link at {LinkSpeed.BAUD[speed]} baud failed, back to {LinkSpeed.BAUD[previous]}")
+        return False
+
+    # try the fastest link speeds first and settle on the first one that works
+    def negotiate_link_speed(self, speeds=(LinkSpeed.M2, LinkSpeed.M1)):
+        for speed in speeds:
+            if self.set_link_speed(speed):
+                return LinkSpeed.BAUD[speed]
+        return LinkSpeed.BAUD[self.link_speed]
+
+    # too many bytes we can't place in the stream, drop to the default speed
+    def _link_error(self):
+        self.link_errors += 1
+        if self.link_speed != LinkSpeed.DEFAULT and self.link_errors > self.link_error_limit:
+            self.logger.warning(f"{self.link_errors} stray bytes at {LinkSpeed.BAUD[self.link_speed]} baud, falling back")
+            self.set_link_speed(LinkSpeed.DEFAULT)
+
     # dispatch a recieved datablob to the appropriate handler
     def dispatch_blob(self, raw_datablob):
-        seq, data, deltime, src = self.decode_datablob(raw_datablob)
-        # dispatch converted data
+        self.dispatch_sample(*self.decode_datablob(raw_datablob))
+
+    # dispatch decoded data to the handler for its port
+    def dispatch_sample(self, seq, data, deltime, src):
         if src == Sources.DIG1:
             if self.dig01_handler:
                 self.dig01_handler(seq, data, deltime, src)
         elif src == Sources.DIG2:
             if self.dig02_handler:
                 self.dig02_handler(seq, data, deltime, src)
-        elif (src == Sources.ANA105):
-            if self.ana01_handler:
-                self.ana01_handler(seq, data, deltime, src)
-        elif (src == Sources.ANA110):
+        elif (src == Sources.ANA105) or (src == Sources.ANA110):
             if self.ana01_handler:
                 self.ana01_handler(seq, data, deltime, src)
-        elif (src == Sources.ANA205):
-            if self.ana02_handler:
-                self.ana02_handler(seq, data, deltime, src)
-        elif  (src == Sources.ANA210):
+        elif (src == Sources.ANA205) or (src == Sources.ANA210):
             if self.ana02_handler:
                 self.ana02_handler(seq, data, deltime, src)
 
+    # collect the samples from some sources into a Capture
+    def start_capture(self, chanlist, calibrations=None, expected=None):
+        """Send the samples from the sources to a new Capture
+
+        Parameters
+        ----------
+        chanlist : a source or list of sources
+        calibrations : optional dict of source to Calibration
+        expected : points per source to allocate for, default is the stop condition
+
+        Returns
+        -------
+        the Capture, it fills up as loop() (or the reader) dispatches the samples
+        """
+        if isinstance(chanlist, int):
+            chanlist = [chanlist]
+        capture = Capture(expected or self.stop_count or 1000, calibrations)
+        for src in chanlist:
+            capture.reserve(src, capture.expected)
+            self.set_data_dataHandler(src, capture.add)
+        return capture
+
+    # once a run is over, compare what a capture got with what the shield says it sent
+    def check_capture(self, capture):
+        """Account for every sample of a finished capture
+
+        Asks the shield for the count, dropped and missed fields of each of the capture's sources
+        and keeps them with the capture, so integrity() can tell samples the shield dropped from
+        ones lost on the way. Call it after the ports have stopped (stop count or halt_data()),
+        samples still arriving are added to the capture while it waits.
+
+        Returns
+        -------
+        capture.integrity(), dict of source to report (see SeqCheck.report)
+        """
+        sources = capture.sources() or list(capture._checks)
+        if sources:
+            status = self.get_status_binary(sources)
+            if isinstance(status, dict):
+                capture.status.update(status)
+        return capture.integrity()
+
+    # dispatch an already decoded event to the handler for its port
+    def dispatch_event(self, seq, data, deltime, src):
+        self.dispatch_sample(seq, data, deltime, src)
+
     # halt the data taking
     def halt_data(self):
         return self.send_command(Commands.HALT)
@@ -286,43 +1347,207 @@ class VernierShield:
         chanlist.append(0)
         chanlist.reverse()
         chan = reduce(lambda sm, e: sm + (1 << (e-1)), chanlist)
+        self._reset_events()
         return self.send_command(Commands.ARM, chan)
 
     def sync_clocks(self):
+        self._reset_events(sync=True)
         return self.send_command(Commands.MDE_SYNC)
 
+    # choose how digital events are sent back: full datablobs or compact events
+    def set_digital_encoding(self, encoding=EventEncoding.COMPACT):
+        return self.send_command(Commands.MDE_DEVENT, encoding)
+
+    # clear the running event clocks. The firmware re-anchors after SYNC and ARM, and after a SYNC
+    # its clock and counts start again from 0 too. The reader thread decodes with the same state,
+    # so it is only touched under the read lock.
+    def _reset_events(self, sync=False):
+        with self._read_lock:
+            self._parser.reset_events()
+            if sync:
+                self._parser.timeline.reset()
+                self.clock.reset()
+
     # displatch a received string
     def dispatch_string(self, raw_string):
         if self.string_handler:
-            self.string_handler(raw_string[:-2].decode("utf-8"))
+            self.string_handler(raw_string.decode("utf-8"))
 
-    # call this routine regularly, It scans the serial port for characters and dispatches the correct handle based
-    # based on characters it gets.  This intended to be non-blocking
+    # hand a record to whoever wants it
+    def _dispatch(self, rec):
+        kind = rec[0]
+        if kind == Records.BLOB or kind == Records.EVENT:
+            self.dispatch_sample(*rec[1:])
+        elif kind == Records.STRING:
+            self.dispatch_string(rec[1])
+        elif kind == Records.ACK or kind == Records.NAK:
+            self._acks[rec[1]] = kind == Records.ACK
+        elif kind == Records.PING:
+            sent = self._pings.pop(rec[1], None)
+            if sent is not None:
+                self.clock.add(sent, rec[5], rec[2], rec[3], rec[4], LinkSpeed.BAUD[self.link_speed])
+        # anything else is an answer nobody is waiting for any more
+
+    # the next record, waiting no more than timeout seconds. None if there isn't one.
+    # With the reader running the records come from its queue, otherwise from the port.
+    def _next_record(self, timeout=0.0):
+        if self._backlog:
+            return self._backlog.popleft()
+        if self._reader is not None or not self._records.empty():
+            try:
+                return self._records.get(timeout=timeout) if timeout > 0 else self._records.get_nowait()
+            except queue.Empty:
+                return None
+        stop = time.monotonic() + timeout
+        while True:
+            waiting = self.serPort.inWaiting()
+            if waiting:
+                with self._read_lock:
+                    data = self.serPort.read(waiting)
+                    self._backlog.extend(self._parser.feed(data, time.monotonic()))
+                if self.reliable:
+                    self._answer_batches()
+                if self._backlog:
+                    return self._backlog.popleft()
+            elif time.monotonic() >= stop:
+                return None
+            else:
+                if self.reliable:
+                    self._answer_batches()  # the last acknowledgement may have been held back
+                time.sleep(0.001)
+
+    # wait for a record of one of the kinds, anything else that turns up is dispatched as usual
+    def _await(self, kinds, timeout=None):
+        stop = time.monotonic() + (self.response_timeout if timeout is None else timeout)
+        while True:
+            left = stop - time.monotonic()
+            if left <= 0:
+                return None
+            rec = self._next_record(left)
+            if rec is None:
+                return None
+            if rec[0] in kinds:
+                return rec
+            self._dispatch(rec)
+
+    # call this routine regularly, It takes whatever has come in from the shield and dispatches
+    # the records to their handlers. This never blocks.
     def loop(self):
-        if self.serPort.inWaiting() > 0:
-            # get a single character
-            cc = self.serPort.read(1)
-            if cc == b'\xAA':  # signal the start of a data blob
-                # gather 7 additional bytes
-                raw_datablob = self.serPort.read(
-                    7)  # if we got the starting 0xAA these should come in the requisite timeout
-                self.dispatch_blob(raw_datablob)
-            if cc == b' ':  # signal we are getting a string
-                raw_string = self.serPort.readline()
-                self.dispatch_string(raw_string)
+        if self._reader is None:
+            self._ping_if_due()
+        while True:
+            rec = self._next_record()
+            if rec is None:
+                break
+            self._dispatch(rec)
+        while self._junk_seen < self._parser.junk:  # bytes that weren't the start of anything we know
+            self._junk_seen += 1
+            self._link_error()
 
     # this is a blocking routine that seeks to get either a string or a datablob response. This is a tool to be
     # used for immediate commands like data reads or status
     def wait_for_response(self):
-        # wait for the first character and allow a timeout if it doesn't happen
-        cc = self.serPort.read(1)
-        if cc == b'\xAA':  # signal the start of a data blob
-            # gather 7 additional bytes
-            rawdatablob = self.serPort.read(7)  # if we got the starting 0xAA these should come in the requisite timeout
-            return self.decode_datablob(rawdatablob)
-        elif cc == b' ':  # signal we are getting a string
-            rawstring = self.serPort.readline()
-            return rawstring[:-2]
+        rec = self._await((Records.BLOB, Records.STRING))
+        if rec is None:
+            return None
+        if rec[0] == Records.BLOB:
+            return rec[1], rec[2], rec[3], rec[4]
+        return rec[1]
+
+    # read the shield on a background thread. loop(), run_loop() and the commands all take
+    # their records from it so a notebook can keep working while a capture runs.
+    def start_reader(self, poll=0.05):
+        """Start reading the port on a background thread
+
+        Parameters
+        ----------
+        poll : float, optional
+            longest the reader waits on the port before checking whether it should stop
+        """
+        if self._reader is not None:
+            return
+        self._port_timeout = self.serPort.timeout
+        self.serPort.timeout = poll
+        self._reader_stop.clear()
+        self._reader = threading.Thread(target=self._read_forever, name="VernierShieldReader", daemon=True)
+        self._reader.start()
+
+    # stop the background reader, records it already parsed are still handed out by loop()
+    def stop_reader(self):
+        if self._reader is None:
+            return
+        self._reader_stop.set()
+        self._reader.join()
+        self._reader = None
+        self.serPort.timeout = self._port_timeout
+
+    # the reader thread: read everything that is waiting in one go (or wait for the next byte)
+    def _read_forever(self):
+        while not self._reader_stop.is_set():
+            with self._read_lock:  # a flush waits for this at most one port timeout
+                try:
+                    data = self.serPort.read(self.serPort.inWaiting() or 1)
+                except serial.SerialException as err:
+                    self.logger.warning(f"reader stopped: {err}")
+                    break
+                for rec in self._parser.feed(data, time.monotonic()):
+                    self._records.put(rec)
+            if self.reliable:
+                self._answer_batches()
+            self._ping_if_due()
+
+    def set_reliable(self, on=True):
+        """Turn reliable streaming on or off
+
+        With it on the shield sends its data in numbered batches with a CRC and keeps each one until
+        we acknowledge it. Batches that are lost or arrive damaged are asked for again and their
+        records are handed out in order once the gap is filled, so a capture over a link that loses
+        the odd byte still gets every sample. The acknowledgements go out as the data is read, by
+        loop(), run_loop(), the reader or anything waiting for an answer, so keep reading while it is
+        on: a shield that hears nothing for a while sends the oldest batch again, then gives up on it,
+        and once its transmit ring is full of batches it drops new data (see get_link_status and the dropped field of
+        get_status_binary). Turn it off after the run has been drained.
+
+        Returns
+        -------
+        True if the shield took it
+        """
+        self.reliable = self._parser.reliable = False
+        self._parser.batches.reset()
+        self._acked = 0
+        self._duplicates = 0
+        self._naks = {}
+        if not self.send_command(Commands.MDE_RELIABLE, 1 if on else 0):
+            return False
+        self.reliable = self._parser.reliable = on
+        return True
+
+    # tell the shield which batches we have and ask again for the ones that went missing
+    def _answer_batches(self):
+        window = self._parser.batches
+        now = time.monotonic()
+        ahead = (window.next - self._acked) & BatchWindow.MASK
+        if (ahead and (ahead >= 4 or now - self._ack_time >= self.ack_interval)) \
+                or window.duplicates != self._duplicates:  # resent: our acknowledgement was lost
+            self._acked = window.next
+            self._ack_time = now
+            self._duplicates = window.duplicates
+            self._write(bytes([Commands.RTX_ACK, window.next >> 7, window.next & 0x7F]))
+        due = []  # missing batches we haven't asked for lately, as (first, count)
+        for first, count in window.missing():
+            for i in range(count):
+                seq = (first + i) & BatchWindow.MASK
+                if now - self._naks.get(seq, 0) < self.nak_interval:
+                    continue
+                self._naks[seq] = now
+                if due and (due[-1][0] + due[-1][1]) & BatchWindow.MASK == seq and due[-1][1] < 0x7F:
+                    due[-1][1] += 1
+                else:
+                    due.append([seq, 1])
+        for first, count in due:
+            self._write(bytes([Commands.RTX_NAK, first >> 7, first & 0x7F, count]))
+        if len(self._naks) > 4 * BatchWindow.HOLD:  # forget the ones that turned up long ago
+            self._naks = {k: v for k, v in self._naks.items() if (k - window.next) & BatchWindow.MASK < BatchWindow.HOLD}
 
     # convenience tool for blinking the
     def blink_led(self, times=1, period=0):
@@ -360,9 +1585,53 @@ class VernierShield:
         param1 = (level >> 7) + (condition << 5) + (channel << 3)
         return self.send_command(Commands.MDE_ATRIG, [param1, param2])
 
+    # set up the whole experiment with one command.
+    def configure_experiment(self, arm=None, rate=SampleRates.S_10_HZ, stop=100,
+                             trigger=Trigger.IMMEDIATE, level=512, digital=Trigger.ANY,
+                             sync=True, compact=False, ports=None):
+        """Configure rates, triggers, stop conditions, digital edges and arming in one shot
+
+        The shield checks the whole frame before it changes anything, then halts,
+        configures, syncs and arms all the ports together.
+
+        Parameters
+        ----------
+        arm : list of Sources to arm when done, optional (default: configure but don't arm)
+        rate : SampleRates index for the analog ports (default 10Hz)
+        stop : number of analog points, 0 for no limit (default 100)
+        trigger, level : analog trigger condition and raw level (default immediate)
+        digital : digital transition to time (default ANY)
+        sync : sync the clocks before arming (default True)
+        compact : send digital transitions as compact events (default False)
+        ports : optional dict of Sources to dicts overriding rate, stop, trigger, level
+                (analog) or digital (digital) for that port
+
+        Returns
+        -------
+        True if the shield accepted and applied the configuration
+        """
+        ports = ports or {}
+        self.stop_count = max([int(stop)] + [int(p['stop']) for p in ports.values() if 'stop' in p])
+        flags = (0x01 if sync else 0) | (0x02 if compact else 0) | (0x04 if arm else 0)
+        mask = reduce(lambda sm, e: sm | (1 << (e-1)), arm or [], 0)
+        cfg = [flags, mask]
+        for src in (Sources.ANA105, Sources.ANA205, Sources.ANA110, Sources.ANA210):
+            p = ports.get(src, {})
+            s_stop = int(p.get('stop', stop))
+            trig = (p.get('trigger', trigger) << 12) | (p.get('level', level) & 0x3FF)
+            cfg += [src, p.get('rate', rate), 0x7F & (s_stop >> 7), 0x7F & s_stop, 0x7F & (trig >> 7), 0x7F & trig]
+        for src in (Sources.DIG1, Sources.DIG2):
+            cfg += [src, ports.get(src, {}).get('digital', digital)]
+        frame = bytes([Commands.MDE_CONFIG, len(cfg)] + [b & 0x7F for b in cfg] + [sum(cfg) & 0x7F])
+        self._reset_events(sync)
+        self._track_arming(Commands.ARM, mask)
+        self._write(frame)
+        return self._acknowledge()
+
     # set the stop condition for the analog channel.
     def set_stop_condition(self, num_points):
         num_points = int(num_points)  # in case someone passed a float
+        self.stop_count = num_points
         return self.send_command(Commands.MDE_ASTOP, [0x7F & (num_points >> 7), 0x7F & num_points])
 
     # get details of analog status
@@ -409,6 +1678,59 @@ class VernierShield:
             #     return f"json: {ans}"
         return "Communication Failed."
 
+    # get the status of the ports as binary records, cheap enough to use during a capture
+    def get_status_binary(self, chanlist=None):
+        """Get the status of the ports without the JSON
+
+        Parameters
+        ----------
+        chanlist: a single channel or a list of channel's to report on: optional (default is all 4)
+
+        Returns
+        -------
+        dictionary keyed by source of the raw status fields
+        """
+        if chanlist is None:
+            chanlist = [Sources.ANA105, Sources.ANA205, Sources.DIG1, Sources.DIG2]
+        if isinstance(chanlist, int):
+            chanlist = [chanlist]
+        chan = reduce(lambda sm, e: sm | (1 << (e-1)), chanlist, 0)
+        if self.send_command(Commands.ST_PORTSB, chan):
+            ans = {}
+            for i in range(len(chanlist)):
+                rec = self._await((Records.STATUS,))
+                if rec is None:
+                    return f"err: {ans}"
+                ans[rec[1]['src']] = rec[1]
+            return ans
+        return "Communication Failed."
+
+    # read several ports at the same moment in a single round trip
+    def get_snapshot(self, chanlist=None):
+        """Read the current value of several ports at once
+
+        Parameters
+        ----------
+        chanlist: a single source or a list of sources: optional (default is every port and the button)
+
+        Returns
+        -------
+        dictionary with 'time' (μs since sync) and the raw reading keyed by source,
+        digital ports and the button read as True/False
+        """
+        if chanlist is None:
+            chanlist = [Sources.DIG1, Sources.DIG2, Sources.ANA105, Sources.ANA205,
+                        Sources.ANA110, Sources.ANA210, Sources.BTN]
+        if isinstance(chanlist, int):
+            chanlist = [chanlist]
+        mask = reduce(lambda sm, e: sm | (1 << (e-1)), chanlist, 0)
+        if not self.send_command(Commands.IMM_SNAP, mask):
+            return "Communication Failed."
+        rec = self._await((Records.SNAPSHOT,))
+        if rec is None:
+            return "err: no snapshot"
+        return rec[1]
+
     # set the conditions for the digital trigger
     def set_digital_trigger(self, trigger_conditions=[Trigger.ANY]):
         # print("set_digital_trigger")
@@ -437,6 +1759,76 @@ class VernierShield:
             return bstr.decode('UTF-8')
         return "Communication Failed."
 
+    # get the state of the shield's transmit ring
+    def get_link_status(self):
+        """Get the transmit statistics of the shield
+
+        Parameters
+        ----------
+
+        Returns
+        -------
+        dictionary with txsize (transmit ring size), hiwater (most bytes ever queued),
+        stall (microseconds spent waiting for room), dropped and frames (bytes and frames
+        thrown away because the link couldn't keep up), rxerrors (receive framing errors),
+        reliable (1 in reliable streaming), resent and expired (batches sent again, and given
+        up on before we had them) and baud (the current link speed)
+        """
+        if self.send_command(Commands.ST_LINK):
+            bstr = self.wait_for_response()
+            return json.loads(bstr.decode('UTF-8'))
+        return "Communication Failed."
+
+    def get_stats(self, clear=False):
+        """Get the shield's timing histograms and free RAM
+
+        Parameters
+        ----------
+        clear : empty the histograms after reading them (the RAM low water mark is kept)
+
+        Returns
+        -------
+        dictionary with loop (time per trip round loop()), stall (time spent waiting for room to
+        transmit), command (last command byte in to handled) and poll (source: cost of each port's
+        poll, see Sources) histograms, and ram ({'free', 'low'} bytes, low is the least ever free).
+        Each histogram is {'max': longest in μs, 'counts': count per bucket}, Stats.BUCKETS has the
+        lower edge of each bucket in μs. Counts are all halved when one fills up so they are relative.
+        Firmware built without SHIELD_STATS (the plain uno image) only has the ram.
+        """
+        if not self.send_command(Commands.ST_STATS, 1 if clear else 0):
+            return "Communication Failed."
+        stats = {'poll': {}}
+        while True:
+            rec = self._await((Records.STATS,))
+            if rec is None:
+                return "Communication Failed."
+            if rec[1] == Stats.RAM:  # always last
+                stats['ram'] = rec[2]
+                return stats
+            if rec[1] & Stats.POLL:
+                stats['poll'][rec[1] & 0x0F] = rec[2]
+            else:
+                stats[Stats.NAMES.get(rec[1], rec[1])] = rec[2]
+
+    def get_trace(self, clear=False):
+        """Dump the shield's trace ring (firmware built with SHIELD_TRACE, see lib/ShieldTrace)
+
+        Parameters
+        ----------
+        clear : empty the ring after reading it
+
+        Returns
+        -------
+        list of (time, name) oldest first, time in μs on the shield's micros() clock, and the
+        number of points the ring had already lost. Empty without SHIELD_TRACE.
+        """
+        if not self.send_command(Commands.ST_TRACE, 1 if clear else 0):
+            return "Communication Failed."
+        rec = self._await((Records.TRACE,))
+        if rec is None:
+            return "Communication Failed."
+        return [(t, Trace.NAMES.get(id, hex(id))) for t, id in rec[1]], rec[2]
+
     # close the serial port
     def close(self):
         """Close the open port
@@ -447,11 +1839,18 @@ class VernierShield:
         Returns
         -------
         """
+        self.stop_reader()
         self.serPort.close()
 
-    # timed loop, run loop for a set time.  Will block for specified time
+    # timed loop, run loop for a set time.  Will block for specified time but sleeps while nothing arrives
     def run_loop(self, timelimit=10.0):
-        now = time.monotonic()
-        while (time.monotonic()-now) < timelimit:
-            self.loop()
+        stop = time.monotonic() + timelimit
+        while True:
+            left = stop - time.monotonic()
+            if left <= 0:
+                break
+            rec = self._next_record(min(left, 0.1))
+            if rec is not None:
+                self._dispatch(rec)
+                self.loop()
 
@@ -0,0 +1,160 @@
+"""
+shieldsweep: how much the shield and this client keep up with.
+
+Runs every combination of analog sources, sample rate and link speed for a few seconds each
+against a shield, or the native firmware behind a pseudo-terminal (see native/readme.md), and
+prints a table with the samples delivered per second, the samples lost (the shield's own count of
+what it took less what arrived) and how many of those the shield dropped itself for lack of room
+on the link, how far the times between samples stray from the requested period and the CPU this
+process used.
+
+    python shieldsweep.py -p /dev/ttyACM0
+    python shieldsweep.py -p /tmp/ttyShield -c ANA105 -c ANA105,ANA205 -r S_1K_HZ -r FASTEST -l M1 -t 10 -j run.jsonl
+
+-c, -r and -l can be given more than once and default to the sweep below. Names are the ones in
+Sources, SampleRates and LinkSpeed. -j writes one JSON object per configuration as well.
+"""
+
+import argparse
+import json
+import math
+import sys
+import time
+
+from VernierShieldCommunication import VernierShield, Sources, SampleRates, LinkSpeed
+
+SOURCES = [[Sources.ANA105],
+           [Sources.ANA105, Sources.ANA205],
+           [Sources.ANA105, Sources.ANA205, Sources.ANA110, Sources.ANA210]]
+RATES = [SampleRates.S_100_HZ, SampleRates.S_500_HZ, SampleRates.S_1K_HZ, SampleRates.FASTEST]
+SPEEDS = [LinkSpeed.DEFAULT, LinkSpeed.M1, LinkSpeed.M2]
+DRAIN_S = 0.2  # after the halt, for what was already on its way
+
+def names(cls):
+    return {v: k for k, v in vars(cls).items() if k.isupper() and isinstance(v, int)}
+
+SOURCE_NAMES = names(Sources)
+RATE_NAMES = names(SampleRates)
+
+class Collector:
+    """every sample's count and time, by source"""
+    def __init__(self, chanlist):
+        self.seq = {src: [] for src in chanlist}
+        self.time = {src: [] for src in chanlist}
+
+    def add(self, seq, data, deltime, src):
+        if src in self.seq and seq > 0:
+            self.seq[src].append(seq)
+            self.time[src].append(deltime)
+
+def measure(collector, period_us, status):
+    """lost samples and the deviation from the period (μs) between consecutive ones. The shield's
+    count (from get_status_binary) says how many it took, without one the last count that arrived
+    is all there is and anything lost after it goes unnoticed"""
+    received = lost = gaps = 0
+    devs = []
+    for src, seqs in collector.seq.items():
+        times = collector.time[src]
+        received += len(seqs)
+        taken = status.get(src, {}).get('count', max(seqs, default=0))  # counted from SYNC
+        lost += max(taken - len(set(seqs)), 0)
+        if not seqs:
+            continue
+        for i in range(1, len(seqs)):
+            step = seqs[i] - seqs[i-1]
+            if step != 1:
+                gaps += 1
+                continue
+            devs.append((times[i] - times[i-1]) * 1e6)
+    if devs and period_us is None:  # FASTEST: against the typical period
+        period_us = sorted(devs)[len(devs) // 2]
+    devs = [d - period_us for d in devs]
+    rms = math.sqrt(sum(d * d for d in devs) / len(devs)) if devs else float('nan')
+    worst = max((abs(d) for d in devs), default=float('nan'))
+    return received, lost, gaps, period_us, rms, worst
+
+def run(shield, chanlist, rate, seconds):
+    """one configuration, None if the shield didn't take it"""
+    collector = Collector(chanlist)
+    for src in chanlist:
+        shield.set_data_dataHandler(src, collector.add)
+    junk = shield._parser.junk
+    if not shield.configure_experiment(arm=chanlist, rate=rate, stop=0):
+        return None
+    start = time.monotonic()
+    cpu = time.process_time()
+    shield.run_loop(seconds)
+    shield.halt_data()
+    wall = time.monotonic() - start
+    cpu = time.process_time() - cpu
+    shield.run_loop(DRAIN_S)
+    status = shield.get_status_binary(chanlist)  # the shield's side of the losses
+    status = status if isinstance(status, dict) else {}
+    asked = SampleRates.PERIOD_US.get(rate)
+    received, lost, gaps, period, rms, worst = measure(collector, asked, status)
+    expected = len(chanlist) * 1e6 / asked if asked else float('nan')
+    return {'sources': [SOURCE_NAMES[s] for s in chanlist], 'rate': RATE_NAMES[rate],
+            'baud': LinkSpeed.BAUD[shield.link_speed], 'seconds': round(wall, 3),
+            'received': received, 'per_s': received / wall, 'expected_per_s': expected,
+            'lost': lost, 'lost_pct': 100.0 * lost / (received + lost) if received + lost else 0.0,
+            'dropped': sum(st.get('dropped', 0) for st in status.values()),
+            'missed': sum(st.get('missed', 0) for st in status.values()),
+            'gaps': gaps, 'period_us': period, 'jitter_rms_us': rms, 'jitter_max_us': worst,
+            'cpu_pct': 100.0 * cpu / wall, 'junk': shield._parser.junk - junk}
+
+HEADER = f"{'sources':<32} {'rate':<9} {'baud':>8} {'per s':>8} {'asked':>8} {'lost':>7} {'lost%':>6} {'drop':>6} " \
+         f"{'rms μs':>8} {'max μs':>8} {'cpu%':>5}"
+
+def row(r):
+    return f"{'+'.join(r['sources']):<32} {r['rate']:<9} {r['baud']:>8} {r['per_s']:>8.1f} " \
+           f"{r['expected_per_s']:>8.1f} {r['lost']:>7} {r['lost_pct']:>6.2f} {r['dropped']:>6} " \
+           f"{r['jitter_rms_us']:>8.1f} {r['jitter_max_us']:>8.1f} {r['cpu_pct']:>5.1f}"
+
+def lookup(cls, name):
+    try:
+        return getattr(cls, name.strip().upper())
+    except AttributeError:
+        raise argparse.ArgumentTypeError(f"no {cls.__name__}.{name}")
+
+def main():
+    parser = argparse.ArgumentParser(description="sweep sources, rates and link speeds")
+    parser.add_argument('-p', '--port', default='/dev/ttyACM0')
+    parser.add_argument('-c', '--sources', action='append',
+                        type=lambda s: [lookup(Sources, n) for n in s.split(',')])
+    parser.add_argument('-r', '--rate', action='append', type=lambda s: lookup(SampleRates, s))
+    parser.add_argument('-l', '--link', action='append', type=lambda s: lookup(LinkSpeed, s))
+    parser.add_argument('-t', '--seconds', type=float, default=5.0, help="per configuration")
+    parser.add_argument('-j', '--json', help="also write the results here, one object a line")
+    args = parser.parse_args()
+
+    shield = VernierShield()
+    shield.string_handler = None
+    if not shield.open(args.port):
+        print(f"shieldsweep: no shield on {args.port}", file=sys.stderr)
+        return 1
+    out = open(args.json, 'w') if args.json else None
+    print(HEADER)
+    try:
+        for speed in args.link or SPEEDS:
+            if speed != shield.link_speed and not shield.set_link_speed(speed):
+                print(f"{'link at ' + str(LinkSpeed.BAUD[speed]) + ' baud failed, skipped':<32}")
+                continue
+            for rate in args.rate or RATES:
+                for chanlist in args.sources or SOURCES:
+                    r = run(shield, chanlist, rate, args.seconds)
+                    if r is None:
+                        print(f"{'+'.join(SOURCE_NAMES[s] for s in chanlist):<32} {RATE_NAMES[rate]:<9} not accepted")
+                        continue
+                    print(row(r), flush=True)
+                    if out:
+                        out.write(json.dumps({k: None if v != v else v for k, v in r.items()}) + '\n')  # NaN
+        if shield.link_speed != LinkSpeed.DEFAULT:
+            shield.set_link_speed(LinkSpeed.DEFAULT)
+    finally:
+        if out:
+            out.close()
+        shield.close()
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
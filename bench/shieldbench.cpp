@@ -0,0 +1,423 @@
+/****************************************************************
+*  shieldbench
+*  Cycle counts for the firmware's hot paths, taken by running the real
+*  [env:uno_bench] image in simavr (an ATmega328P simulator).
+*
+*  That image is built with -D SHIELD_BENCH so the stretches of code
+*  marked in lib/ShieldBench/ShieldBench.h write their id to GPIOR0 as
+*  they start and id|0x80 as they end. Each scenario boots a fresh
+*  simulated Uno, waits for *HELLO*, sends its commands, drives the
+*  analog inputs and the gates and records the cycles between every
+*  start and end for the measured stretch of simulated time.
+*
+*  usage: shieldbench [-t seconds] [-s scenario]... [-i pin=signal]... [-S seed]
+*                     [-b before.jsonl] [-l] [firmware.elf]
+*     -t  simulated seconds measured per scenario, default 1
+*     -s  only run this scenario (repeatable), -l lists them
+*     -i  drive an input from a synthetic source instead of the scenario's
+*         stimulus (see native/Signals), e.g. -i D2=pendulum:2,0.02
+*     -S  seed for the noisy sources, default 1
+*     -b  earlier results, prints a before/after table on stderr
+*  The firmware defaults to .pio/build/uno_bench/firmware.elf.
+*
+*  Results go to stdout, one JSON object per scenario and marker with
+*  the calls measured and the min, median, p99, max and mean cycles per
+*  call (16 to the μs):
+*     {"scenario":"ana2_fast","marker":"analog_poll","calls":...,"min":...,
+*      "median":...,"p99":...,"max":...,"mean":...}
+****************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <sim_avr.h>
+#include <sim_elf.h>
+#include <sim_io.h>
+#include <sim_irq.h>
+#include <sim_time.h>
+#include <sim_cycle_timers.h>
+#include <avr_adc.h>
+#include <avr_ioport.h>
+#include <avr_uart.h>
+
+#include "ShieldParser.h"
+#include "Signals.h"
+
+#define FREQUENCY   16000000
+#define GPIOR0_ADDR 0x3E      // data space address of GPIOR0 (I/O 0x1E)
+#define BOOT_LIMIT  5.0       // seconds to wait for *HELLO*
+#define SETTLE      0.1       // seconds between the commands and measuring
+#define PINS        20        // D0..D13, A0..A5
+#define A0_PIN      14
+#define INPUT_US    5         // how often driven digital inputs are looked at
+
+// names of the ids in ShieldBench.h
+static const char* const MARKERS[] = {
+   nullptr, "loop", "commands", "analog_poll", "digital_poll", "send_blob", "send_event", "beacon"
+};
+#define MARKER_COUNT (sizeof(MARKERS) / sizeof(MARKERS[0]))
+
+/**
+ * What the shield is asked to do and what its inputs see
+ **/
+struct Scenario {
+   const char* name;
+   const char* about;
+   const char* commands;   // hex bytes, as shieldcap -c
+   unsigned    gateHz;     // square wave on DIG1 (DIG2 at half that), 0 for none
+};
+
+static const Scenario SCENARIOS[] = {
+   { "idle",         "nothing armed, the cost of an empty loop()",       "d0",                             0 },
+   { "ana1_10hz",    "one analog input at the default 10Hz",             "d0 b2 00 00 85 04",              0 },
+   { "ana1_fast",    "one analog input as fast as it goes",              "d0 ad 01 b2 00 00 85 04",        0 },
+   { "ana2_fast",    "both 5V analog inputs as fast as they go",         "d0 ad 01 b2 00 00 85 0c",        0 },
+   { "ana4_fast",    "all four analog inputs as fast as they go",        "d0 ad 01 b2 00 00 85 3c",        0 },
+   { "dig2_1khz",    "both gates, 1kHz square waves, events as blobs",   "d0 b9 33 85 03",                 1000 },
+   { "dig2_compact", "both gates, 1kHz square waves, compact events",    "d0 d5 01 b9 33 85 03",           1000 },
+   { "all_fast",     "every port, analog as fast as it goes, 1kHz gates", "d0 ad 01 b2 00 00 b9 33 85 3f", 1000 },
+};
+#define SCENARIO_COUNT (sizeof(SCENARIOS) / sizeof(SCENARIOS[0]))
+
+/**
+ * The samples aren't needed, the parser's own counts (getCounts()) of
+ * what the firmware sent show the scenario did what it says
+ **/
+class StreamCounter : public ShieldParser::Handler {
+public:
+   void sample( const ShieldSample& ) override {}
+};
+
+/**
+ * One simulated Uno running one scenario
+ **/
+struct Run {
+   avr_t*               avr;
+   const Scenario*      scenario;
+   avr_irq_t*           adc[4];
+   avr_irq_t*           gate[2];
+   avr_irq_t*           uartIn;
+   SIGNALS::Pin         inputs[PINS];    // -i, replacing the default stimulus
+   avr_irq_t*           pin[PINS];
+   avr_cycle_count_t    gatePeriod;
+   uint32_t             gateTicks;
+   std::vector<uint8_t> received;        // everything from the UART
+   bool                 booted;          // *HELLO* line seen
+   bool                 measuring;
+   avr_cycle_count_t    windowStart;
+   avr_cycle_count_t    begin[128];      // cycle each marker last started at
+   std::vector<uint32_t> cycles[MARKER_COUNT];
+};
+
+/**
+ * GPIOR0 writes: id to start, id|0x80 to end
+ **/
+static void markerWrite( avr_t* avr, avr_io_addr_t, uint8_t v, void* param ) {
+   Run* run = (Run*)param;
+   uint8_t id = v & 0x7F;
+   if ( !(v & 0x80) ) {
+      run->begin[id] = avr->cycle;
+      return;
+   }
+   if ( run->measuring && id < MARKER_COUNT && run->begin[id] >= run->windowStart )
+      run->cycles[id].push_back( (uint32_t)(avr->cycle - run->begin[id]) );
+   run->begin[id] = 0;
+}
+
+static void uartOut( avr_irq_t*, uint32_t value, void* param ) {
+   Run* run = (Run*)param;
+   run->received.push_back( (uint8_t)value );
+   if ( value == '\n' ) run->booted = true;
+}
+
+/**
+ * Slow triangles between 0.5V and 4.5V, a different period on each input
+ **/
+static avr_cycle_count_t analogTick( avr_t* avr, avr_cycle_count_t when, void* param ) {
+   Run* run = (Run*)param;
+   uint64_t us = avr_cycles_to_usec( avr, when );
+   for ( int ch = 0; ch < 4; ch++ ) {
+      if ( run->inputs[A0_PIN + ch] ) {
+         // the middle of the count the signal asks for
+         uint32_t counts = run->inputs[A0_PIN + ch]( us * 1000 );
+         avr_raise_irq( run->adc[ch], (counts * 5000 + 2500) / 1024 );
+         continue;
+      }
+      uint64_t period = 20000 * (ch + 1);
+      uint64_t phase = us % period;
+      uint64_t ramp = phase < period / 2 ? phase : period - phase;
+      avr_raise_irq( run->adc[ch], (uint32_t)(500 + ramp * 8000 / period) );
+   }
+   return when + avr_usec_to_cycles( avr, 100 );
+}
+
+static avr_cycle_count_t gateTick( avr_t*, avr_cycle_count_t when, void* param ) {
+   Run* run = (Run*)param;
+   run->gateTicks++;
+   if ( !run->inputs[2] ) avr_raise_irq( run->gate[0], run->gateTicks & 1 );
+   if ( !run->inputs[6] ) avr_raise_irq( run->gate[1], (run->gateTicks >> 1) & 1 );
+   return when + run->gatePeriod;
+}
+
+static avr_cycle_count_t inputTick( avr_t* avr, avr_cycle_count_t when, void* param ) {
+   Run* run = (Run*)param;
+   uint64_t ns = avr_cycles_to_nsec( avr, when );
+   for ( int p = 0; p < A0_PIN; p++ )
+      if ( run->inputs[p] ) avr_raise_irq( run->pin[p], run->inputs[p]( ns ) );
+   return when + avr_usec_to_cycles( avr, INPUT_US );
+}
+
+/**
+ * "85 7f" -> { 0x85, 0x7F }
+ **/
+static bool parseHex( const char* arg, std::vector<uint8_t>& out ) {
+   while ( *arg ) {
+      if ( *arg == ' ' || *arg == ',' ) {
+         arg++;
+         continue;
+      }
+      char* end;
+      unsigned long v = strtoul( arg, &end, 16 );
+      if ( end == arg || v > 0xFF ) return false;
+      out.push_back( (uint8_t)v );
+      arg = end;
+   }
+   return true;
+}
+
+/**
+ * "A0=sine:1,2,2.5" into inputs. A1 and A3 are the BTA ±10V inputs, the
+ * other analog pins 0..5V, anything else a digital level.
+ **/
+static bool parseInput( const char* arg, uint64_t seed, SIGNALS::Pin inputs[PINS] ) {
+   const char* eq = strchr( arg, '=' );
+   if ( !eq ) return false;
+   long pin;
+   char* end;
+   if ( arg[0] == 'A' ) pin = A0_PIN + strtol( arg + 1, &end, 10 );
+   else pin = strtol( arg[0] == 'D' ? arg + 1 : arg, &end, 10 );
+   if ( end != eq || pin < 0 || pin >= PINS ) return false;
+
+   SIGNALS::Wave wave = SIGNALS::parse( eq + 1, seed );
+   if ( !wave ) return false;
+   if ( pin == A0_PIN + 1 || pin == A0_PIN + 3 ) inputs[pin] = SIGNALS::analog10V( wave );
+   else if ( pin >= A0_PIN ) inputs[pin] = SIGNALS::analog5V( wave );
+   else inputs[pin] = SIGNALS::digital( wave );
+   return true;
+}
+
+/**
+ * Boot, configure and measure. false if the firmware never got going.
+ **/
+static bool runScenario( elf_firmware_t& firmware, Run& run, double seconds ) {
+   avr_t* avr = avr_make_mcu_by_name( "atmega328p" );
+   if ( !avr ) {
+      fprintf( stderr, "shieldbench: simavr has no atmega328p\n" );
+      return false;
+   }
+   avr_init( avr );
+   avr_load_firmware( avr, &firmware );
+   avr->frequency = FREQUENCY;
+   avr->vcc = avr->avcc = avr->aref = 5000;   // mV
+   run.avr = avr;
+
+   // the firmware's output is ours, not simavr's stdout
+   uint32_t flags = 0;
+   avr_ioctl( avr, AVR_IOCTL_UART_GET_FLAGS( '0' ), &flags );
+   flags &= ~AVR_UART_FLAG_STDIO;
+   avr_ioctl( avr, AVR_IOCTL_UART_SET_FLAGS( '0' ), &flags );
+   avr_irq_register_notify( avr_io_getirq( avr, AVR_IOCTL_UART_GETIRQ( '0' ), UART_IRQ_OUTPUT ), uartOut, &run );
+   run.uartIn = avr_io_getirq( avr, AVR_IOCTL_UART_GETIRQ( '0' ), UART_IRQ_INPUT );
+
+   avr_register_io_write( avr, GPIOR0_ADDR, markerWrite, &run );
+
+   // BTA01/BTA02 5V and 10V pins are A0..A3, the gates D2 and D6
+   for ( int ch = 0; ch < 4; ch++ ) run.adc[ch] = avr_io_getirq( avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_ADC0 + ch );
+   bool driven = false;
+   for ( int p = 0; p < A0_PIN; p++ ) {
+      run.pin[p] = avr_io_getirq( avr, AVR_IOCTL_IOPORT_GETIRQ( p < 8 ? 'D' : 'B' ), p & 7 );
+      driven |= (bool)run.inputs[p];
+   }
+   run.gate[0] = run.pin[2];
+   run.gate[1] = run.pin[6];
+   avr_raise_irq( run.gate[0], 1 );   // gates read open until something happens
+   avr_raise_irq( run.gate[1], 1 );
+   avr_cycle_timer_register_usec( avr, 100, analogTick, &run );
+   if ( driven ) avr_cycle_timer_register_usec( avr, INPUT_US, inputTick, &run );
+   if ( run.scenario->gateHz ) {
+      run.gatePeriod = avr_usec_to_cycles( avr, 500000 / run.scenario->gateHz );
+      avr_cycle_timer_register( avr, run.gatePeriod, gateTick, &run );
+   }
+
+   std::vector<uint8_t> commands;
+   parseHex( run.scenario->commands, commands );
+
+   enum { BOOT, SETTLING, MEASURING } phase = BOOT;
+   avr_cycle_count_t until = (avr_cycle_count_t)(BOOT_LIMIT * FREQUENCY);
+   bool ok = true;
+   for ( ;; ) {
+      int state = avr_run( avr );
+      if ( state == cpu_Done || state == cpu_Crashed ) {
+         fprintf( stderr, "shieldbench: %s: the firmware stopped (state %d)\n", run.scenario->name, state );
+         ok = false;
+         break;
+      }
+      if ( phase == BOOT && run.booted ) {
+         for ( uint8_t b : commands ) avr_raise_irq( run.uartIn, b );
+         phase = SETTLING;
+         until = avr->cycle + (avr_cycle_count_t)(SETTLE * FREQUENCY);
+      } else if ( avr->cycle < until ) {
+         continue;
+      } else if ( phase == BOOT ) {
+         fprintf( stderr, "shieldbench: %s: no *HELLO* after %.0fs\n", run.scenario->name, BOOT_LIMIT );
+         ok = false;
+         break;
+      } else if ( phase == SETTLING ) {
+         phase = MEASURING;
+         run.measuring = true;
+         run.windowStart = avr->cycle;
+         until = avr->cycle + (avr_cycle_count_t)(seconds * FREQUENCY);
+      } else {
+         break;
+      }
+   }
+   avr_terminate( avr );
+   return ok;
+}
+
+struct Result {
+   size_t   calls;
+   uint32_t min, median, p99, max;
+   double   mean;
+};
+
+static Result summarise( std::vector<uint32_t>& c ) {
+   Result r;
+   std::sort( c.begin(), c.end() );
+   r.calls  = c.size();
+   r.min    = c.front();
+   r.median = c[c.size() / 2];
+   r.p99    = c[std::min( c.size() - 1, c.size() * 99 / 100 )];
+   r.max    = c.back();
+   double sum = 0;
+   for ( uint32_t v : c ) sum += v;
+   r.mean = sum / c.size();
+   return r;
+}
+
+/**
+ * Earlier results keyed "scenario/marker", only what the table needs
+ **/
+static bool readBaseline( const char* path, std::map<std::string, Result>& out ) {
+   FILE* f = fopen( path, "r" );
+   if ( !f ) {
+      perror( path );
+      return false;
+   }
+   char line[512];
+   while ( fgets( line, sizeof(line), f ) ) {
+      char scenario[64], marker[32];
+      Result r;
+      if ( sscanf( line, "{\"scenario\":\"%63[^\"]\",\"marker\":\"%31[^\"]\",\"calls\":%zu,\"min\":%u,\"median\":%u,\"p99\":%u,\"max\":%u,\"mean\":%lf",
+                   scenario, marker, &r.calls, &r.min, &r.median, &r.p99, &r.max, &r.mean ) == 8 )
+         out[std::string( scenario ) + "/" + marker] = r;
+   }
+   fclose( f );
+   return true;
+}
+
+static void usage() {
+   fprintf( stderr, "usage: shieldbench [-t seconds] [-s scenario]... [-i pin=signal]... [-S seed]\n"
+                    "                   [-b before.jsonl] [-l] [firmware.elf]\n" );
+}
+
+int main( int argc, char** argv ) {
+   double seconds = 1;
+   std::vector<std::string> only;
+   const char* baselinePath = nullptr;
+   std::vector<const char*> inputSpecs;
+   uint64_t seed = 1;
+
+   int opt;
+   while ( (opt = getopt( argc, argv, "t:s:i:S:b:l" )) != -1 ) {
+      switch ( opt ) {
+         case 't': seconds = atof( optarg ); break;
+         case 's': only.push_back( optarg ); break;
+         case 'i': inputSpecs.push_back( optarg ); break;
+         case 'S': seed = strtoull( optarg, nullptr, 0 ); break;
+         case 'b': baselinePath = optarg; break;
+         case 'l':
+            for ( const Scenario& s : SCENARIOS ) printf( "%-14s %s\n", s.name, s.about );
+            return 0;
+         default:  usage(); return 2;
+      }
+   }
+   if ( argc - optind > 1 ) {
+      usage();
+      return 2;
+   }
+   const char* elf = optind < argc ? argv[optind] : ".pio/build/uno_bench/firmware.elf";
+
+   SIGNALS::Pin inputs[PINS];
+   for ( const char* spec : inputSpecs ) {
+      if ( !parseInput( spec, seed, inputs ) ) {
+         fprintf( stderr, "shieldbench: bad input '%s'\n", spec );
+         return 2;
+      }
+   }
+
+   std::map<std::string, Result> baseline;
+   if ( baselinePath && !readBaseline( baselinePath, baseline ) ) return 1;
+
+   elf_firmware_t firmware;
+   memset( &firmware, 0, sizeof(firmware) );
+   if ( elf_read_firmware( elf, &firmware ) != 0 ) {
+      fprintf( stderr, "shieldbench: can't load %s (pio run -e uno_bench)\n", elf );
+      return 1;
+   }
+
+   int result = 0;
+   if ( baselinePath ) fprintf( stderr, "%-14s %-13s %8s %8s %8s   %s\n", "scenario", "marker", "calls", "median", "mean", "mean before" );
+   for ( const Scenario& s : SCENARIOS ) {
+      if ( !only.empty() && std::find( only.begin(), only.end(), s.name ) == only.end() ) continue;
+
+      Run* run = new Run();
+      run->scenario = &s;
+      for ( int p = 0; p < PINS; p++ ) run->inputs[p] = inputs[p];
+      if ( !runScenario( firmware, *run, seconds ) ) {
+         result = 1;
+         delete run;
+         continue;
+      }
+
+      for ( size_t id = 1; id < MARKER_COUNT; id++ ) {
+         if ( run->cycles[id].empty() ) continue;
+         Result r = summarise( run->cycles[id] );
+         printf( "{\"scenario\":\"%s\",\"marker\":\"%s\",\"calls\":%zu,\"min\":%u,\"median\":%u,\"p99\":%u,\"max\":%u,\"mean\":%.1f}\n",
+                 s.name, MARKERS[id], r.calls, r.min, r.median, r.p99, r.max, r.mean );
+         if ( !baselinePath ) continue;
+         fprintf( stderr, "%-14s %-13s %8zu %8u %8.1f", s.name, MARKERS[id], r.calls, r.median, r.mean );
+         auto before = baseline.find( std::string( s.name ) + "/" + MARKERS[id] );
+         if ( before != baseline.end() )
+            fprintf( stderr, "   %8.1f  %+.1f%%", before->second.mean, 100.0 * (r.mean - before->second.mean) / before->second.mean );
+         fprintf( stderr, "\n" );
+      }
+      fflush( stdout );
+
+      StreamCounter counter;
+      ShieldParser parser( counter );
+      parser.parse( run->received.data(), run->received.size() );
+      const ShieldParser::Counts& c = parser.getCounts();
+      fprintf( stderr, "%s: %zu bytes sent, blobs %llu  events %llu  beacons %llu  junk %llu\n",
+               s.name, run->received.size(), (unsigned long long)c.blobs, (unsigned long long)c.events,
+               (unsigned long long)c.beacons, (unsigned long long)c.junk );
+      delete run;
+   }
+   return result;
+}
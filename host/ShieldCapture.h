@@ -0,0 +1,53 @@
+/****************************************************************
+*  ShieldCapture
+*  Layout of the binary capture files written by shieldcap.
+*
+*  A 32 byte header followed by fixed size sample records, all little
+*  endian so numpy can map the file directly:
+*
+*     header  = np.dtype([('magic','S8'),('version','<u4'),('record','<u4'),
+*                         ('baud','<u4'),('flags','<u4'),('start_ns','<u8')])
+*     samples = np.dtype([('time','<u8'),('seq','<u4'),('raw','<u2'),
+*                         ('src','u1'),('kind','u1')])
+*     data = np.fromfile(name, dtype=samples, offset=32)
+****************************************************************/
+#ifndef ShieldCapture_h
+#define ShieldCapture_h
+
+#include <stdint.h>
+
+namespace CAPTURE {
+  const char     MAGIC[8] = { 'V','S','H','C','A','P','1','\0' };
+  const uint32_t VERSION  = 2;  // 2: 64 bit times and full counts (16 byte samples)
+};
+
+// what produced a sample
+namespace SAMPLEKIND {
+  const uint8_t BLOB     = 0;  // 8 byte data blob, time and seq# unwrapped (see ShieldTimeline)
+                               // digital blobs keep the delta time they were sent with
+  const uint8_t EVENT    = 1;  // compact digital event, time is absolute μs since SYNC
+                               // raw is 1 for LOW2HIGH and 0 for HIGH2LOW
+  const uint8_t SNAPSHOT = 2;  // one port of an IMM_SNAP record, seq is 0
+};
+
+struct ShieldCaptureHeader {
+  char     magic[8];
+  uint32_t version;
+  uint32_t recordSize;   // sizeof(ShieldSample)
+  uint32_t baud;
+  uint32_t flags;        // reserved
+  uint64_t startNs;      // host wall clock when the capture started (ns since the epoch)
+};
+
+struct ShieldSample {
+  uint64_t time;         // μs since SYNC
+  uint32_t seq;          // count on the port since SYNC
+  uint16_t raw;          // raw reading
+  uint8_t  src;          // SOURCES
+  uint8_t  kind;         // SAMPLEKIND
+};
+
+static_assert( sizeof(ShieldCaptureHeader) == 32, "capture header must be 32 bytes" );
+static_assert( sizeof(ShieldSample) == 16, "capture samples must be 16 bytes" );
+
+#endif
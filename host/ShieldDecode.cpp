@@ -0,0 +1,254 @@
+/****************************************************************
+*  ShieldDecode
+*  Batch blob decoding, see ShieldDecode.h
+*
+*  Blob layout (ShieldCommunication::sendDataBlob):
+*     byte 0     0xAA
+*     bytes 1-3  seq# 11 | data 10 | src 3   (one 24 bit big endian word)
+*     bytes 4-7  μs since SYNC, big endian
+*  The kernels shuffle the bytes of each blob into little endian 32 bit
+*  words, time from bytes 7..4 and the packed word from bytes 3..1, then
+*  split the packed word with shifts and masks.
+****************************************************************/
+
+#include "ShieldDecode.h"
+#include "ShieldParser.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SHIELD_DECODE_X86
+#endif
+
+namespace {
+
+const uint8_t BLOB = (uint8_t)RECORDS::BLOB;
+
+typedef size_t (*Kernel)( const uint8_t* p, size_t blobs, ShieldColumns& out, size_t at );
+
+/**
+ * One blob at a time, stops at the first one without a marker
+ **/
+size_t decodeScalar( const uint8_t* p, size_t blobs, ShieldColumns& out, size_t at ) {
+   size_t i = 0;
+   for ( ; i < blobs && p[0] == BLOB; i++, p += 8 ) {
+      uint32_t w = ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+      out.seq[at+i]  = (uint16_t)(w >> 13);
+      out.raw[at+i]  = (uint16_t)((w >> 3) & 0x3FF);
+      out.src[at+i]  = (uint8_t)(w & 0x07);
+      out.time[at+i] = ((uint32_t)p[4] << 24) | ((uint32_t)p[5] << 16) | ((uint32_t)p[6] << 8) | p[7];
+   }
+   return i;
+}
+
+#ifdef SHIELD_DECODE_X86
+
+// per 16 bytes (two blobs): [time A, time B, word A, word B] as little endian dwords
+#define BLOB_SHUFFLE 7, 6, 5, 4, 15, 14, 13, 12, 3, 2, 1, -128, 11, 10, 9, -128
+
+/**
+ * Split packed words into seq#, data and src and store n of them
+ **/
+__attribute__((target("ssse3")))
+inline void splitWords( __m128i w, ShieldColumns& out, size_t at, int n ) {
+   const __m128i rawMask = _mm_set1_epi32( 0x3FF );
+   const __m128i srcMask = _mm_set1_epi32( 0x07 );
+   __m128i seq = _mm_srli_epi32( w, 13 );
+   __m128i raw = _mm_and_si128( _mm_srli_epi32( w, 3 ), rawMask );
+   __m128i src = _mm_and_si128( w, srcMask );
+   // everything fits in 15 bits so the signed packs are safe
+   seq = _mm_packs_epi32( seq, seq );
+   raw = _mm_packs_epi32( raw, raw );
+   src = _mm_packs_epi16( _mm_packs_epi32( src, src ), src );
+   if ( n == 4 ) {
+      _mm_storel_epi64( (__m128i*)(out.seq + at), seq );
+      _mm_storel_epi64( (__m128i*)(out.raw + at), raw );
+      uint32_t s = (uint32_t)_mm_cvtsi128_si32( src );
+      memcpy( out.src + at, &s, 4 );
+   } else {
+      uint32_t q = (uint32_t)_mm_cvtsi128_si32( seq );
+      uint32_t r = (uint32_t)_mm_cvtsi128_si32( raw );
+      uint16_t s = (uint16_t)_mm_cvtsi128_si32( src );
+      memcpy( out.seq + at, &q, 4 );
+      memcpy( out.raw + at, &r, 4 );
+      memcpy( out.src + at, &s, 2 );
+   }
+}
+
+/**
+ * Two blobs per 16 byte load
+ **/
+__attribute__((target("ssse3")))
+size_t decodeSSSE3( const uint8_t* p, size_t blobs, ShieldColumns& out, size_t at ) {
+   const __m128i shuffle = _mm_setr_epi8( BLOB_SHUFFLE );
+   const __m128i marker = _mm_set1_epi8( (char)BLOB );
+   size_t i = 0;
+   for ( ; i + 2 <= blobs; i += 2, p += 16 ) {
+      __m128i v = _mm_loadu_si128( (const __m128i*)p );
+      if ( (_mm_movemask_epi8( _mm_cmpeq_epi8( v, marker ) ) & 0x0101) != 0x0101 ) break;
+      v = _mm_shuffle_epi8( v, shuffle );
+      _mm_storel_epi64( (__m128i*)(out.time + at + i), v );
+      splitWords( _mm_srli_si128( v, 8 ), out, at + i, 2 );
+   }
+   return i + decodeScalar( p, blobs - i, out, at + i );
+}
+
+/**
+ * Four blobs per 32 byte load
+ **/
+__attribute__((target("avx2")))
+size_t decodeAVX2( const uint8_t* p, size_t blobs, ShieldColumns& out, size_t at ) {
+   const __m256i shuffle = _mm256_setr_epi8( BLOB_SHUFFLE, BLOB_SHUFFLE );
+   const __m256i marker = _mm256_set1_epi8( (char)BLOB );
+   size_t i = 0;
+   for ( ; i + 4 <= blobs; i += 4, p += 32 ) {
+      __m256i v = _mm256_loadu_si256( (const __m256i*)p );
+      if ( ((uint32_t)_mm256_movemask_epi8( _mm256_cmpeq_epi8( v, marker ) ) & 0x01010101u) != 0x01010101u ) break;
+      v = _mm256_shuffle_epi8( v, shuffle );
+      // [tA tB wA wB | tC tD wC wD] -> [tA tB tC tD | wA wB wC wD]
+      v = _mm256_permute4x64_epi64( v, 0xD8 );
+      _mm_storeu_si128( (__m128i*)(out.time + at + i), _mm256_castsi256_si128( v ) );
+      splitWords( _mm256_extracti128_si256( v, 1 ), out, at + i, 4 );
+   }
+   return i + decodeSSSE3( p, blobs - i, out, at + i );
+}
+
+/**
+ * The kernel by name if the CPU has what it needs, null if not
+ **/
+Kernel findKernel( const char* name ) {
+   __builtin_cpu_init();
+   if ( !strcmp( name, "avx2" ) ) return __builtin_cpu_supports( "avx2" ) ? decodeAVX2 : nullptr;
+   if ( !strcmp( name, "ssse3" ) ) return __builtin_cpu_supports( "ssse3" ) ? decodeSSSE3 : nullptr;
+   return strcmp( name, "scalar" ) ? nullptr : decodeScalar;
+}
+
+#else
+
+Kernel findKernel( const char* name ) {
+   return strcmp( name, "scalar" ) ? nullptr : decodeScalar;
+}
+
+#endif
+
+// fastest first
+const char* const KERNELS[] = { "avx2", "ssse3", "scalar" };
+
+Kernel pickKernel( const char** name ) {
+   for ( const char* k : KERNELS ) {
+      if ( Kernel found = findKernel( k ) ) {
+         *name = k;
+         return found;
+      }
+   }
+   *name = "scalar";
+   return decodeScalar;
+}
+
+const char* kernelName;
+Kernel kernel = pickKernel( &kernelName );
+
+}  // namespace
+
+ShieldBlobDecoder::ShieldBlobDecoder() {
+   memset( &_counts, 0, sizeof(_counts) );
+   reset();
+}
+
+void
+ShieldBlobDecoder::reset() {
+   for ( int i = 0; i < 8; i++ ) _lastSeq[i] = -1;
+   _timeline.reset();
+}
+
+const char*
+ShieldBlobDecoder::kernel() {
+   return kernelName;
+}
+
+bool
+ShieldBlobDecoder::useKernel( const char* name ) {
+   for ( const char* k : KERNELS ) {
+      Kernel found = strcmp( k, name ) ? nullptr : findKernel( k );
+      if ( found ) {
+         ::kernel = found;
+         kernelName = k;
+         return true;
+      }
+   }
+   return false;
+}
+
+/**
+ * Walk the buffer: runs of blobs go through the kernel, other records are
+ * stepped over, anything else is skipped a byte at a time.
+ **/
+size_t
+ShieldBlobDecoder::decode( const uint8_t* data, size_t len, ShieldColumns& out, size_t* consumed ) {
+   size_t pos = 0;
+   size_t n = 0;
+   while ( pos < len && n < out.capacity ) {
+      const uint8_t* p = data + pos;
+      if ( *p == BLOB ) {
+         size_t blobs = (len - pos) / 8;
+         if ( blobs == 0 ) break;  // the rest of it hasn't arrived
+         if ( blobs > out.capacity - n ) blobs = out.capacity - n;
+         size_t got = ::kernel( p, blobs, out, n );
+         checkSequence( out.src + n, out.seq + n, got );
+         unwrap( out, n, got );
+         n += got;
+         pos += got * 8;
+         _counts.blobs += got;
+         if ( got == blobs ) continue;
+         p = data + pos;  // the run ended on something else, frame that below
+      }
+      long frame = ShieldParser::frameLength( p, len - pos );
+      if ( frame == 0 ) break;
+      if ( frame < 0 || (*p == (uint8_t)RECORDS::BEACON && !_timeline.fits( p )) ) {
+         _counts.junk++;
+         pos++;
+      } else {
+         if ( *p == (uint8_t)RECORDS::BEACON ) _timeline.beacon( p );
+         _counts.other++;
+         pos += frame;
+      }
+   }
+   if ( consumed ) *consumed = pos;
+   return n;
+}
+
+/**
+ * Full width times and counts for n decoded blobs
+ **/
+void
+ShieldBlobDecoder::unwrap( ShieldColumns& out, size_t at, size_t n ) {
+   for ( size_t i = at; i < at + n; i++ ) {
+      int src = out.src[i];
+      out.count[i] = _timeline.count( src, out.seq[i] );
+      out.clock[i] = src == SOURCES::DIG1 || src == SOURCES::DIG2 ? out.time[i] : _timeline.time( out.time[i] );
+   }
+}
+
+/**
+ * Each source counts its own blobs. A seq# of 0 outside a wrap is an
+ * immediate reading or the last blob of a run, the next run starts at 1.
+ **/
+void
+ShieldBlobDecoder::checkSequence( const uint8_t* src, const uint16_t* seq, size_t n ) {
+   for ( size_t i = 0; i < n; i++ ) {
+      int s = src[i] & 0x07;
+      int last = _lastSeq[s];
+      if ( seq[i] == 0 && last != 0x7FF ) {
+         _lastSeq[s] = -1;
+         continue;
+      }
+      if ( last >= 0 ) {
+         int expected = (last + 1) & 0x7FF;
+         if ( seq[i] != expected ) {
+            _counts.gaps++;
+            _counts.missing += (seq[i] - expected) & 0x7FF;
+         }
+      }
+      _lastSeq[s] = seq[i];
+   }
+}
@@ -0,0 +1,71 @@
+/****************************************************************
+*  ShieldDecode
+*  Batch decoder for data blobs. A raw stream (or a whole capture of
+*  it) goes in, separate time, raw value, source and sequence arrays
+*  come out in one pass.
+*
+*  Runs of back to back blobs are unpacked four at a time with AVX2
+*  (or two at a time with SSSE3) byte shuffles, picked at run time.
+*  Anything else in the stream (strings, ACKs, events...) is stepped
+*  over using ShieldParser's framing and bytes that aren't a record are
+*  skipped until a marker turns up again.
+*
+*  Sequence numbers are counted per source (11 bits, see sendDataBlob)
+*  so a jump on a source means blobs were lost in between. Beacon
+*  records in the stream are followed so the times and seq#s also come
+*  out unwrapped to full width (see ShieldTimeline).
+****************************************************************/
+#ifndef ShieldDecode_h
+#define ShieldDecode_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ShieldTimeline.h"
+
+// where the decoded blobs go, each array must hold capacity entries
+struct ShieldColumns {
+   uint32_t* time;   // μs since SYNC
+   uint16_t* raw;    // 10 bit reading
+   uint8_t*  src;    // SOURCES
+   uint16_t* seq;    // 11 bit seq#
+   uint64_t* clock;  // time with the wraps put back (digital blobs: as sent)
+   uint32_t* count;  // seq# with the wraps put back, the port's count since SYNC
+   size_t    capacity;
+};
+
+class ShieldBlobDecoder {
+
+public:
+   struct Counts {
+      uint64_t blobs;
+      uint64_t other;     // records that aren't blobs, stepped over
+      uint64_t junk;      // bytes that weren't part of any record
+      uint64_t gaps;      // places where a source's seq# jumped
+      uint64_t missing;   // blobs lost in those jumps
+   };
+
+   ShieldBlobDecoder();
+
+   // decode as many blobs as fit, returns the number written to out.
+   // *consumed is how far into data it got, an incomplete record at the
+   // end is left for the next call.
+   size_t decode( const uint8_t* data, size_t len, ShieldColumns& out, size_t* consumed );
+   void   reset();  // forget the seq# history and the timeline (after a SYNC)
+
+   const Counts& getCounts() const { return _counts; }
+
+   // which kernel decode() uses: "avx2", "ssse3" or "scalar"
+   static const char* kernel();
+   // use that one from now on (the tests compare them), false if this CPU can't
+   static bool useKernel( const char* name );
+
+private:
+   void checkSequence( const uint8_t* src, const uint16_t* seq, size_t n );
+   void unwrap( ShieldColumns& out, size_t at, size_t n );
+
+   Counts         _counts;
+   int            _lastSeq[8];   // -1 until a source has been seen
+   ShieldTimeline _timeline;
+};
+
+#endif
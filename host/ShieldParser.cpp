@@ -0,0 +1,203 @@
+/****************************************************************
+*  ShieldParser
+*  Record framing and decoding, see ShieldParser.h
+****************************************************************/
+
+#include "ShieldParser.h"
+#include <string.h>
+
+ShieldParser::ShieldParser( Handler& handler ) : _handler( handler ) {
+   memset( &_counts, 0, sizeof(_counts) );
+   reset();
+}
+
+/**
+ * Compact events are relative to the previous one on the port
+ **/
+void
+ShieldParser::reset() {
+   memset( _eventTime, 0, sizeof(_eventTime) );
+   _timeline.reset();
+}
+
+/**
+ * Length of the record starting at p
+ **/
+long
+ShieldParser::frameLength( const uint8_t* p, size_t n ) {
+   uint8_t marker = p[0];
+
+   if ( marker == (uint8_t)RECORDS::BLOB ) return n < 8 ? 0 : 8;
+
+   if ( (marker & (uint8_t)RECORDS::EVENT_MASK) == (uint8_t)RECORDS::EVENT ) {
+      if ( marker & RECORDS::EVENT_ANCHOR ) return n < 5 ? 0 : 5;
+      for ( size_t i = 1; i < 6; i++ ) {   // varint, at most 5 groups of 7 bits
+         if ( i >= n ) return 0;
+         if ( !(p[i] & 0x80) ) return i + 1;
+      }
+      return -1;
+   }
+
+   if ( marker == (uint8_t)RECORDS::STATUS || marker == (uint8_t)RECORDS::STATS ) {
+      if ( n < 3 ) return 0;
+      return n < 3u + p[2] ? 0 : 3 + p[2];
+   }
+
+   if ( marker == (uint8_t)RECORDS::SNAPSHOT ) {
+      if ( n < 2 ) return 0;
+      uint8_t mask = p[1];
+      long len = 6 + 2 * __builtin_popcount( mask & 0x3C );  // ANA105..ANA210
+      if ( mask & 0x43 ) len++;                              // DIG1, DIG2, BTN
+      return (long)n < len ? 0 : len;
+   }
+
+   if ( marker == (uint8_t)RECORDS::ACK || marker == (uint8_t)RECORDS::NAK ) return n < 2 ? 0 : 2;
+
+   if ( marker == '!' || marker == '?' ) return 1;
+
+   if ( marker == (uint8_t)RECORDS::PING ) return n < 13 ? 0 : 13;
+
+   if ( marker == (uint8_t)RECORDS::BEACON ) {
+      if ( n < 2 ) return 0;
+      long len = 8 + 4 * __builtin_popcount( p[1] & 0x3F );  // DIG1..ANA210
+      return (long)n < len ? 0 : len;
+   }
+
+   if ( marker == (uint8_t)RECORDS::TRACE ) {
+      if ( n < 2 ) return 0;
+      long len = TRACE::HEADER + 4 * p[1];
+      return (long)n < len ? 0 : len;
+   }
+
+   if ( marker == (uint8_t)RECORDS::STRING ) {
+      const uint8_t* end = (const uint8_t*)memchr( p, '\n', n < SHIELD_MAX_STRING ? n : SHIELD_MAX_STRING );
+      if ( end ) return end - p + 1;
+      return n < SHIELD_MAX_STRING ? 0 : -1;
+   }
+
+   return -1;
+}
+
+/**
+ * Consume every complete record in the buffer
+ **/
+size_t
+ShieldParser::parse( const uint8_t* data, size_t len ) {
+   size_t pos = 0;
+   while ( pos < len ) {
+      const uint8_t* p = data + pos;
+      long frame = frameLength( p, len - pos );
+      if ( frame == 0 ) break;        // the rest hasn't arrived yet
+      uint8_t marker = p[0];
+      if ( frame < 0 || (marker == (uint8_t)RECORDS::BEACON && !_timeline.fits( p )) ) {
+         _counts.junk++;              // lost, look for the next marker
+         pos++;
+         continue;
+      }
+
+      if ( marker == (uint8_t)RECORDS::BLOB ) {
+         decodeBlob( p );
+      } else if ( (marker & (uint8_t)RECORDS::EVENT_MASK) == (uint8_t)RECORDS::EVENT ) {
+         decodeEvent( p, frame );
+      } else if ( marker == (uint8_t)RECORDS::STATUS ) {
+         _counts.status++;
+         _handler.status( p, frame );
+      } else if ( marker == (uint8_t)RECORDS::SNAPSHOT ) {
+         decodeSnapshot( p );
+      } else if ( marker == (uint8_t)RECORDS::ACK || marker == (uint8_t)RECORDS::NAK ) {
+         _counts.answers++;
+         _handler.answer( p[1], marker == (uint8_t)RECORDS::ACK );
+      } else if ( marker == '!' || marker == '?' ) {
+         _counts.answers++;
+         _handler.answer( -1, marker == '!' );
+      } else if ( marker == (uint8_t)RECORDS::BEACON ) {
+         _counts.beacons++;
+         _timeline.beacon( p );
+      } else if ( marker != (uint8_t)RECORDS::STRING ) {
+         _counts.other++;
+         _handler.record( p, frame );
+      } else {   // string, drop the leading space and the CR LF
+         size_t end = frame - 1;
+         if ( end > 1 && p[end-1] == '\r' ) end--;
+         _counts.strings++;
+         _handler.text( (const char*)p + 1, end - 1 );
+      }
+      pos += frame;
+   }
+   return pos;
+}
+
+/**
+ * 0xAA | seq# 11 | data 10 | src 3 | time 32, see ShieldCommunication::sendDataBlob
+ * Digital blobs carry the time since the previous transition, not since SYNC.
+ **/
+void
+ShieldParser::decodeBlob( const uint8_t* p ) {
+   ShieldSample s;
+   uint32_t seq  = ((uint32_t)p[1] << 3) | (p[2] >> 5);
+   uint32_t time = ((uint32_t)p[4] << 24) | ((uint32_t)p[5] << 16) | ((uint32_t)p[6] << 8) | p[7];
+   s.raw  = (uint16_t)(((p[2] & 0x1F) << 5) | (p[3] >> 3));
+   s.src  = p[3] & 0x07;
+   s.kind = SAMPLEKIND::BLOB;
+   s.seq  = _timeline.count( s.src, seq );
+   s.time = s.src == SOURCES::DIG1 || s.src == SOURCES::DIG2 ? time : _timeline.time( time );
+   _counts.blobs++;
+   _handler.sample( s );
+}
+
+/**
+ * 0b110APSSS then 4 bytes of absolute time or a varint delta,
+ * see ShieldCommunication::sendDigitalEvent
+ **/
+void
+ShieldParser::decodeEvent( const uint8_t* p, size_t len ) {
+   uint8_t src = p[0] & 0x07;
+   uint32_t time;
+   if ( p[0] & RECORDS::EVENT_ANCHOR ) {
+      time = ((uint32_t)p[1] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 8) | p[4];
+   } else {
+      uint32_t delta = 0;
+      for ( size_t i = 1; i < len; i++ ) delta |= (uint32_t)(p[i] & 0x7F) << (7 * (i - 1));
+      time = _eventTime[src] + delta;
+   }
+   _eventTime[src] = time;
+
+   ShieldSample s;
+   s.time = _timeline.time( time );
+   s.seq  = _timeline.next( src );
+   s.raw  = (p[0] & RECORDS::EVENT_RISE) ? 1 : 0;
+   s.src  = src;
+   s.kind = SAMPLEKIND::EVENT;
+   _counts.events++;
+   _handler.sample( s );
+}
+
+/**
+ * 0xAC | mask | time 32 | analogs 16 each | digital bits,
+ * see ShieldCommunication::sendSnapshot
+ **/
+void
+ShieldParser::decodeSnapshot( const uint8_t* p ) {
+   uint8_t mask = p[1];
+   ShieldSample s;
+   s.time = _timeline.time( ((uint32_t)p[2] << 24) | ((uint32_t)p[3] << 16) | ((uint32_t)p[4] << 8) | p[5] );
+   s.seq  = 0;
+   s.kind = SAMPLEKIND::SNAPSHOT;
+
+   const uint8_t* v = p + 6;
+   for ( int src = SOURCES::ANA105; src <= SOURCES::ANA210; src++ ) {
+      if ( !(mask & (1 << (src - 1))) ) continue;
+      s.src = src;
+      s.raw = (uint16_t)((v[0] << 8) | v[1]);
+      v += 2;
+      _handler.sample( s );
+   }
+   const int digital[3] = { SOURCES::DIG1, SOURCES::DIG2, SOURCES::BTN };
+   for ( int src : digital ) {
+      if ( !(mask & (1 << (src - 1))) ) continue;
+      s.src = src;
+      s.raw = (*v >> (src - 1)) & 0x01;
+      _handler.sample( s );
+   }
+   _counts.snapshots++;
+}
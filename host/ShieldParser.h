@@ -0,0 +1,75 @@
+/****************************************************************
+*  ShieldParser
+*  Splits the byte stream coming from the shield into records, using
+*  the markers in ShieldCommunicationCmds.h. Frames are decoded where
+*  they lie in the buffer, nothing is copied.
+*
+*  parse() consumes whole records only. A record cut off at the end of
+*  the buffer is left for the next call, the caller keeps those bytes
+*  and appends the next read after them. Bytes that don't start a known
+*  record are skipped (and counted) until a marker is found again.
+*
+*  Times and seq#s come out unwrapped to full width, see ShieldTimeline.
+****************************************************************/
+#ifndef ShieldParser_h
+#define ShieldParser_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ShieldCommunicationCmds.h>
+#include "ShieldCapture.h"
+#include "ShieldTimeline.h"
+
+// longest string the firmware sends, anything longer is treated as noise
+#define SHIELD_MAX_STRING 256
+
+class ShieldParser {
+
+public:
+   // receives the decoded records
+   class Handler {
+   public:
+      virtual ~Handler() {}
+      virtual void sample( const ShieldSample& s ) = 0;
+      virtual void text( const char* str, size_t len ) { (void)str; (void)len; }      // without the CR LF
+      virtual void status( const uint8_t* rec, size_t len ) { (void)rec; (void)len; } // whole 0xAB record
+      virtual void answer( int tag, bool ok ) { (void)tag; (void)ok; }              // tag is -1 for '!'/'?'
+      virtual void record( const uint8_t* rec, size_t len ) { (void)rec; (void)len; } // anything else (pings...)
+   };
+
+   // what went past
+   struct Counts {
+      uint64_t blobs;
+      uint64_t events;
+      uint64_t snapshots;
+      uint64_t strings;
+      uint64_t status;
+      uint64_t answers;
+      uint64_t beacons;
+      uint64_t other;     // records passed to Handler::record()
+      uint64_t junk;      // bytes skipped looking for a marker
+   };
+
+   explicit ShieldParser( Handler& handler );
+
+   size_t parse( const uint8_t* data, size_t len );  // returns the bytes consumed
+   void   reset();  // forget the event times and counts (after a SYNC)
+   void   setArmed( uint8_t mask ) { _timeline.setArmed( mask ); }  // see ShieldTimeline
+
+   const Counts& getCounts() const { return _counts; }
+
+   // length of the record starting at p, 0 if it is incomplete, -1 if p isn't a record
+   static long frameLength( const uint8_t* p, size_t n );
+
+private:
+   void decodeBlob( const uint8_t* p );
+   void decodeEvent( const uint8_t* p, size_t len );
+   void decodeSnapshot( const uint8_t* p );
+
+   Handler&       _handler;
+   Counts         _counts;
+   ShieldTimeline _timeline;
+   uint32_t       _eventTime[8];   // last absolute event time per source, as sent
+};
+
+#endif
@@ -0,0 +1,42 @@
+/****************************************************************
+*  ShieldRing
+*  Double mapped byte ring, see ShieldRing.h
+****************************************************************/
+
+#include "ShieldRing.h"
+#include <sys/mman.h>
+#include <unistd.h>
+
+ShieldRing::ShieldRing( size_t size ) : _base( nullptr ), _size( 0 ), _head( 0 ), _tail( 0 ) {
+   size_t page = (size_t)sysconf( _SC_PAGESIZE );
+   size = (size + page - 1) / page * page;
+
+   int fd = memfd_create( "shieldring", MFD_CLOEXEC );
+   if ( fd < 0 ) return;
+   if ( ftruncate( fd, size ) < 0 ) {
+      close( fd );
+      return;
+   }
+
+   // reserve twice the size then map the same pages into both halves
+   void* area = mmap( nullptr, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+   if ( area == MAP_FAILED ) {
+      close( fd );
+      return;
+   }
+   uint8_t* base = (uint8_t*)area;
+   if ( mmap( base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0 ) == MAP_FAILED ||
+        mmap( base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0 ) == MAP_FAILED ) {
+      munmap( area, 2 * size );
+      close( fd );
+      return;
+   }
+   close( fd );  // the mappings keep the memory alive
+
+   _base = base;
+   _size = size;
+}
+
+ShieldRing::~ShieldRing() {
+   if ( _base ) munmap( _base, 2 * _size );
+}
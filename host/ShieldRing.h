@@ -0,0 +1,46 @@
+/****************************************************************
+*  ShieldRing
+*  A byte ring that is mapped twice, back to back, in virtual memory.
+*  Whatever is waiting in the ring can always be seen as one contiguous
+*  block even when it wraps, so read() can fill it directly and the
+*  parser can decode records in place without copying a frame that
+*  straddles the end.
+*
+*  Linux only (memfd_create + mmap).
+****************************************************************/
+#ifndef ShieldRing_h
+#define ShieldRing_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+class ShieldRing {
+
+public:
+   explicit ShieldRing( size_t size );  // rounded up to a whole number of pages
+   ~ShieldRing();
+
+   bool     valid() const { return _base != nullptr; }
+   size_t   size() const { return _size; }
+
+   // the waiting bytes, contiguous
+   const uint8_t* readPtr() const { return _base + (_tail % _size); }
+   size_t   readable() const { return (size_t)(_head - _tail); }
+   void     consume( size_t n ) { _tail += n; }
+
+   // room to receive into, contiguous
+   uint8_t* writePtr() { return _base + (_head % _size); }
+   size_t   writable() const { return _size - readable(); }
+   void     commit( size_t n ) { _head += n; }
+
+private:
+   ShieldRing( const ShieldRing& ) = delete;
+   ShieldRing& operator=( const ShieldRing& ) = delete;
+
+   uint8_t* _base;
+   size_t   _size;
+   uint64_t _head;   // total bytes ever written
+   uint64_t _tail;   // total bytes ever consumed
+};
+
+#endif
@@ -0,0 +1,84 @@
+/****************************************************************
+*  ShieldSeqCheck
+*  Per port sample accounting, see ShieldSeqCheck.h
+****************************************************************/
+
+#include "ShieldSeqCheck.h"
+#include "ShieldCommunicationCmds.h"
+
+#define PRINT_GAPS 8   // gaps listed by print()
+
+ShieldSeqCheck::ShieldSeqCheck()
+   : _highest( 0 ), _received( 0 ), _duplicates( 0 ), _reordered( 0 ),
+     _hasStatus( false ), _count( 0 ), _dropped( 0 ), _missed( 0 ) {
+}
+
+/**
+ * Ahead of the next count opens a gap, behind it either fills one in
+ * or is a duplicate. 0 is an immediate read and not counted.
+ **/
+void
+ShieldSeqCheck::irregular( uint32_t seq ) {
+   if ( seq == 0 ) return;
+   if ( seq > _highest ) {
+      _gaps.push_back( std::make_pair( _highest + 1, seq - 1 ) );
+      _highest = seq;
+      _received++;
+      return;
+   }
+   for ( size_t i = _gaps.size(); i-- > 0; ) {
+      std::pair<uint32_t, uint32_t> gap = _gaps[i];
+      if ( gap.second < seq ) break;
+      if ( gap.first > seq ) continue;
+      _reordered++;
+      _received++;
+      _gaps.erase( _gaps.begin() + i );
+      if ( seq < gap.second ) _gaps.insert( _gaps.begin() + i, std::make_pair( seq + 1, gap.second ) );
+      if ( seq > gap.first )  _gaps.insert( _gaps.begin() + i, std::make_pair( gap.first, seq - 1 ) );
+      return;
+   }
+   _duplicates++;
+}
+
+void
+ShieldSeqCheck::status( const uint8_t* rec, size_t len ) {
+   for ( size_t i = 3; i + 2 <= len; i += 2 + rec[i+1] ) {
+      uint8_t size = rec[i+1];
+      if ( i + 2 + size > len ) break;
+      uint32_t value = 0;
+      for ( uint8_t b = 0; b < size && b < 4; b++ ) value = (value << 8) | rec[i+2+b];
+      switch ( rec[i] ) {
+         case STATUSTAG::COUNT:   _count = value; _hasStatus = true; break;
+         case STATUSTAG::DROPPED: _dropped = value; break;
+         case STATUSTAG::MISSED:  _missed = value; break;
+      }
+   }
+}
+
+uint64_t
+ShieldSeqCheck::getMissing() const {
+   uint64_t missing = 0;
+   for ( const auto& gap : _gaps ) missing += gap.second - gap.first + 1;
+   if ( _hasStatus && _count > _highest ) missing += _count - _highest;  // the last ones never came
+   return missing;
+}
+
+void
+ShieldSeqCheck::print( FILE* out, int src ) const {
+   fprintf( out, "  src %d: %llu received, %llu missing in %zu gaps, %llu duplicates, %llu reordered",
+            src, (unsigned long long)_received, (unsigned long long)getMissing(),
+            _gaps.size() + (_hasStatus && _count > _highest ? 1 : 0),
+            (unsigned long long)_duplicates, (unsigned long long)_reordered );
+   if ( _hasStatus ) {
+      long long lost = (long long)_count - (long long)_received - _dropped;
+      fprintf( out, "; shield took %lu, dropped %lu, lost on the way %lld, missed %lu periods%s",
+               (unsigned long)_count, (unsigned long)_dropped, lost, (unsigned long)_missed,
+               complete() ? ", complete" : "" );
+   }
+   fprintf( out, "\n" );
+   for ( size_t i = 0; i < _gaps.size() && i < PRINT_GAPS; i++ )
+      fprintf( out, "    missing %lu..%lu\n", (unsigned long)_gaps[i].first, (unsigned long)_gaps[i].second );
+   if ( _gaps.size() > PRINT_GAPS ) fprintf( out, "    and %zu more gaps\n", _gaps.size() - PRINT_GAPS );
+   if ( _hasStatus && _count > _highest )
+      fprintf( out, "    missing %lu..%lu at the end\n", (unsigned long)_highest + 1, (unsigned long)_count );
+}
@@ -0,0 +1,66 @@
+/****************************************************************
+*  ShieldSeqCheck
+*  Accounts for every sample from one port. After a SYNC a port counts
+*  its samples from 1 (ShieldTimeline puts back the bits the 11 bit
+*  seq# leaves out), so each count from 1 to the highest seen should
+*  arrive exactly once. Missing counts are kept as ranges, a count that
+*  turns up later fills its range in (reordered) and one that has been
+*  seen already is a duplicate.
+*
+*  The port's status record (ST_PORTSB) says how many samples the
+*  shield took and how many it dropped for lack of room on the link,
+*  with it the losses can be placed: dropped on the shield, lost on the
+*  way, or periods the shield let go by without a reading (missed).
+****************************************************************/
+#ifndef ShieldSeqCheck_h
+#define ShieldSeqCheck_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <utility>
+#include <vector>
+
+class ShieldSeqCheck {
+
+public:
+   ShieldSeqCheck();
+
+   void add( uint32_t seq ) {
+      if ( seq == _highest + 1 ) {   // the usual case
+         _highest = seq;
+         _received++;
+      } else {
+         irregular( seq );
+      }
+   }
+
+   // the COUNT, DROPPED and MISSED fields of a whole 0xAB record for this port
+   void status( const uint8_t* rec, size_t len );
+
+   uint64_t getReceived() const { return _received; }
+   uint64_t getMissing() const;     // up to the shield's count if there was a status record
+   uint64_t getDuplicates() const { return _duplicates; }
+   uint64_t getReordered() const { return _reordered; }
+   bool     hasStatus() const { return _hasStatus; }
+   bool     complete() const { return getMissing() == 0; }
+
+   // one line, and the first few gaps
+   void print( FILE* out, int src ) const;
+
+private:
+   void irregular( uint32_t seq );
+
+   uint32_t _highest;
+   uint64_t _received;     // distinct counts
+   uint64_t _duplicates;
+   uint64_t _reordered;
+   std::vector<std::pair<uint32_t, uint32_t>> _gaps;  // first, last missing, oldest first
+
+   bool     _hasStatus;
+   uint32_t _count;        // samples the shield took
+   uint32_t _dropped;      // and couldn't queue
+   uint32_t _missed;       // periods it let go by
+};
+
+#endif
@@ -0,0 +1,78 @@
+/****************************************************************
+*  ShieldTimeline
+*  64 bit times and full counts from beacons, see ShieldTimeline.h
+****************************************************************/
+
+#include "ShieldTimeline.h"
+#include <string.h>
+#include <ShieldCommunicationCmds.h>
+
+#define AHEAD_US      120000000ull  // twice the idle beacon period
+#define COUNT_SLACK   0x800         // a damaged seq# can move a count on by less than a wrap
+#define US_PER_COUNT  8             // faster than any port can count
+
+ShieldTimeline::ShieldTimeline() : _armed( 0x3F ) {
+   reset();
+}
+
+void
+ShieldTimeline::reset() {
+   _now = 0;
+   memset( _count, 0, sizeof(_count) );
+   _beaconAt = 0;
+   _held = false;
+   _heldAt = 0;
+}
+
+uint64_t
+ShieldTimeline::beaconTime( const uint8_t* p ) {
+   return ((uint64_t)((p[2] << 8) | p[3]) << 32) |
+          ((uint32_t)p[4] << 24) | ((uint32_t)p[5] << 16) | ((uint32_t)p[6] << 8) | p[7];
+}
+
+/**
+ * Could this beacon be right, see ShieldTimeline.h. Turning one down
+ * is remembered, so call it once per beacon.
+ **/
+bool
+ShieldTimeline::fits( const uint8_t* p ) {
+   if ( p[1] & ~_armed ) return false;
+   uint64_t t = beaconTime( p );
+   bool synced = t < _beaconAt;   // a SYNC we weren't told about, times and counts start from 0
+   uint64_t since = synced ? 0 : _beaconAt;
+   bool ok = t <= since + AHEAD_US;
+   int64_t limit = COUNT_SLACK + (t - since) / US_PER_COUNT;
+   const uint8_t* c = p + 8;
+   for ( int src = SOURCES::DIG1; ok && src <= SOURCES::ANA210; src++ ) {
+      if ( !(p[1] & (1 << (src - 1))) ) continue;
+      uint32_t n = ((uint32_t)c[0] << 24) | ((uint32_t)c[1] << 16) | ((uint32_t)c[2] << 8) | c[3];
+      int64_t ahead = (int64_t)n - (synced ? 0 : _count[src]);
+      ok = ahead >= -COUNT_SLACK && ahead <= limit;
+      c += 4;
+   }
+   if ( ok ) return true;
+   bool follows = _held && t >= _heldAt && t <= _heldAt + AHEAD_US;
+   _held = true;
+   _heldAt = t;
+   return follows;
+}
+
+/**
+ * 0xAE | mask | wraps 16 | time 32 | count 32 per port in mask,
+ * see ShieldCommunication::sendBeacon
+ **/
+void
+ShieldTimeline::beacon( const uint8_t* p ) {
+   uint64_t t = beaconTime( p );
+   if ( t < _beaconAt ) memset( _count, 0, sizeof(_count) );  // synced since the last one
+   _now = t;
+   _beaconAt = t;
+   _held = false;
+
+   const uint8_t* c = p + 8;
+   for ( int src = SOURCES::DIG1; src <= SOURCES::ANA210; src++ ) {
+      if ( !(p[1] & (1 << (src - 1))) ) continue;
+      _count[src] = ((uint32_t)c[0] << 24) | ((uint32_t)c[1] << 16) | ((uint32_t)c[2] << 8) | c[3];
+      c += 4;
+   }
+}
@@ -0,0 +1,78 @@
+/****************************************************************
+*  ShieldTimeline
+*  Puts back the bits the wire leaves out. Blob and event times are 32
+*  bit μs since SYNC (they wrap after ~71.6 minutes) and blob seq#s are
+*  11 bits (they wrap every 2048 samples). The firmware sends a beacon
+*  record (RECORDS::BEACON) with the clock's wrap count and each armed
+*  port's full count at least once a second while anything is armed, so
+*  every value can be placed next to the last one we know.
+*
+*  Times are taken as the nearest 64 bit value to the latest time seen,
+*  counts as the next one forward from the port's last count. A beacon
+*  replaces both, one earlier than the beacon before it means the clocks
+*  were synced and every count starts again from 0.
+*
+*  A marker byte in damaged data can look like a beacon, so the parsers
+*  only take one that fits(): its time no more than two idle periods
+*  after the last beacon's (not the latest time, one damaged sample can
+*  move that anywhere), or after 0 if it is earlier (a SYNC), its counts
+*  no further back than a seq# wrap and no further on than the ports can
+*  count, and only ports that have been armed. When a beacon doesn't fit
+*  but follows on from the one turned down before it, it is us that is
+*  off (a long stretch lost) and it is taken.
+****************************************************************/
+#ifndef ShieldTimeline_h
+#define ShieldTimeline_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+class ShieldTimeline {
+
+public:
+   ShieldTimeline();
+
+   void reset();                         // after a SYNC
+   bool fits( const uint8_t* rec );      // a whole 0xAE record can be right, see above
+   void beacon( const uint8_t* rec );    // take it
+
+   // the ports armed since the shield started, a beacon for any other is damage (default all)
+   void setArmed( uint8_t mask ) { _armed = mask & 0x3F; }
+
+   // μs since SYNC with the wraps put back
+   uint64_t time( uint32_t t ) {
+      int64_t v = (int64_t)_now + (int32_t)(t - (uint32_t)_now);
+      if ( v < 0 ) return t;             // from before the first wrap
+      if ( (uint64_t)v > _now ) _now = v;
+      return v;
+   }
+
+   // a port's 11 bit seq# as its count since SYNC. A seq# behind the
+   // last one doesn't move the port's count on, and a 0 that isn't the
+   // next one after 0x7FF is an immediate read and stays 0.
+   uint32_t count( int src, uint32_t seq ) {
+      uint32_t& last = _count[src & 0x07];
+      if ( seq == 0 && (last & 0x7FF) != 0x7FF ) return 0;
+      uint32_t ahead = (seq - last) & 0x7FF;
+      if ( ahead < 0x400 ) return last += ahead;
+      uint32_t back = 0x800 - ahead;
+      return last >= back ? last - back : seq;
+   }
+
+   // the next count on a port whose records don't carry one (compact events)
+   uint32_t next( int src ) { return ++_count[src & 0x07]; }
+
+   uint64_t now() const { return _now; }
+
+private:
+   static uint64_t beaconTime( const uint8_t* rec );
+
+   uint64_t _now;        // latest time seen
+   uint32_t _count[8];   // last count per source
+   uint64_t _beaconAt;   // time of the last beacon taken
+   bool     _held;       // the last beacon was turned down
+   uint64_t _heldAt;     // and its time
+   uint8_t  _armed;
+};
+
+#endif
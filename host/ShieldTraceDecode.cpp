@@ -0,0 +1,84 @@
+/****************************************************************
+*  ShieldTraceDecode
+*  Trace records into timelines, see ShieldTraceDecode.h
+*
+*  Record layout (ShieldTrace::send):
+*     byte 0      0xA8
+*     byte 1      n, the points that follow
+*     bytes 2-3   points since the ring was emptied (wraps)
+*     bytes 4-7   micros() at the dump
+*     bytes 8-10  tick count at the dump
+*     then n of   id, tick count (3 bytes)
+*  All big endian.
+****************************************************************/
+
+#include "ShieldTraceDecode.h"
+
+namespace {
+
+uint32_t be24( const uint8_t* p ) {
+   return ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+}
+
+struct Name {
+   uint8_t     id;
+   const char* name;
+};
+
+const Name NAMES[] = {
+   { TRACE::LOOP,    "loop" },
+   { TRACE::COMMAND, "command" },
+   { TRACE::BLOB,    "blob" },
+   { TRACE::EVENT,   "event" },
+   { TRACE::A_POLL,  "analog poll" },
+   { TRACE::A_ARMED, "analog armed" },
+   { TRACE::A_RUN,   "analog run" },
+   { TRACE::A_STOP,  "analog stop" },
+   { TRACE::A_READ,  "analog read" },
+   { TRACE::A_IDLE,  "analog idle" },
+   { TRACE::D_POLL,  "digital poll" },
+   { TRACE::D_READ,  "digital read" },
+   { TRACE::D_FIRED, "digital fired" },
+};
+
+}  // namespace
+
+bool
+ShieldTraceDecode::decode( const uint8_t* rec, size_t len, ShieldTrace& out ) {
+   if ( len < (size_t)TRACE::HEADER || rec[0] != (uint8_t)RECORDS::TRACE ) return false;
+   size_t n = rec[1];
+   if ( len != TRACE::HEADER + 4 * n ) return false;
+
+   out.total = (uint16_t)((rec[2] << 8) | rec[3]);
+   out.dumpedUs = (double)(((uint32_t)rec[4] << 24) | ((uint32_t)rec[5] << 16) | ((uint32_t)rec[6] << 8) | rec[7]);
+   out.overwritten = (uint16_t)(out.total - n);
+   uint32_t now = be24( rec + 8 );
+
+   out.points.clear();
+   const uint8_t* p = rec + TRACE::HEADER;
+   for ( size_t i = 0; i < n; i++, p += 4 ) {
+      uint32_t ago = (now - be24( p + 1 )) & 0xFFFFFF;
+      out.points.push_back( { p[0], out.dumpedUs - ago / 2.0 } );
+   }
+   return true;
+}
+
+const char*
+ShieldTraceDecode::name( uint8_t id ) {
+   for ( const Name& n : NAMES )
+      if ( n.id == id ) return n.name;
+   static char hex[8];
+   snprintf( hex, sizeof(hex), "0x%02x", id );
+   return hex;
+}
+
+void
+ShieldTraceDecode::print( FILE* out, const ShieldTrace& trace ) {
+   fprintf( out, "trace: %zu points, %u overwritten, dumped at %.1fμs\n",
+            trace.points.size(), trace.overwritten, trace.dumpedUs );
+   for ( size_t i = 0; i < trace.points.size(); i++ ) {
+      const ShieldTracePoint& p = trace.points[i];
+      if ( i == 0 ) fprintf( out, "%14.1f %9s  %s\n", p.us, "", name( p.id ) );
+      else          fprintf( out, "%14.1f %+9.1f  %s\n", p.us, p.us - trace.points[i-1].us, name( p.id ) );
+   }
+}
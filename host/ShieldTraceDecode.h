@@ -0,0 +1,45 @@
+/****************************************************************
+*  ShieldTraceDecode
+*  Turns a trace record (ST_TRACE, see lib/ShieldTrace) into points on
+*  the shield's micros() clock, and prints them as a timeline.
+*
+*  The firmware stamps each point with a 24 bit count of 0.5μs ticks and
+*  the dump with both micros() and the tick count, so a point's time is
+*  micros() at the dump less the ticks since the point. That holds for
+*  points up to 8.39s old, far longer than the ring lasts when anything
+*  is running.
+****************************************************************/
+#ifndef ShieldTraceDecode_h
+#define ShieldTraceDecode_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include <ShieldCommunicationCmds.h>
+
+struct ShieldTracePoint {
+   uint8_t id;   // TRACE::
+   double  us;   // micros() on the shield
+};
+
+struct ShieldTrace {
+   std::vector<ShieldTracePoint> points;   // oldest first
+   uint16_t total;        // points traced since the ring was emptied (wraps)
+   double   dumpedUs;     // micros() when the ring was sent
+   unsigned overwritten;  // points the ring had already lost
+};
+
+namespace ShieldTraceDecode {
+
+   // a whole 0xA8 record (ShieldParser::frameLength long), false if it is malformed
+   bool decode( const uint8_t* rec, size_t len, ShieldTrace& out );
+
+   // "analog read", or the id in hex for one we don't know
+   const char* name( uint8_t id );
+
+   // one line per point: time, time since the point before, name
+   void print( FILE* out, const ShieldTrace& trace );
+};
+
+#endif
@@ -0,0 +1,466 @@
+/****************************************************************
+*  shieldcap
+*  Capture everything the shield sends to a binary file at line rate.
+*
+*  The serial port is read in bulk (raw termios, epoll) straight into a
+*  double mapped ring, records are decoded in place by ShieldParser and
+*  the samples are written out in large blocks (see ShieldCapture.h for
+*  the file layout). Strings, status records, trace dumps and ACK/NAKs
+*  are reported on stderr. Python (or anything else) opens the file afterwards.
+*  At the end each port's counts are checked for gaps, duplicates and
+*  reordering (ShieldSeqCheck).
+*
+*  Opening the port resets an Uno (DTR), and what arrives before setup()
+*  is done is lost, so nothing is sent until the *HELLO* boot line has
+*  come in, as the Python client does.
+*
+*  usage: shieldcap [-b baud] [-c "hex bytes"]... [-t seconds] [-H] [-q] device file
+*     -b  link speed, default 460800 (the firmware's LINKSPEED::DEFAULT)
+*     -c  command bytes to send once the shield is up, e.g. -c d0 -c "85 7f"
+*         (repeatable, sent in order). The ports they arm are the ones
+*         beacons are expected for
+*     -t  stop after this many seconds, otherwise run until ^C
+*     -H  send HALT before exiting, then ask for the status of the ports
+*         that sent samples to account for every one of them
+*     -q  don't echo strings and answers
+****************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "ShieldCapture.h"
+#include "ShieldParser.h"
+#include "ShieldRing.h"
+#include "ShieldSeqCheck.h"
+#include "ShieldTraceDecode.h"
+
+#define RING_SIZE    (1 << 20)   // bytes of serial data that can be waiting
+#define WRITE_BLOCK  8192        // samples written to the file at a time
+#define SETTLE_NS    500000000ull  // after -H, longest to wait for the last samples and the status
+#define BOOT_NS      5000000000ull // longest to wait for the boot line after opening the port
+#define BOOT_MSG     "*HELLO*"     // the firmware's boot line starts with this
+
+static uint64_t nowNs( clockid_t clock ) {
+   struct timespec ts;
+   clock_gettime( clock, &ts );
+   return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Collects the samples and writes them out in blocks
+ **/
+class CaptureWriter : public ShieldParser::Handler {
+
+public:
+   CaptureWriter( int fd, bool quiet ) : _fd( fd ), _quiet( quiet ), _written( 0 ), _failed( false ) {
+      _block.reserve( WRITE_BLOCK );
+   }
+
+   void sample( const ShieldSample& s ) override {
+      _block.push_back( s );
+      if ( _block.size() >= WRITE_BLOCK ) flush();
+      if ( s.kind != SAMPLEKIND::SNAPSHOT ) {
+         _checks[s.src & 0x07].add( s.seq );
+         _seen |= 1 << (s.src & 0x07);
+      }
+   }
+
+   void text( const char* str, size_t len ) override {
+      if ( !_quiet ) fprintf( stderr, "shield: %.*s\n", (int)len, str );
+   }
+
+   void status( const uint8_t* rec, size_t len ) override {
+      _checks[rec[1] & 0x07].status( rec, len );
+      _asked &= ~(1 << (rec[1] & 0x07));
+      if ( _quiet ) return;
+      fprintf( stderr, "status src %d:", rec[1] );
+      for ( size_t i = 3; i < len; i++ ) fprintf( stderr, " %02x", rec[i] );
+      fprintf( stderr, "\n" );
+   }
+
+   void record( const uint8_t* rec, size_t len ) override {
+      ShieldTrace trace;
+      if ( _quiet || rec[0] != (uint8_t)RECORDS::TRACE || !ShieldTraceDecode::decode( rec, len, trace ) ) return;
+      ShieldTraceDecode::print( stderr, trace );
+   }
+
+   void answer( int tag, bool ok ) override {
+      if ( _quiet ) return;
+      if ( tag < 0 ) fprintf( stderr, "%s\n", ok ? "ACK" : "NAK" );
+      else           fprintf( stderr, "%s tag %d\n", ok ? "ACK" : "NAK", tag );
+   }
+
+   bool flush() {
+      const uint8_t* p = (const uint8_t*)_block.data();
+      size_t left = _block.size() * sizeof(ShieldSample);
+      while ( left && !_failed ) {
+         ssize_t n = write( _fd, p, left );
+         if ( n < 0 ) {
+            if ( errno == EINTR ) continue;
+            perror( "shieldcap: write" );
+            _failed = true;
+            break;
+         }
+         p += n;
+         left -= n;
+      }
+      _written += _block.size();
+      _block.clear();
+      return !_failed;
+   }
+
+   uint64_t getWritten() const { return _written; }
+   bool     failed() const { return _failed; }
+
+   // ST_PORTSB mask of the ports that sent samples, the status records are then awaited
+   uint8_t askStatus() {
+      _asked = _seen & 0x7E & ~(1 << SOURCES::BTN);
+      return _asked >> 1;
+   }
+   bool answered() const { return _asked == 0; }
+
+   void accounts( FILE* out ) const {
+      for ( int src = 1; src < 8; src++ )
+         if ( _seen & (1 << src) ) _checks[src].print( out, src );
+   }
+
+private:
+   int                       _fd;
+   bool                      _quiet;
+   std::vector<ShieldSample> _block;
+   uint64_t                  _written;
+   bool                      _failed;
+   ShieldSeqCheck            _checks[8];  // by SOURCES
+   uint8_t                   _seen = 0;   // bit per source that sent samples
+   uint8_t                   _asked = 0;  // status records still to come
+};
+
+/**
+ * termios speed constant for a baud rate
+ **/
+static speed_t speedFor( unsigned long baud ) {
+   switch ( baud ) {
+      case 115200:  return B115200;
+      case 230400:  return B230400;
+      case 460800:  return B460800;
+      case 500000:  return B500000;
+      case 921600:  return B921600;
+      case 1000000: return B1000000;
+      case 2000000: return B2000000;
+   }
+   return B0;
+}
+
+/**
+ * Open the port raw, non blocking, 8N1
+ **/
+static int openPort( const char* device, unsigned long baud ) {
+   speed_t speed = speedFor( baud );
+   if ( speed == B0 ) {
+      fprintf( stderr, "shieldcap: unsupported baud rate %lu\n", baud );
+      return -1;
+   }
+   int fd = open( device, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC );
+   if ( fd < 0 ) {
+      perror( device );
+      return -1;
+   }
+   struct termios tio;
+   if ( tcgetattr( fd, &tio ) < 0 ) {
+      perror( "shieldcap: tcgetattr" );
+      close( fd );
+      return -1;
+   }
+   cfmakeraw( &tio );
+   tio.c_cflag |= CLOCAL | CREAD;
+   tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+   tio.c_cc[VMIN] = 0;
+   tio.c_cc[VTIME] = 0;
+   cfsetispeed( &tio, speed );
+   cfsetospeed( &tio, speed );
+   if ( tcsetattr( fd, TCSANOW, &tio ) < 0 ) {
+      perror( "shieldcap: tcsetattr" );
+      close( fd );
+      return -1;
+   }
+   tcflush( fd, TCIOFLUSH );
+   return fd;
+}
+
+/**
+ * "85 7f" -> { 0x85, 0x7F }
+ **/
+static bool parseHex( const char* arg, std::vector<uint8_t>& out ) {
+   while ( *arg ) {
+      if ( *arg == ' ' || *arg == ',' ) {
+         arg++;
+         continue;
+      }
+      char* end;
+      unsigned long v = strtoul( arg, &end, 16 );
+      if ( end == arg || v > 0xFF ) return false;
+      out.push_back( (uint8_t)v );
+      arg = end;
+   }
+   return true;
+}
+
+/**
+ * Throw away what comes in (the bootloader, the end of an earlier run)
+ * until the boot line, the rest of that read goes into the ring. False
+ * if it doesn't come, e.g. a board that doesn't reset on open.
+ **/
+static bool waitForBoot( int fd, ShieldRing& ring, bool quiet ) {
+   std::string seen;
+   uint64_t deadline = nowNs( CLOCK_MONOTONIC ) + BOOT_NS;
+   for ( ;; ) {
+      uint64_t now = nowNs( CLOCK_MONOTONIC );
+      if ( now >= deadline ) return false;
+      struct pollfd p = { fd, POLLIN, 0 };
+      if ( poll( &p, 1, (int)((deadline - now) / 1000000) + 1 ) < 0 && errno != EINTR ) return false;
+      char buf[256];
+      ssize_t got = read( fd, buf, sizeof(buf) );
+      if ( got < 0 && errno != EAGAIN && errno != EINTR ) return false;
+      if ( got <= 0 ) continue;
+      seen.append( buf, got );
+      size_t at = seen.find( BOOT_MSG );
+      size_t end = at == std::string::npos ? at : seen.find( '\n', at );
+      if ( end == std::string::npos ) {
+         if ( at == std::string::npos && seen.size() > 64 ) seen.erase( 0, seen.size() - 64 );
+         continue;
+      }
+      int len = (int)(end - at);
+      if ( seen[end-1] == '\r' ) len--;
+      if ( !quiet ) fprintf( stderr, "shield: %.*s\n", len, seen.c_str() + at );
+      size_t rest = seen.size() - end - 1;
+      memcpy( ring.writePtr(), seen.data() + end + 1, rest );
+      ring.commit( rest );
+      return true;
+   }
+}
+
+static bool sendAll( int fd, const std::vector<uint8_t>& bytes ) {
+   size_t done = 0;
+   while ( done < bytes.size() ) {
+      ssize_t n = write( fd, bytes.data() + done, bytes.size() - done );
+      if ( n < 0 ) {
+         if ( errno == EAGAIN || errno == EINTR ) continue;
+         perror( "shieldcap: send" );
+         return false;
+      }
+      done += n;
+   }
+   tcdrain( fd );
+   return true;
+}
+
+/**
+ * The ports the commands arm (ARM, MDE_CONFIG with F_ARM), a beacon for
+ * any other is damage. Without either there is no telling, any port goes.
+ **/
+static uint8_t armedBy( const std::vector<uint8_t>& cmds ) {
+   bool arming = false;
+   uint8_t mask = 0;
+   for ( size_t i = 0; i + 1 < cmds.size(); i++ ) {
+      if ( cmds[i] == (uint8_t)CMDS::ARM ) {
+         arming = true;
+         mask |= cmds[i+1];
+      } else if ( cmds[i] == (uint8_t)CMDS::MDE_CONFIG && i + 3 < cmds.size() ) {
+         arming = true;
+         if ( cmds[i+2] & EXTCMD::F_ARM ) mask |= cmds[i+3];
+      }
+   }
+   return arming ? mask : 0x3F;
+}
+
+static void usage() {
+   fprintf( stderr, "usage: shieldcap [-b baud] [-c \"hex bytes\"]... [-t seconds] [-H] [-q] device file\n" );
+}
+
+int main( int argc, char** argv ) {
+   unsigned long baud = 460800;
+   std::vector<uint8_t> commands;
+   double seconds = 0;
+   bool halt = false;
+   bool quiet = false;
+
+   int opt;
+   while ( (opt = getopt( argc, argv, "b:c:t:Hq" )) != -1 ) {
+      switch ( opt ) {
+         case 'b': baud = strtoul( optarg, nullptr, 10 ); break;
+         case 'c':
+            if ( !parseHex( optarg, commands ) ) {
+               fprintf( stderr, "shieldcap: bad command bytes '%s'\n", optarg );
+               return 2;
+            }
+            break;
+         case 't': seconds = atof( optarg ); break;
+         case 'H': halt = true; break;
+         case 'q': quiet = true; break;
+         default:  usage(); return 2;
+      }
+   }
+   if ( argc - optind != 2 ) {
+      usage();
+      return 2;
+   }
+
+   ShieldRing ring( RING_SIZE );
+   if ( !ring.valid() ) {
+      perror( "shieldcap: ring" );
+      return 1;
+   }
+
+   int port = openPort( argv[optind], baud );
+   if ( port < 0 ) return 1;
+
+   int out = open( argv[optind+1], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+   if ( out < 0 ) {
+      perror( argv[optind+1] );
+      return 1;
+   }
+   ShieldCaptureHeader header;
+   memset( &header, 0, sizeof(header) );
+   memcpy( header.magic, CAPTURE::MAGIC, sizeof(header.magic) );
+   header.version = CAPTURE::VERSION;
+   header.recordSize = sizeof(ShieldSample);
+   header.baud = baud;
+   header.startNs = nowNs( CLOCK_REALTIME );
+   if ( write( out, &header, sizeof(header) ) != (ssize_t)sizeof(header) ) {
+      perror( "shieldcap: header" );
+      return 1;
+   }
+
+   // ^C and kill end the capture cleanly
+   sigset_t signals;
+   sigemptyset( &signals );
+   sigaddset( &signals, SIGINT );
+   sigaddset( &signals, SIGTERM );
+   sigprocmask( SIG_BLOCK, &signals, nullptr );
+   int sigs = signalfd( -1, &signals, SFD_CLOEXEC );
+
+   int ep = epoll_create1( EPOLL_CLOEXEC );
+   struct epoll_event ev;
+   memset( &ev, 0, sizeof(ev) );
+   ev.events = EPOLLIN;
+   ev.data.fd = port;
+   epoll_ctl( ep, EPOLL_CTL_ADD, port, &ev );
+   ev.data.fd = sigs;
+   epoll_ctl( ep, EPOLL_CTL_ADD, sigs, &ev );
+
+   CaptureWriter writer( out, quiet );
+   ShieldParser parser( writer );
+   parser.setArmed( armedBy( commands ) );
+
+   if ( !waitForBoot( port, ring, quiet ) )
+      fprintf( stderr, "shieldcap: no %s from the shield in %llus, carrying on\n", BOOT_MSG, BOOT_NS / 1000000000ull );
+   if ( !commands.empty() && !sendAll( port, commands ) ) return 1;
+
+   uint64_t start = nowNs( CLOCK_MONOTONIC );
+   uint64_t deadline = seconds > 0 ? start + (uint64_t)(seconds * 1e9) : 0;
+   uint64_t received = 0;
+   bool running = true;
+   bool halted = false;
+   int result = 0;
+
+   // with -H the end is a HALT and a request for the status of the ports
+   // heard from, the capture runs on until that has come back
+   auto finish = [&]() {
+      if ( !halt || halted ) return false;
+      halted = true;
+      std::vector<uint8_t> cmds( 1, (uint8_t)CMDS::HALT );
+      uint8_t mask = writer.askStatus();
+      if ( mask ) {
+         cmds.push_back( (uint8_t)CMDS::ST_PORTSB );
+         cmds.push_back( mask );
+      }
+      sendAll( port, cmds );
+      deadline = nowNs( CLOCK_MONOTONIC ) + SETTLE_NS;
+      return true;
+   };
+
+   while ( running ) {
+      if ( halted && writer.answered() ) break;
+      int timeout = -1;
+      if ( deadline ) {
+         uint64_t now = nowNs( CLOCK_MONOTONIC );
+         if ( now >= deadline ) {
+            if ( finish() ) continue;
+            break;
+         }
+         timeout = (int)((deadline - now) / 1000000) + 1;
+      }
+      struct epoll_event events[2];
+      int n = epoll_wait( ep, events, 2, timeout );
+      if ( n < 0 ) {
+         if ( errno == EINTR ) continue;
+         perror( "shieldcap: epoll" );
+         result = 1;
+         break;
+      }
+      for ( int i = 0; i < n; i++ ) {
+         if ( events[i].data.fd == sigs ) {
+            struct signalfd_siginfo si;
+            if ( read( sigs, &si, sizeof(si) ) < 0 ) {}
+            if ( !finish() ) running = false;  // a second ^C doesn't wait
+            continue;
+         }
+         // drain everything the driver has
+         for ( ;; ) {
+            if ( ring.writable() == 0 ) {  // only junk could fill a ring this size
+               fprintf( stderr, "shieldcap: ring full, no records found\n" );
+               ring.consume( ring.readable() );
+            }
+            ssize_t got = read( port, ring.writePtr(), ring.writable() );
+            if ( got < 0 ) {
+               if ( errno == EAGAIN || errno == EINTR ) break;
+               perror( "shieldcap: read" );
+               running = false;
+               result = 1;
+               break;
+            }
+            if ( got == 0 ) break;
+            ring.commit( got );
+            received += got;
+            ring.consume( parser.parse( ring.readPtr(), ring.readable() ) );
+         }
+         if ( events[i].events & (EPOLLHUP | EPOLLERR) ) {
+            fprintf( stderr, "shieldcap: port closed\n" );
+            running = false;
+         }
+      }
+      if ( writer.failed() ) {
+         result = 1;
+         break;
+      }
+   }
+
+   if ( halt && !halted ) sendAll( port, std::vector<uint8_t>( 1, (uint8_t)CMDS::HALT ) );
+   if ( !writer.flush() ) result = 1;
+   close( out );
+   close( port );
+
+   double elapsed = (nowNs( CLOCK_MONOTONIC ) - start) / 1e9;
+   const ShieldParser::Counts& c = parser.getCounts();
+   fprintf( stderr, "shieldcap: %llu bytes in %.1fs (%.0f B/s), %llu samples written\n",
+            (unsigned long long)received, elapsed, elapsed > 0 ? received / elapsed : 0.0,
+            (unsigned long long)writer.getWritten() );
+   fprintf( stderr, "  blobs %llu  events %llu  snapshots %llu  strings %llu  status %llu  answers %llu  beacons %llu  other %llu  junk %llu\n",
+            (unsigned long long)c.blobs, (unsigned long long)c.events, (unsigned long long)c.snapshots,
+            (unsigned long long)c.strings, (unsigned long long)c.status, (unsigned long long)c.answers, (unsigned long long)c.beacons,
+            (unsigned long long)c.other, (unsigned long long)c.junk );
+   writer.accounts( stderr );
+   return result;
+}
@@ -0,0 +1,171 @@
+/****************************************************************
+*  shielddecode
+*  Python binding for ShieldBlobDecoder. Takes anything that supports
+*  the buffer protocol (bytes, bytearray, mmap, numpy arrays...) and
+*  returns the columns as typed memoryviews, np.asarray() wraps them
+*  without a copy.
+*
+*     import shielddecode
+*     dec = shielddecode.Decoder()
+*     cols = dec.decode(raw)     # {'time','raw','src','seq','clock','count','consumed'}
+*     dec.counts                 # blobs, other, junk, gaps, missing
+*
+*  The decoder keeps the seq# history and the timeline between calls so
+*  a stream can be fed in pieces; start the next call at cols['consumed'].
+*  clock and count are time and seq with the wraps put back.
+****************************************************************/
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <new>
+#include "ShieldDecode.h"
+
+struct DecoderObject {
+   PyObject_HEAD
+   ShieldBlobDecoder decoder;
+};
+
+/**
+ * A bytearray of n items viewed as format fmt
+ **/
+static PyObject* column( PyObject* bytes, const char* fmt ) {
+   PyObject* view = PyMemoryView_FromObject( bytes );
+   if ( !view ) return nullptr;
+   PyObject* typed = PyObject_CallMethod( view, "cast", "s", fmt );
+   Py_DECREF( view );
+   return typed;
+}
+
+static PyObject* Decoder_new( PyTypeObject* type, PyObject*, PyObject* ) {
+   allocfunc alloc = (allocfunc)PyType_GetSlot( type, Py_tp_alloc );
+   DecoderObject* self = (DecoderObject*)alloc( type, 0 );
+   if ( self ) new ( &self->decoder ) ShieldBlobDecoder();
+   return (PyObject*)self;
+}
+
+static void Decoder_dealloc( DecoderObject* self ) {
+   PyTypeObject* type = Py_TYPE( self );
+   self->decoder.~ShieldBlobDecoder();
+   freefunc release = (freefunc)PyType_GetSlot( type, Py_tp_free );
+   release( self );
+   Py_DECREF( type );  // instances of heap types hold a reference to their type
+}
+
+static PyObject* Decoder_decode( DecoderObject* self, PyObject* arg ) {
+   Py_buffer in;
+   if ( PyObject_GetBuffer( arg, &in, PyBUF_SIMPLE ) < 0 ) return nullptr;
+
+   size_t cap = (size_t)in.len / 8;
+   PyObject* bufs[6] = {
+      PyByteArray_FromStringAndSize( nullptr, cap * sizeof(uint32_t) ),
+      PyByteArray_FromStringAndSize( nullptr, cap * sizeof(uint16_t) ),
+      PyByteArray_FromStringAndSize( nullptr, cap * sizeof(uint8_t) ),
+      PyByteArray_FromStringAndSize( nullptr, cap * sizeof(uint16_t) ),
+      PyByteArray_FromStringAndSize( nullptr, cap * sizeof(uint64_t) ),
+      PyByteArray_FromStringAndSize( nullptr, cap * sizeof(uint32_t) ),
+   };
+   PyObject* result = nullptr;
+   if ( bufs[0] && bufs[1] && bufs[2] && bufs[3] && bufs[4] && bufs[5] ) {
+      ShieldColumns cols;
+      cols.time  = (uint32_t*)PyByteArray_AS_STRING( bufs[0] );
+      cols.raw   = (uint16_t*)PyByteArray_AS_STRING( bufs[1] );
+      cols.src   = (uint8_t*)PyByteArray_AS_STRING( bufs[2] );
+      cols.seq   = (uint16_t*)PyByteArray_AS_STRING( bufs[3] );
+      cols.clock = (uint64_t*)PyByteArray_AS_STRING( bufs[4] );
+      cols.count = (uint32_t*)PyByteArray_AS_STRING( bufs[5] );
+      cols.capacity = cap;
+
+      size_t consumed = 0;
+      size_t n;
+      Py_BEGIN_ALLOW_THREADS
+      n = self->decoder.decode( (const uint8_t*)in.buf, (size_t)in.len, cols, &consumed );
+      Py_END_ALLOW_THREADS
+
+      if ( PyByteArray_Resize( bufs[0], n * sizeof(uint32_t) ) == 0 &&
+           PyByteArray_Resize( bufs[1], n * sizeof(uint16_t) ) == 0 &&
+           PyByteArray_Resize( bufs[2], n * sizeof(uint8_t) ) == 0 &&
+           PyByteArray_Resize( bufs[3], n * sizeof(uint16_t) ) == 0 &&
+           PyByteArray_Resize( bufs[4], n * sizeof(uint64_t) ) == 0 &&
+           PyByteArray_Resize( bufs[5], n * sizeof(uint32_t) ) == 0 ) {
+         PyObject* time  = column( bufs[0], "I" );
+         PyObject* raw   = column( bufs[1], "H" );
+         PyObject* src   = column( bufs[2], "B" );
+         PyObject* seq   = column( bufs[3], "H" );
+         PyObject* clock = column( bufs[4], "Q" );
+         PyObject* count = column( bufs[5], "I" );
+         if ( time && raw && src && seq && clock && count )
+            result = Py_BuildValue( "{s:O,s:O,s:O,s:O,s:O,s:O,s:n}", "time", time, "raw", raw, "src", src,
+                                    "seq", seq, "clock", clock, "count", count, "consumed", (Py_ssize_t)consumed );
+         Py_XDECREF( time );
+         Py_XDECREF( raw );
+         Py_XDECREF( src );
+         Py_XDECREF( seq );
+         Py_XDECREF( clock );
+         Py_XDECREF( count );
+      }
+   }
+   for ( PyObject* b : bufs ) Py_XDECREF( b );
+   PyBuffer_Release( &in );
+   return result;
+}
+
+static PyObject* Decoder_reset( DecoderObject* self, PyObject* ) {
+   self->decoder.reset();
+   Py_RETURN_NONE;
+}
+
+static PyObject* Decoder_counts( DecoderObject* self, void* ) {
+   const ShieldBlobDecoder::Counts& c = self->decoder.getCounts();
+   return Py_BuildValue( "{s:K,s:K,s:K,s:K,s:K}",
+                         "blobs", (unsigned long long)c.blobs, "other", (unsigned long long)c.other,
+                         "junk", (unsigned long long)c.junk, "gaps", (unsigned long long)c.gaps,
+                         "missing", (unsigned long long)c.missing );
+}
+
+static PyMethodDef Decoder_methods[] = {
+   { "decode", (PyCFunction)Decoder_decode, METH_O,
+     "decode(buffer) -> dict of time, raw, src, seq, clock, count columns and the bytes consumed" },
+   { "reset", (PyCFunction)Decoder_reset, METH_NOARGS, "forget the seq# history and the timeline (after a SYNC)" },
+   { nullptr, nullptr, 0, nullptr }
+};
+
+static PyGetSetDef Decoder_getset[] = {
+   { "counts", (getter)Decoder_counts, nullptr, "blobs, other records, junk bytes, gaps and missing blobs", nullptr },
+   { nullptr, nullptr, nullptr, nullptr, nullptr }
+};
+
+static PyType_Slot Decoder_slots[] = {
+   { Py_tp_new, (void*)Decoder_new },
+   { Py_tp_dealloc, (void*)Decoder_dealloc },
+   { Py_tp_methods, (void*)Decoder_methods },
+   { Py_tp_getset, (void*)Decoder_getset },
+   { Py_tp_doc, (void*)"Decodes data blobs into columns, keeps the seq# history between calls" },
+   { 0, nullptr }
+};
+
+static PyType_Spec Decoder_spec = {
+   "shielddecode.Decoder", sizeof(DecoderObject), 0, Py_TPFLAGS_DEFAULT, Decoder_slots
+};
+
+static PyModuleDef module = {
+   PyModuleDef_HEAD_INIT,
+   "shielddecode",
+   "Batch decoder for Vernier shield data blobs",
+   -1, nullptr, nullptr, nullptr, nullptr, nullptr
+};
+
+PyMODINIT_FUNC PyInit_shielddecode() {
+   PyObject* m = PyModule_Create( &module );
+   if ( !m ) return nullptr;
+   PyObject* type = PyType_FromSpec( &Decoder_spec );
+   if ( !type || PyModule_AddObject( m, "Decoder", type ) < 0 ) {  // takes the reference if it works
+      Py_XDECREF( type );
+      Py_DECREF( m );
+      return nullptr;
+   }
+   if ( PyModule_AddStringConstant( m, "KERNEL", ShieldBlobDecoder::kernel() ) < 0 ) {
+      Py_DECREF( m );
+      return nullptr;
+   }
+   return m;
+}
@@ -0,0 +1,215 @@
+/****************************************************************
+*  shielddecode_test
+*  The SIMD kernels of ShieldBlobDecoder against the scalar one.
+*
+*  A random stream of blob runs (every source, seq#s and time wrapping,
+*  gaps, immediate readings), beacons, strings, ACKs and compact events is
+*  decoded with each kernel this CPU has, from every misalignment of
+*  the buffer and fed in random pieces into columns of random
+*  capacity. Every column and count has to match the scalar kernel's,
+*  and without the junk bytes the scalar kernel has to give back what
+*  was generated.
+*
+*  usage: shielddecode_test [seed]     (make test)
+****************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+#include <vector>
+
+#include "ShieldDecode.h"
+#include "ShieldParser.h"
+
+#define BLOBS       200000   // in each stream
+#define MAX_CHUNK   4096     // most bytes handed to decode() at a time
+#define MAX_COLUMNS 512      // largest column capacity tried
+
+namespace {
+
+struct Decoded {
+   std::vector<uint32_t> time;
+   std::vector<uint16_t> raw;
+   std::vector<uint8_t>  src;
+   std::vector<uint16_t> seq;
+   std::vector<uint64_t> clock;
+   std::vector<uint32_t> count;
+   ShieldBlobDecoder::Counts counts;
+};
+
+/**
+ * A stream like the shield's with the blobs that went into it
+ **/
+struct Stream {
+   std::vector<uint8_t> bytes;
+   Decoded              truth;
+
+   Stream( uint64_t seed, bool junk ) {
+      std::mt19937_64 rng( seed );
+      uint64_t now = 0;
+      uint32_t count[8] = { 0 };
+      for ( size_t blobs = 0; blobs < BLOBS; ) {
+         switch ( rng() % 8 ) {
+            case 0: beacon( now, count ); break;
+            case 1: string( rng ); break;
+            case 2: bytes.push_back( rng() & 1 ? '!' : '?' ); break;
+            case 3: put( { (uint8_t)RECORDS::ACK, (uint8_t)(rng() & 0x7F) } ); break;
+            case 4: event( rng, now ); break;
+            case 5: if ( junk ) for ( int n = 1 + rng() % 6; n; n-- ) bytes.push_back( (uint8_t)rng() ); break;
+            default:
+               for ( int n = 1 + rng() % 40; n; n--, blobs++ ) blob( rng, now, count );
+         }
+      }
+   }
+
+   void put( std::initializer_list<uint8_t> b ) { bytes.insert( bytes.end(), b ); }
+   void put32( uint32_t v ) { put( { (uint8_t)(v >> 24), (uint8_t)(v >> 16), (uint8_t)(v >> 8), (uint8_t)v } ); }
+
+   void blob( std::mt19937_64& rng, uint64_t& now, uint32_t* count ) {
+      now += 1 + rng() % 50000;                   // wraps the 32 bit time about once
+      uint8_t src = 1 + rng() % 6;
+      uint16_t raw = rng() & 0x3FF;
+      uint32_t n = 0;                             // an immediate reading
+      if ( rng() % 64 || (count[src] & 0x7FF) == 0x7FF ) {
+         if ( rng() % 32 == 0 ) {                 // lost on the way, not landing on a 0
+            count[src] += 1 + rng() % 50;         // that would read as an immediate one
+            if ( ((count[src] + 1) & 0x7FF) == 0 ) count[src]++;
+         }
+         n = ++count[src];
+      }
+      uint16_t seq = n & 0x7FF;
+      uint32_t w = ((uint32_t)seq << 13) | ((uint32_t)raw << 3) | src;
+      put( { (uint8_t)RECORDS::BLOB, (uint8_t)(w >> 16), (uint8_t)(w >> 8), (uint8_t)w } );
+      put32( (uint32_t)now );
+      truth.time.push_back( (uint32_t)now );
+      truth.raw.push_back( raw );
+      truth.src.push_back( src );
+      truth.seq.push_back( seq );
+      truth.clock.push_back( src == SOURCES::DIG1 || src == SOURCES::DIG2 ? (uint32_t)now : now );
+      truth.count.push_back( n );
+   }
+
+   void beacon( uint64_t now, const uint32_t* count ) {
+      put( { (uint8_t)RECORDS::BEACON, 0x3F, (uint8_t)(now >> 40), (uint8_t)(now >> 32) } );
+      put32( (uint32_t)now );
+      for ( int src = SOURCES::DIG1; src <= SOURCES::ANA210; src++ ) put32( count[src] );
+   }
+
+   void string( std::mt19937_64& rng ) {
+      bytes.push_back( (uint8_t)RECORDS::STRING );
+      for ( int n = rng() % 30; n; n-- ) bytes.push_back( 'a' + rng() % 26 );
+      bytes.push_back( '\n' );
+   }
+
+   void event( std::mt19937_64& rng, uint64_t now ) {
+      bytes.push_back( (uint8_t)RECORDS::EVENT | RECORDS::EVENT_ANCHOR | (rng() & 1 ? RECORDS::EVENT_RISE : 0) | (1 + rng() % 2) );
+      put32( (uint32_t)now );
+   }
+};
+
+/**
+ * The stream at offset from a 64 byte boundary, fed in random pieces
+ * into random capacities, all drawn from seed
+ **/
+Decoded decode( const std::vector<uint8_t>& stream, size_t offset, uint64_t seed ) {
+   std::mt19937_64 rng( seed );
+   std::vector<uint8_t> store( stream.size() + 128 );
+   uint8_t* data = (uint8_t*)(((uintptr_t)store.data() + 63) & ~(uintptr_t)63) + offset;
+   memcpy( data, stream.data(), stream.size() );
+
+   ShieldBlobDecoder dec;
+   Decoded out;
+   std::vector<uint32_t> time( MAX_COLUMNS ), count( MAX_COLUMNS );
+   std::vector<uint16_t> raw( MAX_COLUMNS ), seq( MAX_COLUMNS );
+   std::vector<uint8_t>  src( MAX_COLUMNS );
+   std::vector<uint64_t> clock( MAX_COLUMNS );
+   size_t pos = 0, end = 0;
+   while ( pos < stream.size() ) {
+      if ( end < stream.size() ) end = std::min( stream.size(), end + 1 + rng() % MAX_CHUNK );
+      ShieldColumns cols = { time.data(), raw.data(), src.data(), seq.data(), clock.data(), count.data(),
+                             1 + rng() % MAX_COLUMNS };
+      size_t consumed;
+      size_t n = dec.decode( data + pos, end - pos, cols, &consumed );
+      out.time.insert( out.time.end(), time.begin(), time.begin() + n );
+      out.raw.insert( out.raw.end(), raw.begin(), raw.begin() + n );
+      out.src.insert( out.src.end(), src.begin(), src.begin() + n );
+      out.seq.insert( out.seq.end(), seq.begin(), seq.begin() + n );
+      out.clock.insert( out.clock.end(), clock.begin(), clock.begin() + n );
+      out.count.insert( out.count.end(), count.begin(), count.begin() + n );
+      pos += consumed;
+      if ( n == 0 && consumed == 0 && end == stream.size() ) break;   // only an incomplete record left
+   }
+   out.counts = dec.getCounts();
+   return out;
+}
+
+template<class T> bool same( const char* what, const std::vector<T>& a, const std::vector<T>& b ) {
+   if ( a.size() != b.size() ) {
+      fprintf( stderr, "  %s: %zu values against %zu\n", what, a.size(), b.size() );
+      return false;
+   }
+   for ( size_t i = 0; i < a.size(); i++ ) {
+      if ( a[i] != b[i] ) {
+         fprintf( stderr, "  %s[%zu]: %llu against %llu\n", what, i, (unsigned long long)a[i], (unsigned long long)b[i] );
+         return false;
+      }
+   }
+   return true;
+}
+
+bool same( const Decoded& a, const Decoded& b, bool withCounts ) {
+   bool ok = same( "time", a.time, b.time ) & same( "raw", a.raw, b.raw ) & same( "src", a.src, b.src ) &
+             same( "seq", a.seq, b.seq ) & same( "clock", a.clock, b.clock ) & same( "count", a.count, b.count );
+   if ( withCounts && memcmp( &a.counts, &b.counts, sizeof(a.counts) ) ) {
+      fprintf( stderr, "  counts: blobs %llu/%llu other %llu/%llu junk %llu/%llu gaps %llu/%llu missing %llu/%llu\n",
+               (unsigned long long)a.counts.blobs, (unsigned long long)b.counts.blobs,
+               (unsigned long long)a.counts.other, (unsigned long long)b.counts.other,
+               (unsigned long long)a.counts.junk, (unsigned long long)b.counts.junk,
+               (unsigned long long)a.counts.gaps, (unsigned long long)b.counts.gaps,
+               (unsigned long long)a.counts.missing, (unsigned long long)b.counts.missing );
+      ok = false;
+   }
+   return ok;
+}
+
+}  // namespace
+
+int main( int argc, char** argv ) {
+   uint64_t seed = argc > 1 ? strtoull( argv[1], nullptr, 0 ) : 1;
+   const char* best = ShieldBlobDecoder::kernel();
+   int failed = 0;
+
+   Stream clean( seed, false );
+   ShieldBlobDecoder::useKernel( "scalar" );
+   if ( !same( decode( clean.bytes, 0, seed ), clean.truth, false ) ) {
+      fprintf( stderr, "scalar: the clean stream didn't decode to what went into it\n" );
+      failed++;
+   }
+
+   Stream noisy( seed + 1, true );
+   for ( const char* kernel : { "ssse3", "avx2" } ) {
+      if ( !ShieldBlobDecoder::useKernel( kernel ) ) {
+         printf( "%s: not on this CPU, skipped\n", kernel );
+         continue;
+      }
+      int before = failed;
+      for ( const Stream* s : { &clean, &noisy } ) {
+         for ( size_t offset = 0; offset < 32; offset++ ) {
+            uint64_t pieces = seed * 131 + offset;
+            ShieldBlobDecoder::useKernel( "scalar" );
+            Decoded want = decode( s->bytes, offset, pieces );
+            ShieldBlobDecoder::useKernel( kernel );
+            if ( !same( decode( s->bytes, offset, pieces ), want, true ) ) {
+               fprintf( stderr, "%s: %s stream at offset %zu differs from scalar\n", kernel, s == &clean ? "clean" : "noisy", offset );
+               failed++;
+            }
+         }
+      }
+      if ( failed == before ) printf( "%s: %zu + %zu blobs from 32 offsets match scalar\n", kernel, clean.truth.time.size(), noisy.truth.time.size() );
+   }
+   ShieldBlobDecoder::useKernel( best );
+
+   if ( failed ) fprintf( stderr, "shielddecode_test: %d failed (seed %llu)\n", failed, (unsigned long long)seed );
+   return failed ? 1 : 0;
+}
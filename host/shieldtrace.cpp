@@ -0,0 +1,133 @@
+/****************************************************************
+*  shieldtrace
+*  Decode the trace dumps (ST_TRACE) in a raw stream from the shield
+*  into timelines, and sum up the time between each pair of points.
+*
+*  usage: shieldtrace [-s] [-q] [file]...
+*     -s  after the timelines, each step from one point to the next:
+*         how often it was taken and its min, mean and max μs
+*     -q  don't print the timelines
+*  Reads stdin without a file, e.g. the -o output of the native build
+*  or a serial port set up with stty.
+****************************************************************/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "ShieldParser.h"
+#include "ShieldTraceDecode.h"
+
+struct Step {
+   unsigned long n = 0;
+   double min = 0;
+   double max = 0;
+   double sum = 0;
+};
+
+/**
+ * Prints each trace as it turns up and keeps the steps for the summary
+ **/
+class TraceHandler : public ShieldParser::Handler {
+
+public:
+   explicit TraceHandler( bool quiet ) : _quiet( quiet ), _traces( 0 ) {}
+
+   void sample( const ShieldSample& ) override {}
+
+   void record( const uint8_t* rec, size_t len ) override {
+      if ( rec[0] != (uint8_t)RECORDS::TRACE ) return;
+      ShieldTrace trace;
+      if ( !ShieldTraceDecode::decode( rec, len, trace ) ) {
+         fprintf( stderr, "shieldtrace: bad trace record\n" );
+         return;
+      }
+      _traces++;
+      if ( !_quiet ) ShieldTraceDecode::print( stdout, trace );
+      for ( size_t i = 1; i < trace.points.size(); i++ ) {
+         double us = trace.points[i].us - trace.points[i-1].us;
+         Step& s = _steps[std::make_pair( trace.points[i-1].id, trace.points[i].id )];
+         if ( s.n == 0 || us < s.min ) s.min = us;
+         if ( s.n == 0 || us > s.max ) s.max = us;
+         s.sum += us;
+         s.n++;
+      }
+   }
+
+   void summary( FILE* out ) const {
+      fprintf( out, "%-14s %-14s %8s %9s %9s %9s\n", "from", "to", "n", "min", "mean", "max" );
+      for ( const auto& step : _steps ) {
+         const Step& s = step.second;
+         fprintf( out, "%-14s ", ShieldTraceDecode::name( step.first.first ) );
+         fprintf( out, "%-14s %8lu %9.1f %9.1f %9.1f\n", ShieldTraceDecode::name( step.first.second ),
+                  s.n, s.min, s.sum / s.n, s.max );
+      }
+   }
+
+   unsigned long getTraces() const { return _traces; }
+
+private:
+   bool                                            _quiet;
+   unsigned long                                   _traces;
+   std::map<std::pair<uint8_t, uint8_t>, Step>    _steps;
+};
+
+static bool readAll( int fd, ShieldParser& parser ) {
+   std::vector<uint8_t> buf;
+   uint8_t chunk[65536];
+   for ( ;; ) {
+      ssize_t got = read( fd, chunk, sizeof(chunk) );
+      if ( got < 0 ) {
+         perror( "shieldtrace: read" );
+         return false;
+      }
+      if ( got == 0 ) break;
+      buf.insert( buf.end(), chunk, chunk + got );
+      buf.erase( buf.begin(), buf.begin() + parser.parse( buf.data(), buf.size() ) );
+   }
+   return true;
+}
+
+static void usage() {
+   fprintf( stderr, "usage: shieldtrace [-s] [-q] [file]...\n" );
+}
+
+int main( int argc, char** argv ) {
+   bool steps = false;
+   bool quiet = false;
+
+   int opt;
+   while ( (opt = getopt( argc, argv, "sq" )) != -1 ) {
+      switch ( opt ) {
+         case 's': steps = true; break;
+         case 'q': quiet = true; break;
+         default:  usage(); return 2;
+      }
+   }
+
+   TraceHandler handler( quiet );
+   int result = 0;
+   if ( optind == argc ) {
+      ShieldParser parser( handler );
+      if ( !readAll( 0, parser ) ) result = 1;
+   }
+   for ( int i = optind; i < argc; i++ ) {
+      int fd = open( argv[i], O_RDONLY | O_CLOEXEC );
+      if ( fd < 0 ) {
+         perror( argv[i] );
+         result = 1;
+         continue;
+      }
+      ShieldParser parser( handler );
+      if ( !readAll( fd, parser ) ) result = 1;
+      close( fd );
+   }
+
+   if ( handler.getTraces() == 0 ) fprintf( stderr, "shieldtrace: no trace records\n" );
+   if ( steps ) handler.summary( stdout );
+   return result;
+}
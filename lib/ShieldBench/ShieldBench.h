@@ -0,0 +1,51 @@
+/****************************************************************
+*  ShieldBench
+*  Markers for the cycle benchmarks (see bench/readme.md). Built with
+*  -D SHIELD_BENCH ([env:uno_bench]) every marked stretch of code writes
+*  its id to GPIOR0 when it starts and id|0x80 when it ends. GPIOR0 is a
+*  general purpose I/O register nothing else uses, each write is one
+*  `out` instruction (1 cycle), and the simulator watches it to count
+*  the cycles in between.
+*
+*  Without SHIELD_BENCH, or off the AVR, the markers are nothing at all.
+*
+*     bool VernierAnalogSensor::pollPort() {
+*             BENCH_SCOPE( BENCH::ANALOG_POLL );  // ends at every return
+*             ...
+****************************************************************/
+#ifndef ShieldBench_h
+#define ShieldBench_h
+#include <Arduino.h>
+
+// what is being timed, ids 1..127. bench/shieldbench.cpp has the same names.
+namespace BENCH {
+  const uint8_t LOOP         = 1;  // one pass of loop()
+  const uint8_t COMMANDS     = 2;  // ShieldCommunication::processCommands
+  const uint8_t ANALOG_POLL  = 3;  // VernierAnalogSensor::pollPort
+  const uint8_t DIGITAL_POLL = 4;  // VernierDigitalSensor::pollPort
+  const uint8_t SEND_BLOB    = 5;  // ShieldCommunication::sendDataBlob
+  const uint8_t SEND_EVENT   = 6;  // ShieldCommunication::sendDigitalEvent
+  const uint8_t BEACON       = 7;  // checkBeacon
+};
+
+#if defined(SHIELD_BENCH) && defined(__AVR__)
+
+struct ShieldBenchScope {
+  const uint8_t id;
+  ShieldBenchScope( uint8_t i ) : id( i ) { GPIOR0 = id; }
+  ~ShieldBenchScope() { GPIOR0 = id | 0x80; }
+};
+
+#define BENCH_BEGIN(id) (GPIOR0 = (id))
+#define BENCH_END(id)   (GPIOR0 = (id) | 0x80)
+#define BENCH_SCOPE(id) ShieldBenchScope _benchScope( id )
+
+#else
+
+#define BENCH_BEGIN(id)
+#define BENCH_END(id)
+#define BENCH_SCOPE(id)
+
+#endif
+
+#endif
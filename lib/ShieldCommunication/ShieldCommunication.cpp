@@ -1,9 +1,9 @@
 
 /****************************************************************
 *  ShieldCommunication
-*  This encapsulates the serial communication from the host machine. The Serial
-*  port is managed outside this object through the establishment of a baud rate
-*  and .begin notification.  After that this object is meant to do all the work.
+*  This encapsulates the serial communication from the host machine. The UART
+*  (ShieldPort) is started outside this object through the establishment of a baud
+*  rate and .begin notification.  After that this object is meant to do all the work.
 *
 *  Tested and developed in Platformio 3.1.0
 *  PBeeken ByramHills High School 9.1.2016
@@ -11,17 +11,95 @@
 *  10 Dec 2016- P. Beeken, Byram Hils High School
 *  07 Jul 2017- tested communication to two different interfaces
 *  12 Jul 2017- begin development of a binary communication protocol
+*  Data goes out through ShieldPort's interrupt driven transmit ring
 ****************************************************************/
 
 #include <ShieldCommunication.h>
 #include <Streaming.h>
+#include <ShieldBench.h>
+#include <ShieldStats.h>
+#include <ShieldTrace.h>
 
 /**
  * Initialize object to receive
  **/
 ShieldCommunication::ShieldCommunication() {
    _paramCount = -1;
+   _tag = -1;
+   _extended = false;
+   _commands = NULL;
+   _commandCount = 0;
+   _known = false;
    // Command is complete, we are ready for another command
+   _eventEncoding = DEVENTENC::BLOB;
+   resetEventAnchors();
+   clearDropped();
+   _linkSpeed = LINKSPEED::DEFAULT;
+   _linkPending = false;
+}
+
+// baud rates for each LINKSPEED index
+static const unsigned long LINK_BAUD[LINKSPEED::COUNT] = { 4*115200L, 1000000L, 2000000L };
+
+/**
+ * Register the table of commands this firmware understands. The table must
+ * be in PROGMEM.
+ **/
+void
+ShieldCommunication::setCommands( const CommandEntry* table, uint8_t count ) {
+   _commands = table;
+   _commandCount = count;
+}
+
+/**
+ * Look a predicate up in the command table, on success _entry holds a copy
+ **/
+bool
+ShieldCommunication::findCommand( char predicate ) {
+   for( uint8_t i=0; i<_commandCount; i++ ) {
+      memcpy_P( &_entry, &_commands[i], sizeof(CommandEntry) );
+      if ( _entry.predicate==predicate ) return true;
+   }
+   return false;
+}
+
+/**
+ * Meant to be called from several places in loop() so that HALT and the
+ * immediate reads are answered within one pass of the ports. Collects any
+ * waiting characters and, once a command is complete, runs its handler
+ * and sends the ACK/NAK the way the table says to.
+ **/
+bool
+ShieldCommunication::processCommands() {
+   BENCH_SCOPE( BENCH::COMMANDS );
+   if ( isReadyToBuild() ) {
+      if ( !ShieldPort.available() ) return false;
+      collectCommand();
+   }
+   if ( !isCommandComplete() ) return false;
+
+   unsigned long arrived = ShieldPort.getRxMicros();
+
+   if ( !_known ) {
+      badCommand();
+   } else if ( _entry.flags & CMDF::ACK_FIRST ) {
+      commandSuccessful();
+      _entry.handler();
+   } else if ( _entry.flags & CMDF::SELF_ACK ) {
+      _entry.handler();
+      if ( isCommandComplete() ) badCommand();  // the handler didn't answer
+   } else if ( _entry.flags & CMDF::NO_ACK ) {
+      _entry.handler();
+      _tag = -1;
+      _paramCount = -1;  // Ready to compile a new command.
+   } else if ( _entry.handler() ) {
+      commandSuccessful();
+   } else {
+      badCommand();
+   }
+   Stats.command( micros() - arrived );
+   TRACE_POINT( TRACE::COMMAND );
+   return true;
 }
 
 /**
@@ -50,7 +128,7 @@ ShieldCommunication::isReadyToBuild() {
 
 
 /** CollectCommand
- *  This routine is intended for the serialEvent stub where this object
+ *  This routine is called by processCommands() where this object
  *  waits for and collects the 'command.'  Commands consist of the
  *  instuction predicate and parameters. With ASCII commands we can use
  *  terminals and limited inputs to control flow. With binary this isn't
@@ -65,26 +143,57 @@ ShieldCommunication::isReadyToBuild() {
  *  communication is done except by counting characters.  Some command
  *  predicates do not have parameters while others do and the parameters (in
  *  binary might look like commands so we have to be careful.)
+ *  We stop reading as soon as a command is complete so commands sent back to
+ *  back wait their turn in the receive ring. A TAG command is absorbed here,
+ *  it only marks the command that follows it.
+ *  The parameter count comes from the command table when the predicate is
+ *  known, otherwise from its low two bits.
+ *  Variable length commands (e.g. MDE_CONFIG) have a count as their one parameter.
+ *  Once it arrives we keep going for that many data bytes plus a checksum
+ *  which are gathered in _ext rather than _param.
  **/
 void
 ShieldCommunication::collectCommand() {
-   // Since this is embeded in a serialEvent ISR there has to be
-   // at least one character.  Because we deal with character reception
+   // Because we deal with character reception
    // asynchronously we need to set up a state machine to collect the
    // characters to assemble the command.
-   while(Serial.available()) {
-     char cc = (char)Serial.read();
+   while(ShieldPort.available()) {
+     char cc = (char)ShieldPort.read();
      if ( cc & 0x80 ) { // if the high order bit is set then this is a predicate
-       _paramCount = (int)cc & 0x03; // mask count for additional bytes
        _predicate = cc;
+       _known = findCommand( cc );
+       _paramCount = _known ? _entry.params : (int)cc & 0x03; // count for additional bytes
        _param[0] = 0;
        _param[1] = 0;
        _param[2] = 0;
-       break;
+       _extended = _known && (_entry.flags & CMDF::EXTENDED);
+       _extLen = -1;
+       if ( _paramCount==0 ) break;  // complete, nothing to wait for
      } else { // we are a data value
        if ( _paramCount<1 ) return; // sync error ignore extra data byte
+       if ( _extended ) {
+         if ( _extLen<0 ) {     // the count
+           _extLen = cc;
+           _extCount = 0;
+           _param[0] = cc;
+           if ( _extLen > EXTCMD::MAX_LEN ) { // can't hold it, NAK and drop the command
+             badCommand();                     // the data that follows is ignored as stray bytes
+             return;
+             }
+           _paramCount = _extLen + 1;  // data and checksum
+           continue;
+           }
+         _ext[_extCount++] = cc;
+         if ( --_paramCount==0 ) break;
+         continue;
+         }
        --_paramCount; // decrement count
        _param[_paramCount] = cc;
+       if ( _paramCount==0 ) { // complete
+         if ( _predicate!=CMDS::TAG ) break;
+         _tag = _param[0];      // remember the tag and go get the real command
+         _paramCount = -1;
+         }
        } // ifelse
     } // while
 }
@@ -92,10 +201,25 @@ ShieldCommunication::collectCommand() {
 /**
  * combine the command into a single unsigned long
  * data parameters are 7 bits so this is a useful tool
+ * (widen before shifting, an int is only 16 bits on the AVR)
  **/
 unsigned long
 ShieldCommunication::getParameter() {
-  return (_param[2]<<14) + (_param[1]<<7) + _param[0];
+  return ((unsigned long)_param[2]<<14) + ((unsigned long)_param[1]<<7) + _param[0];
+}
+
+/**
+ * The data of a variable length command. Returns the number of bytes or
+ * -1 if the checksum doesn't match.
+ **/
+int
+ShieldCommunication::getExtended( const uint8_t** data ) {
+  if ( !_extended || _extLen<0 ) return -1;
+  uint8_t sum = 0;
+  for( int i=0; i<_extLen; i++ ) sum += _ext[i];
+  if ( (sum & 0x7F) != _ext[_extLen] ) return -1;
+  *data = _ext;
+  return _extLen;
 }
 
 /**
@@ -112,8 +236,8 @@ ShieldCommunication::getParameter(int i) {
  **/
 void
 ShieldCommunication::commandSuccessful() {
-   Serial << "!"; //(char)0x06; //ASCII ACK
-//   Serial.write((char)0x06);
+   if ( _tag<0 ) ShieldPort << "!";
+   else          sendTagged( RECORDS::ACK );
    _paramCount=-1; // Ready to compile a new command.
 }
 
@@ -122,22 +246,33 @@ ShieldCommunication::commandSuccessful() {
  **/
 void
 ShieldCommunication::badCommand() {
-    Serial << "?"; // (char)0x15; //ASCII NAK
+    if ( _tag<0 ) ShieldPort << "?";
+    else          sendTagged( RECORDS::NAK );
     _paramCount=-1; // Ready to compile a new command.
 }
 
+/**
+ * ACK/NAK record for a tagged command, the tag is used up.
+ **/
+void
+ShieldCommunication::sendTagged( char marker ) {
+    uint8_t record[2] = { (uint8_t)marker, (uint8_t)_tag };
+    ShieldPort.write( record, 2 );
+    _tag = -1;
+}
+
 /**
  * Format and send current state
  **/
 void
 ShieldCommunication::sendStatus(char state) {
-   Serial << "Status: " << state;
-   Serial << " -cmd: " << _predicate << " (0x" << _HEX(_predicate) << ")";
+   ShieldPort << "Status: " << state;
+   ShieldPort << " -cmd: " << _predicate << " (0x" << _HEX(_predicate) << ")";
    switch ( _predicate&0x03 ) {
-      case 2:  Serial << " p2: " << _DEC(_param[1]) << ", 0x" << _HEX(_param[1]) << ", 0b" << _BIN(_param[1]);
-      case 1:  Serial << " p1: " << _DEC(_param[0]) << ", 0x" << _HEX(_param[0]) << ", 0b" << _BIN(_param[0]);
+      case 2:  ShieldPort << " p2: " << _DEC(_param[1]) << ", 0x" << _HEX(_param[1]) << ", 0b" << _BIN(_param[1]);
+      case 1:  ShieldPort << " p1: " << _DEC(_param[0]) << ", 0x" << _HEX(_param[0]) << ", 0b" << _BIN(_param[0]);
    }
-   Serial << endl;
+   ShieldPort << endl;
 }
 
 /**
@@ -145,8 +280,8 @@ ShieldCommunication::sendStatus(char state) {
  **/
 void
 ShieldCommunication::sendStatus(const char* report) {
-   Serial << report; // send a string that is formatted by someone else.
-   Serial << endl;
+   ShieldPort << report; // send a string that is formatted by someone else.
+   ShieldPort << endl;
 }
 
 /**
@@ -162,6 +297,7 @@ ShieldCommunication::sendStatus(const char* report) {
  **/
 void
 ShieldCommunication::sendDataBlob(int index, unsigned long clktime, int raw, int channel) {
+  BENCH_SCOPE( BENCH::SEND_BLOB );
   /**
   // The arduino does funny things with the ordering of these values.
   union dataBlob {
@@ -184,28 +320,345 @@ ShieldCommunication::sendDataBlob(int index, unsigned long clktime, int raw, int
   // The arduino is little endian. elaborate experimments with unions and bit
   // field structures cannot adjust for the funny way the data gets ordered.
   // This is the only sure fire way to avoid the whole gulliver's travels thing
-  char dataBytes[8] = {
-      (char) 0xAA, // flag
-      (char) (( (uint16_t)index) >> 3),  // top 8 bytes of the index
-      (char) (( (0x07 & (uint16_t)index) << 5) + ((uint16_t)raw>>5)),
-      (char) (( (0x1F & (uint16_t)raw) << 3) + (0x7 & channel)),
-      (char) (0xFF & (clktime>>24)),  // the time data is straight forward
-      (char) (0xFF & (clktime>>16)),
-      (char) (0xFF & (clktime>>8)),
-      (char) (0xFF & clktime)
+  uint8_t dataBytes[8] = {
+      (uint8_t) 0xAA, // flag
+      (uint8_t) (( (uint16_t)index) >> 3),  // top 8 bytes of the index
+      (uint8_t) (( (0x07 & (uint16_t)index) << 5) + ((uint16_t)raw>>5)),
+      (uint8_t) (( (0x1F & (uint16_t)raw) << 3) + (0x7 & channel)),
+      (uint8_t) (0xFF & (clktime>>24)),  // the time data is straight forward
+      (uint8_t) (0xFF & (clktime>>16)),
+      (uint8_t) (0xFF & (clktime>>8)),
+      (uint8_t) (0xFF & clktime)
     };
 
-  for( int i=0; i<8; i++) {
-    Serial.write( dataBytes[i] );
-//    Serial << " " << _BIN(db.bytes[i]);
+  // queued as a whole, if the link can't keep up the blob is dropped (and counted
+  // against its port, the host sees the gap in the counts)
+  if ( !ShieldPort.writeFrame( dataBytes, 8 ) ) _dropped[channel & 0x7]++;
+  TRACE_POINT( TRACE::BLOB );
+}
+
+/**
+ * Choose how digital events go out. Returns false for an unknown encoding.
+ **/
+bool
+ShieldCommunication::setEventEncoding( int encoding ) {
+  if ( encoding!=DEVENTENC::BLOB && encoding!=DEVENTENC::COMPACT ) return false;
+  _eventEncoding = encoding;
+  resetEventAnchors();
+  return true;
+}
+
+/**
+ * The next compact event on each port will carry its absolute time. Call this
+ * whenever the clocks are synced or the ports are armed.
+ **/
+void
+ShieldCommunication::resetEventAnchors() {
+  for( int i=0; i<8; i++ ) _sinceAnchor[i] = RECORDS::EVENT_ANCHOR_INTERVAL;
+}
+
+/**
+ * Start counting the dropped frames again
+ **/
+void
+ShieldCommunication::clearDropped() {
+  for( int i=0; i<8; i++ ) _dropped[i] = 0L;
+}
+
+/**
+ * Send a digital transition. With the BLOB encoding this is the same 8 byte
+ * data blob as always (the time field is the delta time). With the COMPACT
+ * encoding the event is a single header byte followed by the time:
+      +---+---+---+---+---+---+---+---+
+  bit | 7 | 6 | 5 | 4 | 3 | 2 | 1 | 0 |
+      | 1 | 1 | 0 | A | P |    src    |   A: anchor, P: 1 for LOW2HIGH
+      +---+---+---+---+---+---+---+---+
+ *  A=1: 4 bytes of absolute microseconds since SYNC (big endian, like the blob)
+ *  A=0: microseconds since the last event on this port as a varint, 7 bits per
+ *       byte, least significant group first, high bit set on all but the last.
+ * Typical gate timings fit in 2-3 bytes where the blob always needs 8.
+ **/
+void
+ShieldCommunication::sendDigitalEvent(unsigned long index, unsigned long absTime, unsigned long deltaTime,
+                                      char transition, int channel) {
+  BENCH_SCOPE( BENCH::SEND_EVENT );
+  if ( _eventEncoding==DEVENTENC::BLOB ) {
+    sendDataBlob( index, deltaTime, transition, channel );
+    return;
+  }
+
+  channel &= 0x7;
+  uint8_t header = (uint8_t)RECORDS::EVENT | channel;
+  if ( transition==0x01 ) header |= RECORDS::EVENT_RISE;  // DTRIGCOND::LOW2HIGH
+
+  uint8_t event[6];
+  int len = 1;
+  if ( _sinceAnchor[channel] >= RECORDS::EVENT_ANCHOR_INTERVAL ) { // re-anchor absolute time
+    _sinceAnchor[channel] = 0;
+    header |= RECORDS::EVENT_ANCHOR;
+    event[len++] = (uint8_t)(absTime>>24);
+    event[len++] = (uint8_t)(absTime>>16);
+    event[len++] = (uint8_t)(absTime>>8);
+    event[len++] = (uint8_t)absTime;
+  } else {
+    _sinceAnchor[channel]++;
+    while ( deltaTime > 0x7F ) {     // varint, low groups first
+      event[len++] = (uint8_t)(deltaTime & 0x7F) | 0x80;
+      deltaTime >>= 7;
+    }
+    event[len++] = (uint8_t)deltaTime;
+  }
+  event[0] = header;
+
+  if ( !ShieldPort.writeFrame( event, len ) ) {
+    _dropped[channel]++;
+    _sinceAnchor[channel] = RECORDS::EVENT_ANCHOR_INTERVAL;  // the next delta would be from the lost one
+  }
+  TRACE_POINT( TRACE::EVENT );
+}
+
+/**
+ * Start the UART at one of the link speeds
+ **/
+void
+ShieldCommunication::beginLink( int speed ) {
+  _linkSpeed = speed;
+  _linkPending = false;
+  ShieldPort.begin( LINK_BAUD[speed] );
+}
+
+unsigned long
+ShieldCommunication::getLinkBaud() {
+  return LINK_BAUD[_linkSpeed];
+}
+
+/**
+ * Switch the UART to a new speed. The ACK has to go out first at the old
+ * speed so we wait for it to drain. The change is provisional until the
+ * host talks to us at the new speed (confirmLink), checkLink() undoes it
+ * if that doesn't happen in time or the receiver starts seeing errors.
+ **/
+bool
+ShieldCommunication::changeLinkSpeed( int speed ) {
+  if ( speed<0 || speed>=LINKSPEED::COUNT ) return false;
+  int previous = _linkSpeed;
+  ShieldPort.flush();
+  beginLink( speed );
+  _linkFallback = previous;
+  _linkPending = true;
+  _linkDeadline = millis() + LINKSPEED::CONFIRM_MS;
+  _linkErrors = ShieldPort.getRxErrors();
+  return true;
+}
+
+/**
+ * The host has echoed at the new speed, keep it.
+ **/
+void
+ShieldCommunication::confirmLink() {
+  _linkPending = false;
+}
+
+/**
+ * Return to the old speed if a change wasn't confirmed in time or
+ * the receiver is seeing framing errors.
+ **/
+void
+ShieldCommunication::checkLink() {
+  if ( !_linkPending ) return;
+  if ( (long)(millis() - _linkDeadline) > 0 || ShieldPort.getRxErrors() != _linkErrors ) {
+    ShieldPort.flush();
+    beginLink( _linkFallback );
+    _paramCount = -1;  // whatever we were collecting is garbage
   }
-//  Serial << endl;
 }
 
 /**
  * Send a string (always starts with a space and ends with endl)
  **/
 void
-ShieldCommunication::sendString( String msg ) {
-  Serial << " " << msg << endl;
+ShieldCommunication::sendString( const char* msg ) {
+  ShieldPort << " " << msg << endl;
+}
+
+void
+ShieldCommunication::sendString( const __FlashStringHelper* msg ) {
+  ShieldPort << " " << msg << endl;
+}
+
+/**
+ * Begin a string that is written piece by piece straight into the transmit ring
+ **/
+Print&
+ShieldCommunication::startString() {
+  ShieldPort << " ";
+  return ShieldPort;
+}
+
+void
+ShieldCommunication::endString() {
+  ShieldPort << endl;
+}
+
+/**
+ * Start a binary status record for a source
+ **/
+ShieldStatusRecord::ShieldStatusRecord( int src ) {
+  _record[0] = RECORDS::STATUS;
+  _record[1] = (uint8_t)src;
+  _len = 3;
+}
+
+/**
+ * Add a numeric field of 1, 2 or 4 bytes
+ **/
+void
+ShieldStatusRecord::add( uint8_t tag, unsigned long value, uint8_t size ) {
+  if ( (unsigned int)(_len + 2 + size) > sizeof(_record) ) return;  // full, drop the field
+  _record[_len++] = tag;
+  _record[_len++] = size;
+  while ( size-- ) _record[_len++] = (uint8_t)(value >> (8*size));
+}
+
+/**
+ * Add a string field (no terminator)
+ **/
+void
+ShieldStatusRecord::add( uint8_t tag, const char* str ) {
+  uint8_t size = strlen( str );
+  if ( (unsigned int)(_len + 2 + size) > sizeof(_record) ) return;  // full, drop the field
+  _record[_len++] = tag;
+  _record[_len++] = size;
+  memcpy( _record + _len, str, size );
+  _len += size;
+}
+
+/**
+ * Queue the record (never dropped, status is requested by the host)
+ **/
+void
+ShieldStatusRecord::send() {
+  _record[2] = _len - 3;
+  ShieldPort.write( _record, _len );
+}
+
+/**
+ * Send the readings of several ports taken at the same moment (IMM_SNAP)
+      +------+------+------+------+------+------+-----------+-----------+--------+
+      | 0xAC | mask |  μs since SYNC (4 bytes)  | analog hi | analog lo | digits |
+      +------+------+------+------+------+------+-----------+-----------+--------+
+ *  mask is the port mask from the command (bit SOURCES-1).
+ *  One big endian raw value (2 bytes) follows for each analog port in the
+ *  mask in SOURCES order (ANA105, ANA205, ANA110, ANA210).
+ *  If DIG1, DIG2 or BTN are in the mask a final byte holds their states in
+ *  the same bit positions as the mask.
+ * The length is known from the mask so there is no length byte.
+ **/
+void
+ShieldCommunication::sendSnapshot( char mask, unsigned long time, const int raw[] ) {
+  uint8_t record[15];
+  int len = 0;
+  record[len++] = RECORDS::SNAPSHOT;
+  record[len++] = mask & 0x7F;
+  record[len++] = (uint8_t)(time>>24);
+  record[len++] = (uint8_t)(time>>16);
+  record[len++] = (uint8_t)(time>>8);
+  record[len++] = (uint8_t)time;
+  for ( int src=SOURCES::ANA105; src<=SOURCES::ANA210; src++ ) {
+    if ( mask & bit(src-1) ) {
+      record[len++] = (uint8_t)((uint16_t)raw[src]>>8);
+      record[len++] = (uint8_t)raw[src];
+    }
+  }
+  const char digital = bit(SOURCES::DIG1-1) | bit(SOURCES::DIG2-1) | bit(SOURCES::BTN-1);
+  if ( mask & digital ) {
+    uint8_t states = 0;
+    if ( raw[SOURCES::DIG1] ) states |= bit(SOURCES::DIG1-1);
+    if ( raw[SOURCES::DIG2] ) states |= bit(SOURCES::DIG2-1);
+    if ( raw[SOURCES::BTN] )  states |= bit(SOURCES::BTN-1);
+    record[len++] = states & mask;
+  }
+  ShieldPort.write( record, len );  // requested by the host, never dropped
+}
+
+/**
+ * Answer a clock ping (CLK_PING)
+      +------+------+------+-------------+-------------+-------------+
+      | 0xAD |  id hi/lo    |  rx time    |  tx time    |  queued     |
+      +------+------+------+-------------+-------------+-------------+
+ *  id:     the 14 bit id from the command as two 7 bit bytes
+ *  rx/tx:  μs since SYNC when the command arrived and when this record was
+ *          queued (4 bytes each, big endian like the blobs)
+ *  queued: bytes waiting in the transmit ring ahead of this record (2 bytes),
+ *          the host adds their time on the wire to tx
+ **/
+void
+ShieldCommunication::sendPing( unsigned int id, unsigned long rxTime, unsigned long txTime ) {
+  uint16_t queued = ShieldPort.getTxQueued();
+  uint8_t record[13] = {
+      (uint8_t)RECORDS::PING,
+      (uint8_t)((id >> 7) & 0x7F),
+      (uint8_t)(id & 0x7F),
+      (uint8_t)(rxTime>>24), (uint8_t)(rxTime>>16), (uint8_t)(rxTime>>8), (uint8_t)rxTime,
+      (uint8_t)(txTime>>24), (uint8_t)(txTime>>16), (uint8_t)(txTime>>8), (uint8_t)txTime,
+      (uint8_t)(queued>>8), (uint8_t)queued
+  };
+  ShieldPort.write( record, sizeof(record) );
+}
+
+/**
+ * Time beacon, sent regularly so long runs can be put together unambiguously
+      +------+------+------+------+-------------+-------------+---
+      | 0xAE | mask |  wraps hi/lo |  time       |  count      | ...
+      +------+------+------+------+-------------+-------------+---
+ *  wraps: times the μs since SYNC has wrapped, the high bits of a 48 bit clock
+ *  time:  μs since SYNC when the beacon was queued (4 bytes, big endian)
+ *  mask:  ports (bit SOURCES-1, DIG1 to ANA210) whose 4 byte count follows in
+ *         SOURCES order. A count is the seq# of the port's last blob before it
+ *         was wrapped to 11 bits.
+ * The length is known from the mask. Beacons go out with the data so they
+ * can be dropped like blobs when the link is full.
+ **/
+bool
+ShieldCommunication::sendBeacon( char mask, unsigned int wraps, unsigned long time, const unsigned long counts[] ) {
+  uint8_t record[8+6*4];
+  int len = 0;
+  record[len++] = RECORDS::BEACON;
+  record[len++] = mask & 0x3F;
+  record[len++] = (uint8_t)(wraps>>8);
+  record[len++] = (uint8_t)wraps;
+  record[len++] = (uint8_t)(time>>24);
+  record[len++] = (uint8_t)(time>>16);
+  record[len++] = (uint8_t)(time>>8);
+  record[len++] = (uint8_t)time;
+  for ( int src=SOURCES::DIG1; src<=SOURCES::ANA210; src++ ) {
+    if ( mask & bit(src-1) ) {
+      record[len++] = (uint8_t)(counts[src]>>24);
+      record[len++] = (uint8_t)(counts[src]>>16);
+      record[len++] = (uint8_t)(counts[src]>>8);
+      record[len++] = (uint8_t)counts[src];
+    }
+  }
+  return ShieldPort.writeFrame( record, len );
+}
+
+/**
+ * Report how the transmit side of the link is coping as a JSON string
+ *  txsize: size of the transmit ring, hiwater: most bytes ever queued,
+ *  stall: μs spent waiting for room, dropped/frames: bytes and frames thrown away
+ *  rxerrors: framing errors and overruns, reliable: 1 in reliable streaming,
+ *  resent/expired: batches sent again and given up on, baud: current link speed
+ **/
+void
+ShieldCommunication::sendLinkStatus() {
+  ShieldPort << " {\"txsize\":" << ShieldPort.getTxSize()
+             << ",\"hiwater\":" << ShieldPort.getHighWater()
+             << ",\"stall\":" << ShieldPort.getStallMicros()
+             << ",\"dropped\":" << ShieldPort.getDroppedBytes()
+             << ",\"frames\":" << ShieldPort.getDroppedFrames()
+             << ",\"rxerrors\":" << ShieldPort.getRxErrors()
+             << ",\"reliable\":" << (ShieldPort.isReliable() ? 1 : 0)
+             << ",\"resent\":" << ShieldPort.getResent()
+             << ",\"expired\":" << ShieldPort.getExpired()
+             << ",\"baud\":" << getLinkBaud() << "}" << endl;
 }
@@ -1,8 +1,8 @@
 /****************************************************************
 *  ShieldCommunication
-*  This encapsulates the serial communication from the host machine. The Serial
-*  port is managed outside this object through the establishment of a baud rate
-*  and .begin notification.  After that this object is meant to do all the work.
+*  This encapsulates the serial communication from the host machine. The UART
+*  (ShieldPort) is started outside this object through the establishment of a baud
+*  rate and .begin notification.  After that this object is meant to do all the work.
 *
 *  The commands structure and reasoning is outlined in a separate document.
 *
@@ -17,13 +17,42 @@
 
 // separate header with all the command codes
 #include <ShieldCommunicationCmds.h>
+// the UART and its transmit ring
+#include <ShieldSerial.h>
+
+// A command handler. Unless the command's flags say otherwise the return
+// value decides whether an ACK (true) or NAK (false) is sent afterwards.
+typedef bool (*CommandHandler)();
+
+// Flags for the command table
+namespace CMDF {
+  const uint8_t ACK_FIRST = 0x01;  // ACK before the handler runs (it sends data back)
+  const uint8_t SELF_ACK  = 0x02;  // the handler sends its own ACK/NAK
+  const uint8_t EXTENDED  = 0x04;  // variable length: count, data bytes and checksum
+  const uint8_t NO_ACK    = 0x08;  // no ACK/NAK at all, the record the handler sends is the answer
+};
+
+// One entry in the command table. The table lives in PROGMEM.
+struct CommandEntry {
+   char           predicate;
+   uint8_t        params;    // parameter bytes (the count byte for EXTENDED commands)
+   uint8_t        flags;     // CMDF
+   CommandHandler handler;
+};
 
 class ShieldCommunication {
 
 public:
    ShieldCommunication();
 
-   // called in the serialEvent function to collect characters into
+   // register the command table (in PROGMEM)
+   void setCommands( const CommandEntry* table, uint8_t count );
+   // call regularly from loop(). Collects waiting characters and runs the
+   // handler of a completed command. Cheap when nothing is waiting.
+   // Returns true if a command was handled.
+   bool processCommands();
+
+   // called by processCommands to collect characters into
    //   a 'command'. It parses the characters and isolates the predicate
    //   from the parameters (if any)
    void collectCommand();
@@ -37,26 +66,105 @@ public:
    void commandSuccessful();
    // return a message that the command was not understood
    void badCommand();
+   // both of the above send a tagged record if the command was preceded by TAG
    // sent detailed information on the current command
    void sendStatus( char state); // communications status
    void sendStatus( const char* report ); // string from other object
 
    // senders
    void sendDataBlob( int index, unsigned long time, int rawValue, int channel );
-   void sendString( String msg );
+   void sendDigitalEvent( unsigned long index, unsigned long absTime, unsigned long deltaTime,
+                          char transition, int channel );
+   void sendSnapshot( char mask, unsigned long time, const int raw[] );  // raw indexed by SOURCES
+   void sendPing( unsigned int id, unsigned long rxTime, unsigned long txTime );
+   // counts indexed by SOURCES, false if the link had no room (try again later)
+   bool sendBeacon( char mask, unsigned int wraps, unsigned long time, const unsigned long counts[] );
+   void sendString( const char* msg );
+   void sendString( const __FlashStringHelper* msg );
+   // for strings composed on the fly: startString() sends the leading space and
+   // returns the port to write the rest to, endString() terminates it.
+   Print& startString();
+   void   endString();
+   void sendLinkStatus();  // transmit ring size, high water, stall time and drops
 
    // basic getters
    char            getCommand() { return (int)_predicate; }
    unsigned long   getParameter();
    char            getParameter(int i);
+   // data of a variable length command, -1 if the checksum failed
+   int             getExtended( const uint8_t** data );
+
+   // digital event encoding (DEVENTENC::BLOB or DEVENTENC::COMPACT)
+   bool            setEventEncoding( int encoding );
+   int             getEventEncoding() { return _eventEncoding; }
+   // force the next compact event on every port to carry absolute time
+   void            resetEventAnchors();
+
+   // blobs and events thrown away because the link couldn't keep up, by SOURCES
+   unsigned long   getDropped( int src ) { return _dropped[src & 0x07]; }
+   void            clearDropped();  // at SYNC, like the counts
+
+   // link speed negotiation (LINKSPEED index)
+   void            beginLink( int speed=LINKSPEED::DEFAULT );
+   bool            changeLinkSpeed( int speed );  // call after the ACK, falls back unless confirmed
+   void            confirmLink();                 // the host answered at the new speed
+   void            checkLink();                   // call regularly, does the fall back
+   unsigned long   getLinkBaud();
 
 private:
+   void sendTagged( char marker );
+   bool findCommand( char predicate );
+
+   const CommandEntry* _commands;  // PROGMEM
+   uint8_t             _commandCount;
+   CommandEntry        _entry;     // table entry of the command being collected
+   bool                _known;     // _entry is valid
+
    char _predicate;
    char _param[3];
 
    int _paramCount;  // COMPLETE BUILDING or READY
                         // -1       >0         ==0
    char _cmdCount;
+   int  _tag;        // sequence tag for the current command, -1 if untagged
+
+   // variable length commands
+   bool    _extended;              // collecting a variable length command
+   int     _extLen;                // data bytes expected, -1 until the length is known
+   int     _extCount;              // data bytes collected
+   uint8_t _ext[EXTCMD::MAX_LEN+1];  // data and checksum
+
+   int  _eventEncoding;
+
+   int           _linkSpeed;      // current LINKSPEED
+   int           _linkFallback;   // speed to return to if the change isn't confirmed
+   unsigned long _linkDeadline;   // millis() by which the change must be confirmed
+   bool          _linkPending;
+   unsigned int  _linkErrors;     // ShieldPort error count when the change started
+   char _sinceAnchor[8];  // compact events sent since the last anchor, by source
+   unsigned long _dropped[8];  // frames the link had no room for, by source
+};
+
+/**
+ * Binary status record. Built on the stack then queued on ShieldPort as
+      +------+-----+-----+-----+-----+-------+-----+-----+-------+---
+      | 0xAB | src | len | tag | len | value | tag | len | value | ...
+      +------+-----+-----+-----+-----+-------+-----+-----+-------+---
+ * len is the number of bytes that follow it. Values are big endian.
+ * Tags are listed in STATUSTAG.
+ **/
+class ShieldStatusRecord {
+
+public:
+   ShieldStatusRecord( int src );
+
+   void add( uint8_t tag, unsigned long value, uint8_t size );
+   void add( uint8_t tag, const char* str );
+   void send();
+
+private:
+   uint8_t _record[64];   // an analog port with 4 character units and name needs 55
+   uint8_t _len;
 };
 
 #endif
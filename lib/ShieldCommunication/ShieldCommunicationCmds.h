@@ -6,6 +6,10 @@
  *   data bits to follow the intial command. We are thus limited in the number of
  *   available command bytes.
  **/
+#ifndef ShieldCommunicationCmds_h
+#define ShieldCommunicationCmds_h
+
+#include <stdint.h>
 
 namespace CMDS {
 
@@ -30,6 +34,12 @@ namespace CMDS {
   const char BLINKLED=0xA8 | 0x01;   // 0b10101000  168   ⇨ blink led n times with period k
   // param 1: high nibble is # blinks 1-7, low nibble<<6 is period
 
+  const char TAG     =0x88 | 0x01;   // 0b10001000  137   ⇨ tag the next command
+  // param: 7 bit sequence tag. The command that follows is acknowledged with a tagged
+  // ACK/NAK record (0x06 tag / 0x15 tag) instead of a bare '!' or '?'. This lets the host
+  // send a batch of commands back to back and match the answers up as they come in,
+  // even when they are mixed in with data.
+
   // These are immediate commands that solicit responses almost right away
   const char IMM_DIG1 =0x8C;          // 0b10001100  140   ⇨ read dig port 1
   const char IMM_DIG2 =0x90;          // 0b10010000  144   ⇨ read dig port 2
@@ -39,6 +49,9 @@ namespace CMDS {
   const char IMM_AN102=0xA0;          // 0b10100000  160   ⇨ read analog ±10V port 2
   const char IMM_BUTSTATE=0xA4;       // 0b10100100  164   ⇨ get button press
   // all of the above commands will return a single datablob with seq# = 0
+  const char IMM_SNAP    =0xDC | 0x01;  // 0b11011100  221   ⇨ read several ports at once
+  // parameter is the same port mask as ST_PORTS. Every requested port is read in one go and
+  // returned as a single snapshot record (see RECORDS::SNAPSHOT) with one common timestamp.
 
   // These are setup commands that set the conditions of the shield
   const char MDE_SYNC     =0xD0;     // 0b11010000  208   ⇨ sync the clocks
@@ -76,27 +89,82 @@ namespace CMDS {
   // on one port. With this configuration there is no way to distinguish which gate
   // triggered the event.
 
+  const char MDE_DEVENT =0xD4 | 0x01;  // 0b11010100  212   ⇨ set the digital event encoding
+  // param: 0 digital events are sent as full 8 byte data blobs [default]
+  //        1 digital events are sent as compact varint encoded event records
+  // Compact events carry the edge polarity and source in a single header byte followed
+  // by the time since the previous event on that port as a varint. Every so often (and
+  // always after a SYNC or ARM) the event is sent with its absolute time instead so the
+  // host can re-anchor its running clock.
+
+  const char MDE_LINK   =0xD8 | 0x01;  // 0b11011000  216   ⇨ change the link speed
+  // param: LINKSPEED index 0: 460800 [default], 1: 1M baud, 2: 2M baud
+  // The ACK is sent at the old rate, then the UART switches. The host must switch too
+  // and send LINK_ECHO within LINK_CONFIRM_MS. If it doesn't, or the UART sees framing
+  // errors first, the shield falls back to the rate it had before.
+  const char LINK_ECHO  =0xD8 | 0x02;  // 0b11011000  218   ⇨ echo the parameters back
+  // returns a string {"echo":[p1,p2],"baud":rate} and confirms a pending link speed change
+
+  const char MDE_CONFIG =0xE0 | 0x01;  // 0b11100000  225   ⇨ configure the whole experiment
+  // Variable length. The single parameter is the count N of bytes that follow, then the
+  // N 7bit bytes and a 7bit checksum (sum of the N bytes & 0x7F):
+  //    0xE1 N b0 b1 ... bN-1 chk
+  //    b0:   flags bit 0: sync clocks, bit 1: compact digital events, bit 2: arm when done
+  //    b1:   arm mask (same bits as ARM)
+  //    then one block per port to set up, in any order:
+  //      analog  (ANA105..ANA210): src, rate, stop hi, stop lo, trig hi, trig lo   (6 bytes)
+  //              rate as MDE_ASAMPTIME, stop as MDE_ASTOP, trig as MDE_ATRIG (channel bits ignored)
+  //      digital (DIG1, DIG2):     src, edge (DTRIGCOND)                             (2 bytes)
+  // Everything is checked before anything is applied. If it is all good the ports are
+  // halted, configured, optionally synced and armed together and then an ACK is sent.
+  // Otherwise a NACK is sent and nothing changes. An N over EXTCMD::MAX_LEN is NACKed as
+  // soon as it arrives and the bytes after it are ignored.
+
   // Status requests. Can be used to see if the Shield has been set up correctly or
   // just interrogate the firmware.
   const char ST_PORTS  =0xC8 | 0x01;   // 0b11001000  200   ⇨ Status of Ports
   // parameter is simply the 1 indexed bit position of SOURCES port index
   const char ST_VERS   =0xC8;          // 0b11001000  200   ⇨ version info
+  const char ST_PORTSB =0xC4 | 0x01;   // 0b11000100  196   ⇨ binary status of ports
+  // parameter is the same port mask as ST_PORTS. One binary status record is returned
+  // per port (see STATUSTAG), much cheaper than the JSON when polling during a capture.
+  const char ST_LINK   =0xCC;          // 0b11001100  204   ⇨ transmit link status
+  // returns a string with the transmit ring size, its high water mark, the time spent
+  // waiting for room (μs) and the bytes and frames dropped because the link couldn't keep up.
+
+  // Clock correlation
+  const char CLK_PING   =0xE4 | 0x02;  // 0b11100100  230   ⇨ timing handshake
+  // parameters are a 14 bit id chosen by the host (high 7 bits first). There is no ACK,
+  // the answer is a ping record (see RECORDS::PING) with the same id, the time the command
+  // arrived and the time the answer was queued, both in μs since SYNC like the blobs.
+  // The host notes when it sent the ping and when the answer came back which gives
+  // four times per ping, as in NTP, to map the shield's clock onto its own.
+
+  // Instrumentation
+  const char ST_STATS   =0xE8 | 0x01;  // 0b11101000  233   ⇨ loop and latency histograms
+  // param: 1 to empty the histograms once they are sent, 0 to leave them.
+  // Returns one stats record (see RECORDS::STATS) per histogram: the loop period, the
+  // transmit stalls, the command latency and each port's poll cost, then the free RAM.
+  // The histograms are only kept in a build with SHIELD_STATS (env:uno_stats), any other
+  // build answers with the free RAM alone.
+  const char ST_TRACE   =0xEC | 0x01;  // 0b11101100  237   ⇨ dump the trace ring
+  // param: 1 to empty the ring once it is sent. Returns one trace record (see RECORDS::TRACE
+  // and ShieldTrace) holding the ring oldest first, empty unless built with SHIELD_TRACE.
+
+  // Reliable streaming
+  const char MDE_RELIABLE =0xF0 | 0x01;  // 0b11110000  241   ⇨ number the data and keep it until acknowledged
+  // param: 1 on, 0 off [default]. While it is on the data blobs, events and beacons are
+  // gathered into batch records (see RECORDS::BATCH) numbered from 0 (14 bits, wrapping).
+  // A batch stays in the transmit ring until the host acknowledges it with RTX_ACK and is
+  // sent again when the host asks for it with RTX_NAK, or when nothing has been acknowledged
+  // for SHIELD_RETX_TIMEOUT_MS. Everything else (ACKs, strings, status) is sent as usual.
+  const char RTX_ACK      =0xF4 | 0x02;  // 0b11110100  246   ⇨ acknowledge batches
+  // params: 14 bit number of the first batch the host doesn't have, high 7 bits first.
+  // Every batch before it can be forgotten. No ACK.
+  const char RTX_NAK      =0xF8 | 0x03;  // 0b11111000  251   ⇨ ask for batches again
+  // params: 14 bit number of the first batch missing (high 7 bits first), then how many. No ACK.
 
   /*** following is for future expansion
-     const char STASTOP=0xC4;      // 0b11000100  196   ⇨ stop status
-     const char STASTATE=0xCC;     // 0b11001100  204   ⇨ state
-     const char NOP=0x88;          // 0b10001000  136   ⇨ not used currently
-     const char xxx=0xC4;          // 0b11000100  196
-     const char xxx=0xD4;          // 0b11010100  212
-     const char xxx=0xD8;          // 0b11011000  216
-     const char xxx=0xDC;          // 0b11011100  220
-     const char xxx=0xE0;          // 0b11100000  224
-     const char xxx=0xE4;          // 0b11100100  228
-     const char xxx=0xE8;          // 0b11101000  232
-     const char xxx=0xEC;          // 0b11101100  236
-     const char xxx=0xF0;          // 0b11110000  240
-     const char xxx=0xF4;          // 0b11110100  244
-     const char xxx=0xF8;          // 0b11111000  248
      const char xxx=0xFC;          // 0b11111100  252
    ***/
 };
@@ -111,3 +179,109 @@ namespace SOURCES {
   const int DIG2 = 0x2;
   const int BTN = 0x7;
 };
+
+// Digital event encodings (see MDE_DEVENT)
+namespace DEVENTENC {
+  const int BLOB    = 0x0;
+  const int COMPACT = 0x1;
+};
+
+// Variable length commands (see MDE_CONFIG)
+namespace EXTCMD {
+  const int MAX_LEN   = 32;   // most data bytes a variable length command may carry
+  const int F_SYNC    = 0x01; // MDE_CONFIG flags
+  const int F_COMPACT = 0x02;
+  const int F_ARM     = 0x04;
+};
+
+// Link speeds (see MDE_LINK)
+namespace LINKSPEED {
+  const int DEFAULT = 0;   // 460800 (really 500k with U2X on a 16MHz uno)
+  const int M1      = 1;   // 1M baud
+  const int M2      = 2;   // 2M baud
+  const int COUNT   = 3;
+  const unsigned long CONFIRM_MS = 1000;  // time the host has to confirm a new speed
+};
+
+// Markers that open the records sent back to the host.
+namespace RECORDS {
+  const char BLOB   = 0xAA;   // 8 byte data blob
+  const char STRING = 0x20;   // space, string terminated by CR LF
+  const char STATUS = 0xAB;   // binary status record (see ShieldStatusRecord)
+  const char SNAPSHOT = 0xAC; // readings of several ports at one moment (see IMM_SNAP)
+  const char PING   = 0xAD;   // answer to CLK_PING (see ShieldCommunication::sendPing)
+  const char BEACON = 0xAE;   // clock wraps and full sample counts (see ShieldCommunication::sendBeacon)
+  const char STATS  = 0xAF;   // instrumentation: 0xAF id len payload (see ShieldStats::send)
+  const char TRACE  = 0xA8;   // trace ring dump (see ST_TRACE and ShieldTrace::send)
+  const char BATCH  = 0xA9;   // frames in reliable streaming: 0xA9 seq(2) len frames crc(2) (see MDE_RELIABLE)
+  const char ACK    = 0x06;   // ASCII ACK followed by the tag of the command (see TAG)
+  const char NAK    = 0x15;   // ASCII NAK followed by the tag of the command
+  const char EVENT  = 0xC0;   // 0b110APSSS compact digital event, top 3 bits only
+  // compact event header bits
+  const char EVENT_MASK   = 0xE0;  // mask for the event marker bits
+  const char EVENT_ANCHOR = 0x10;  // A: payload is 4 byte absolute time, else varint delta
+  const char EVENT_RISE   = 0x08;  // P: set for LOW2HIGH, clear for HIGH2LOW
+  // number of compact events on a port between absolute time anchors
+  const int  EVENT_ANCHOR_INTERVAL = 32;
+};
+
+// Time beacons. The blob's 32 bit μs field wraps after ~71.6 minutes and its
+// 11 bit seq# every 2048 samples, the beacons carry what the host needs to
+// put the missing high bits back.
+namespace BEACON {
+  const unsigned long ARMED_MS = 1000;   // beacon period while any port is armed
+  const unsigned long IDLE_MS  = 60000;  // and while nothing is
+};
+
+// Instrumentation histograms (see ST_STATS and ShieldStats). The id opens the
+// stats record: a histogram carries its max (μs, 4 bytes) and BUCKETS counts
+// (2 bytes each), bucket 0 < 4μs, bucket b 2^(b+1)..2^(b+2)-1μs, the last 4096μs
+// and up. The RAM record carries the free RAM now and its low water mark.
+namespace STATS {
+  const uint8_t RAM     = 0x00;  // bytes free between heap and stack, now and least ever
+  const uint8_t LOOP    = 0x01;  // period of loop()
+  const uint8_t STALL   = 0x02;  // each wait for room in the transmit ring
+  const uint8_t COMMAND = 0x03;  // last command byte received to the handler done
+  const uint8_t POLL    = 0x10;  // | SOURCES: pollPort() of that port
+  const uint8_t BUCKETS = 12;
+};
+
+// Trace points (see ST_TRACE and ShieldTrace). A trace record is 0xA8, n, points
+// traced since the ring was emptied (2 bytes, wraps), micros() and the trace clock
+// at the dump (4 and 3 bytes), then n points oldest first: id and the trace clock
+// (3 bytes) when it was passed. The trace clock counts 0.5μs ticks and wraps every
+// 8.39s, a point's time is micros() at the dump less the ticks since it.
+namespace TRACE {
+  const uint8_t LOOP       = 0x01;  // top of loop()
+  const uint8_t COMMAND    = 0x02;  // a command handled
+  const uint8_t BLOB       = 0x03;  // a data blob queued
+  const uint8_t EVENT      = 0x04;  // a digital event queued
+  const uint8_t A_POLL     = 0x10;  // VernierAnalogSensor::pollPort, past the halt check
+  const uint8_t A_ARMED    = 0x11;  //   trigger checked, still waiting
+  const uint8_t A_RUN      = 0x12;  //   running
+  const uint8_t A_STOP     = 0x13;  //   stop condition checked
+  const uint8_t A_READ     = 0x14;  //   sample taken
+  const uint8_t A_IDLE     = 0x15;  //   not time for a sample yet
+  const uint8_t D_POLL     = 0x20;  // VernierDigitalSensor::pollPort, past the halt check
+  const uint8_t D_READ     = 0x21;  //   gate read and timed
+  const uint8_t D_FIRED    = 0x22;  //   trigger condition met
+  const int     HEADER     = 11;    // bytes ahead of the points
+};
+
+// Fields in a binary status record. Numeric values are the raw firmware values.
+namespace STATUSTAG {
+  const uint8_t STATE     = 0x01;  // analog: STATE::TS_*, digital: 0 halted, 1 armed
+  const uint8_t PERIOD    = 0x02;  // sample period μs (4 bytes)
+  const uint8_t TRIGGER   = 0x03;  // analog: ATRIGCOND, digital: DTRIGCOND
+  const uint8_t LEVEL     = 0x04;  // analog trigger level (2 bytes)
+  const uint8_t STOP      = 0x05;  // stop count (4 bytes)
+  const uint8_t COUNT     = 0x06;  // samples/transitions since sync (4 bytes)
+  const uint8_t UNITS     = 0x07;  // string
+  const uint8_t NAME      = 0x08;  // string
+  const uint8_t SHORTNAME = 0x09;  // string
+  const uint8_t BUTTON    = 0x0A;  // 1 if the button is down
+  const uint8_t DROPPED   = 0x0B;  // blobs/events the link had no room for since sync (4 bytes)
+  const uint8_t MISSED    = 0x0C;  // analog: sample periods that went by unread since sync (4 bytes)
+};
+
+#endif
@@ -0,0 +1,621 @@
+/****************************************************************
+*  ShieldSerial
+*  Interrupt driven UART with a large transmit ring and overload
+*  accounting. See ShieldSerial.h for the reasoning.
+*
+*  The register handling follows HardwareSerial so the baud rates
+*  (and their errors) are exactly what Serial.begin() would give us.
+****************************************************************/
+
+#include <ShieldSerial.h>
+#include <ShieldStats.h>
+#include <ShieldCommunicationCmds.h>
+
+#if defined(__AVR__)
+#include <util/atomic.h>
+#include <util/crc16.h>
+#define SHIELD_UART_ISR
+#define SHIELD_ATOMIC ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+#else
+#define SHIELD_ATOMIC
+#endif
+
+#if (SHIELD_RETX_BATCHES & (SHIELD_RETX_BATCHES - 1)) || SHIELD_RETX_BATCHES > 16
+#error SHIELD_RETX_BATCHES must be a power of 2 no bigger than 16
+#endif
+
+// a batch is: RECORDS::BATCH, seq (2 bytes, 14 bits), payload length, the
+// frames, then a CRC-CCITT (2 bytes) of everything before it
+#define BATCH_HEADER  4
+#define BATCH_TRAILER 2
+#define SEQ_MASK      0x3FFF
+#define SLOT(seq)     ((seq) & (SHIELD_RETX_BATCHES - 1))
+
+ShieldSerial ShieldPort;
+
+// bytes from one place in the transmit ring to another
+static inline uint16_t ringDist( uint16_t from, uint16_t to ) {
+   return to >= from ? to - from : SHIELD_TX_BUFFER_SIZE - from + to;
+}
+
+static inline uint16_t ringNext( uint16_t i ) {
+   return ++i == SHIELD_TX_BUFFER_SIZE ? 0 : i;
+}
+
+// CRC-CCITT (0x8408 reflected) one byte at a time, as avr-libc's _crc_ccitt_update
+static inline uint16_t crcUpdate( uint16_t crc, uint8_t data ) {
+#if defined(__AVR__)
+   return _crc_ccitt_update( crc, data );
+#else
+   data ^= crc & 0xFF;
+   data ^= data << 4;
+   return ((((uint16_t)data << 8) | (crc >> 8)) ^ (uint8_t)(data >> 4) ^ ((uint16_t)data << 3));
+#endif
+}
+
+/**
+ * Initialize the rings and counters
+ **/
+ShieldSerial::ShieldSerial() {
+   _txHead = _txTail = 0;
+   _rxHead = _rxTail = 0;
+   _rxMicros = 0L;
+   _written = false;
+   _reliable = false;
+   _batchOpen = false;
+   _nextSeq = _ackSeq = 0;
+   _resend = 0;
+   clearCounters();
+}
+
+/**
+ * Set the baud rate and enable the receiver and transmitter.
+ **/
+void
+ShieldSerial::begin( unsigned long baud ) {
+#ifdef SHIELD_UART_ISR
+   // Try double speed mode first, same as HardwareSerial
+   uint16_t setting = (F_CPU / 4 / baud - 1) / 2;
+   UCSR0A = _BV(U2X0);
+   // hardcoded exception for 57600 for compatibility with the bootloader
+   if ( ((F_CPU == 16000000UL) && (baud == 57600)) || (setting > 4095) ) {
+      UCSR0A = 0;
+      setting = (F_CPU / 8 / baud - 1) / 2;
+   }
+   UBRR0H = setting >> 8;
+   UBRR0L = setting;
+   UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);             // 8N1
+   UCSR0B = _BV(RXEN0) | _BV(TXEN0) | _BV(RXCIE0);  // UDRIE0 is set when there is something to send
+#else
+   Serial.begin( baud );
+#endif
+}
+
+/**
+ * Wait for the transmitter to finish and turn the UART off
+ **/
+void
+ShieldSerial::end() {
+   flush();
+#ifdef SHIELD_UART_ISR
+   UCSR0B &= ~(_BV(RXEN0) | _BV(TXEN0) | _BV(RXCIE0) | _BV(UDRIE0));
+#endif
+   _rxHead = _rxTail;
+}
+
+/**
+ * Number of received characters waiting
+ **/
+int
+ShieldSerial::available() {
+#ifndef SHIELD_UART_ISR
+   poll();
+#endif
+   return ((unsigned int)(SHIELD_RX_BUFFER_SIZE + _rxHead - _rxTail)) % SHIELD_RX_BUFFER_SIZE;
+}
+
+/**
+ * Look at the next received character without taking it
+ **/
+int
+ShieldSerial::peek() {
+   if ( !available() ) return -1;
+   return _rxBuf[_rxTail];
+}
+
+/**
+ * Take the next received character
+ **/
+int
+ShieldSerial::read() {
+   if ( !available() ) return -1;
+   uint8_t c = _rxBuf[_rxTail];
+   _rxTail = (uint8_t)(_rxTail + 1) % SHIELD_RX_BUFFER_SIZE;
+   return c;
+}
+
+/**
+ * Room left in the transmit ring
+ **/
+int
+ShieldSerial::availableForWrite() {
+   return SHIELD_TX_BUFFER_SIZE - 1 - txUsed();
+}
+
+/**
+ * Block until everything queued has been shifted out of the UART
+ **/
+void
+ShieldSerial::flush() {
+   closeBatch();
+   if ( !_written ) return;  // TXC0 is never set if nothing was ever sent
+#ifdef SHIELD_UART_ISR
+   while ( bit_is_set(UCSR0B, UDRIE0) || bit_is_clear(UCSR0A, TXC0) ) poll();
+#else
+   while ( _txTail != _txHead ) poll();
+#endif
+}
+
+/**
+ * A single byte (Print and Streaming go through here). Never dropped.
+ **/
+size_t
+ShieldSerial::write( uint8_t c ) {
+   enqueue( &c, 1, false );
+   return 1;
+}
+
+/**
+ * A run of bytes that must go out. Blocks (and counts the stall) if the
+ * ring is too full, longer runs are sent in ring sized pieces.
+ **/
+size_t
+ShieldSerial::write( const uint8_t* buffer, size_t size ) {
+   const uint16_t room = SHIELD_TX_BUFFER_SIZE - 1;
+   size_t left = size;
+   while ( left ) {
+      uint16_t chunk = left > room ? room : left;
+      enqueue( buffer, chunk, false );
+      buffer += chunk;
+      left -= chunk;
+   }
+   return size;
+}
+
+/**
+ * A frame (data blob, event, ...) is queued whole or dropped whole.
+ **/
+bool
+ShieldSerial::writeFrame( const uint8_t* frame, uint8_t len ) {
+   if ( _reliable ) return batchFrame( frame, len );
+   return enqueue( frame, len, true );
+}
+
+/**
+ * Copy bytes into the transmit ring. If there isn't room we wait for the
+ * interrupt to make some. A droppable frame gives up after
+ * SHIELD_TX_STALL_LIMIT_US so the acquisition loop keeps running.
+ **/
+bool
+ShieldSerial::enqueue( const uint8_t* buffer, uint16_t size, bool mayDrop ) {
+   const uint16_t room = SHIELD_TX_BUFFER_SIZE - 1;
+   if ( size > room ) {  // can never fit
+      dropFrame( size );
+      return false;
+   }
+   closeBatch();  // anything outside a batch goes after it
+   if ( !waitForRoom( size, room, mayDrop ) ) {
+      dropFrame( size );
+      return false;
+   }
+
+   uint16_t head = _txHead;
+   while ( size-- ) {
+      _txBuf[head] = *buffer++;
+      head = ringNext( head );
+   }
+   publish( head );
+   return true;
+}
+
+/**
+ * Wait until size more bytes leave no more than limit in use. Batches
+ * kept for the host only go away when it acknowledges them, which can't
+ * happen while we wait here, so something that mustn't be dropped takes
+ * their room: they are given up on, oldest first.
+ **/
+bool
+ShieldSerial::waitForRoom( uint16_t size, uint16_t limit, bool mayDrop ) {
+   unsigned long waitStart = 0;
+   bool waiting = false;
+   while ( txUsed() + size > limit ) {
+      if ( !mayDrop && batchesOut() ) {
+         uint16_t tail;
+         SHIELD_ATOMIC {
+            tail = _txTail;
+         }
+         if ( ringDist( _keep, _txHead ) > ringDist( tail, _txHead ) ) {
+            expireOldest();
+            continue;
+         }
+      }
+      if ( !waiting ) {
+         waiting = true;
+         waitStart = micros();
+      } else if ( mayDrop && (micros() - waitStart) > SHIELD_TX_STALL_LIMIT_US ) {
+         unsigned long stalled = micros() - waitStart;
+         _stallMicros += stalled;
+         Stats.stall( stalled );
+         return false;
+      }
+      poll();  // does the interrupt's job if interrupts are off
+   }
+   if ( waiting ) {
+      unsigned long stalled = micros() - waitStart;
+      _stallMicros += stalled;
+      Stats.stall( stalled );
+   }
+   return true;
+}
+
+void
+ShieldSerial::dropFrame( uint16_t size ) {
+   _droppedBytes += size;
+   _droppedFrames++;
+}
+
+/**
+ * Hand the bytes up to head over to the interrupt
+ **/
+void
+ShieldSerial::publish( uint16_t head ) {
+   SHIELD_ATOMIC {
+      _txHead = head;
+   }
+   _written = true;
+
+   uint16_t used = txUsed();
+   if ( used > _highWater ) _highWater = used;
+
+   kickTx();
+}
+
+/**
+ * Bytes of the transmit ring in use: waiting to be sent, or kept for
+ * the host, whichever reaches further back. An open batch comes on top.
+ **/
+uint16_t
+ShieldSerial::txUsed() {
+   uint16_t tail;
+   SHIELD_ATOMIC {
+      tail = _txTail;
+   }
+   uint16_t head = _txHead;
+   uint16_t used = ringDist( tail, head );
+   if ( batchesOut() ) {
+      uint16_t kept = ringDist( _keep, head );
+      if ( kept > used ) used = kept;
+   }
+   if ( _batchOpen ) used += ringDist( head, _batchHead );
+   return used;
+}
+
+/**
+ * Bytes that will go out ahead of anything queued now: not sent yet,
+ * and the open batch
+ **/
+unsigned int
+ShieldSerial::getTxQueued() {
+   uint16_t tail;
+   SHIELD_ATOMIC {
+      tail = _txTail;
+   }
+   return ringDist( tail, _txHead ) + (_batchOpen ? ringDist( _txHead, _batchHead ) : 0);
+}
+
+/**
+ * Make sure the data register empty interrupt is going to drain the ring
+ **/
+void
+ShieldSerial::kickTx() {
+#ifdef SHIELD_UART_ISR
+   SHIELD_ATOMIC {
+      UCSR0B |= _BV(UDRIE0);
+   }
+#else
+   poll();
+#endif
+}
+
+/**
+ * Turn reliable streaming on or off. Whatever was kept for the host is
+ * forgotten and the batches start again from 0.
+ **/
+void
+ShieldSerial::setReliable( bool on ) {
+   closeBatch();
+   _reliable = on;
+   _nextSeq = _ackSeq = 0;
+   _resend = 0;
+   _ackMillis = millis();
+}
+
+/**
+ * Add a frame to the open batch, opening one if there isn't one. The
+ * batch is built past _txHead and only handed to the interrupt when it
+ * is closed. New batches leave SHIELD_RETX_RESERVE of the ring free so
+ * there is always room to send one again. If the window is full the
+ * frame is dropped at once, waiting won't bring an acknowledgement.
+ **/
+bool
+ShieldSerial::batchFrame( const uint8_t* frame, uint8_t len ) {
+   const uint16_t limit = SHIELD_TX_BUFFER_SIZE - 1 - SHIELD_RETX_RESERVE;
+   if ( _batchOpen && txUsed() + len > limit ) closeBatch();  // let what we have go first
+   if ( !_batchOpen ) {
+      if ( batchesOut() >= SHIELD_RETX_BATCHES
+           || !waitForRoom( BATCH_HEADER + len + BATCH_TRAILER, limit, true ) ) {
+         dropFrame( len );
+         return false;
+      }
+      _batchOpen = true;
+      _batchStarted = micros();
+      _batchHead = (_txHead + BATCH_HEADER) % SHIELD_TX_BUFFER_SIZE;  // closeBatch() fills the header in
+   }
+   while ( len-- ) {
+      _txBuf[_batchHead] = *frame++;
+      _batchHead = ringNext( _batchHead );
+   }
+   if ( ringDist( _txHead, _batchHead ) >= BATCH_HEADER + SHIELD_BATCH_BYTES ) closeBatch();
+   return true;
+}
+
+/**
+ * Fill in the header, add the CRC, note where the batch is and send it
+ **/
+void
+ShieldSerial::closeBatch() {
+   if ( !_batchOpen ) return;
+   _batchOpen = false;
+   uint16_t at = _txHead;
+   uint8_t length = ringDist( at, _batchHead ) - BATCH_HEADER;
+   uint16_t i = at;
+   _txBuf[i] = RECORDS::BATCH;   i = ringNext( i );
+   _txBuf[i] = _nextSeq >> 8;    i = ringNext( i );
+   _txBuf[i] = _nextSeq & 0xFF;  i = ringNext( i );
+   _txBuf[i] = length;
+   uint16_t crc = 0xFFFF;
+   for ( i = at; i != _batchHead; i = ringNext( i ) ) crc = crcUpdate( crc, _txBuf[i] );
+   _txBuf[i] = crc >> 8;    i = ringNext( i );
+   _txBuf[i] = crc & 0xFF;  i = ringNext( i );
+
+   uint8_t slot = SLOT( _nextSeq );
+   _batchAt[slot] = at;
+   _batchLen[slot] = BATCH_HEADER + length + BATCH_TRAILER;
+   if ( !batchesOut() ) {
+      _keep = at;
+      _ackMillis = millis();
+   }
+   _nextSeq = (_nextSeq + 1) & SEQ_MASK;
+   publish( i );
+}
+
+/**
+ * The host has every batch before next. An old or repeated
+ * acknowledgement is ignored.
+ **/
+void
+ShieldSerial::acknowledge( uint16_t next ) {
+   uint16_t ahead = (next - _ackSeq) & SEQ_MASK;
+   if ( ahead == 0 || ahead > batchesOut() ) return;
+   while ( _ackSeq != next ) {
+      _resend &= ~(1U << SLOT( _ackSeq ));
+      _ackSeq = (_ackSeq + 1) & SEQ_MASK;
+   }
+   updateKeep();
+   _ackMillis = millis();
+}
+
+/**
+ * The host is missing some batches, the ones we still have are sent
+ * again (oldest first) as soon as there is room
+ **/
+void
+ShieldSerial::resend( uint16_t first, uint8_t count ) {
+   while ( count-- ) {
+      if ( ((first - _ackSeq) & SEQ_MASK) < batchesOut() ) _resend |= 1U << SLOT( first );
+      first = (first + 1) & SEQ_MASK;
+   }
+   sendResends();
+}
+
+/**
+ * Close a batch that has waited long enough for more frames. If the
+ * host hasn't acknowledged anything for SHIELD_RETX_TIMEOUT_MS either it
+ * lost the newest batches, with nothing after them to show the gap, or
+ * we lost its acknowledgements: send the oldest again, its answer says
+ * where the host is. One that still hasn't found room to be sent again
+ * by the next time round is given up on, the ring is full of batches
+ * the host can't acknowledge without it.
+ **/
+void
+ShieldSerial::service() {
+   if ( !_reliable ) return;
+   if ( _batchOpen && micros() - _batchStarted >= SHIELD_BATCH_US ) closeBatch();
+   if ( batchesOut() && millis() - _ackMillis >= SHIELD_RETX_TIMEOUT_MS ) {
+      _ackMillis = millis();
+      if ( _resend & (1U << SLOT( _ackSeq )) ) expireOldest();
+      if ( batchesOut() ) _resend |= 1U << SLOT( _ackSeq );
+   }
+   if ( _resend ) sendResends();
+}
+
+/**
+ * Copy the batches asked for to the head of the ring, oldest first,
+ * until one doesn't fit
+ **/
+void
+ShieldSerial::sendResends() {
+   closeBatch();
+   for ( uint16_t seq = _ackSeq; _resend && seq != _nextSeq; seq = (seq + 1) & SEQ_MASK ) {
+      uint16_t bit = 1U << SLOT( seq );
+      if ( !(_resend & bit) ) continue;
+      if ( !copyBatch( seq ) ) return;
+      _resend &= ~bit;
+   }
+}
+
+/**
+ * One kept batch again. Its new copy is the one kept from now on.
+ **/
+bool
+ShieldSerial::copyBatch( uint16_t seq ) {
+   uint8_t slot = SLOT( seq );
+   uint8_t len = _batchLen[slot];
+   if ( txUsed() + len > SHIELD_TX_BUFFER_SIZE - 1 ) return false;
+   uint16_t from = _batchAt[slot];
+   uint16_t to = _txHead;
+   _batchAt[slot] = to;
+   while ( len-- ) {
+      _txBuf[to] = _txBuf[from];
+      from = ringNext( from );
+      to = ringNext( to );
+   }
+   _resent++;
+   publish( to );
+   updateKeep();
+   return true;
+}
+
+/**
+ * Give up on the oldest batch, the host will find it missing
+ **/
+void
+ShieldSerial::expireOldest() {
+   _resend &= ~(1U << SLOT( _ackSeq ));
+   _ackSeq = (_ackSeq + 1) & SEQ_MASK;
+   _expired++;
+   updateKeep();
+}
+
+/**
+ * Resends move batches about, find the one furthest behind the head
+ **/
+void
+ShieldSerial::updateKeep() {
+   uint16_t furthest = 0;
+   for ( uint16_t seq = _ackSeq; seq != _nextSeq; seq = (seq + 1) & SEQ_MASK ) {
+      uint16_t at = _batchAt[SLOT( seq )];
+      uint16_t behind = ringDist( at, _txHead );
+      if ( behind >= furthest ) {
+         furthest = behind;
+         _keep = at;
+      }
+   }
+}
+
+/**
+ * Without interrupts (either disabled on the AVR or not an AVR at all)
+ * this moves the bytes along.
+ **/
+void
+ShieldSerial::poll() {
+#ifdef SHIELD_UART_ISR
+   if ( bit_is_clear(SREG, SREG_I) && bit_is_set(UCSR0B, UDRIE0) && bit_is_set(UCSR0A, UDRE0) )
+      _txReady();
+#else
+   // pass the transmit ring to the platform's serial port
+   int room = Serial.availableForWrite();
+   while ( room-- > 0 && _txTail != _txHead ) {
+      Serial.write( _txBuf[_txTail] );
+      _txTail = (_txTail + 1) % SHIELD_TX_BUFFER_SIZE;
+   }
+   // and collect whatever it has received
+   while ( Serial.available() ) {
+      uint8_t next = (uint8_t)(_rxHead + 1) % SHIELD_RX_BUFFER_SIZE;
+      if ( next == _rxTail ) break;  // full, leave it with the platform
+      _rxBuf[_rxHead] = (uint8_t)Serial.read();
+      _rxHead = next;
+      _rxMicros = micros();
+   }
+#endif
+}
+
+/**
+ * Receive errors are counted in the interrupt so read them atomically
+ **/
+unsigned int
+ShieldSerial::getRxErrors() {
+   unsigned int errors;
+   SHIELD_ATOMIC {
+      errors = _rxErrors;
+   }
+   return errors;
+}
+
+/**
+ * Arrival time of the last byte, the clock ping uses it to leave the
+ * time the command waited in the ring out of the round trip
+ **/
+unsigned long
+ShieldSerial::getRxMicros() {
+   unsigned long when;
+   SHIELD_ATOMIC {
+      when = _rxMicros;
+   }
+   return when;
+}
+
+/**
+ * Forget the backpressure history
+ **/
+void
+ShieldSerial::clearCounters() {
+   _stallMicros = 0L;
+   _droppedBytes = 0L;
+   _droppedFrames = 0L;
+   _highWater = 0;
+   _rxErrors = 0;
+   _resent = 0L;
+   _expired = 0L;
+}
+
+#ifdef SHIELD_UART_ISR
+/**
+ * A byte arrived. If the ring is full the byte is lost (same as HardwareSerial)
+ * Framing errors and overruns are counted, they are the first sign the
+ * baud rate is too fast for the link.
+ **/
+void
+ShieldSerial::_rxComplete() {
+   if ( UCSR0A & (_BV(FE0) | _BV(DOR0)) ) _rxErrors++;  // must be read before UDR0
+   uint8_t c = UDR0;  // reading clears the interrupt
+   _rxMicros = micros();
+   uint8_t next = (uint8_t)(_rxHead + 1) % SHIELD_RX_BUFFER_SIZE;
+   if ( next != _rxTail ) {
+      _rxBuf[_rxHead] = c;
+      _rxHead = next;
+   }
+}
+
+/**
+ * The UART can take another byte
+ **/
+void
+ShieldSerial::_txReady() {
+   uint16_t tail = _txTail;
+   UDR0 = _txBuf[tail];
+   if ( ++tail == SHIELD_TX_BUFFER_SIZE ) tail = 0;
+   _txTail = tail;
+   // clear the TXC bit (by writing a one) so flush() can tell when we are done
+   UCSR0A = (UCSR0A & (_BV(U2X0) | _BV(MPCM0))) | _BV(TXC0);
+   if ( tail == _txHead ) UCSR0B &= ~_BV(UDRIE0);  // ring is empty
+}
+
+ISR(USART_RX_vect) {
+   ShieldPort._rxComplete();
+}
+
+ISR(USART_UDRE_vect) {
+   ShieldPort._txReady();
+}
+#endif
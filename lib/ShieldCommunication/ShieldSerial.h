@@ -0,0 +1,175 @@
+/****************************************************************
+*  ShieldSerial
+*  The firmware owns the UART instead of going through HardwareSerial.
+*  HardwareSerial has a 64 byte transmit buffer and once that fills
+*  every Serial.write() spins until there is room, which stalls the
+*  whole loop() including sampling and edge detection.
+*
+*  ShieldSerial keeps a much larger transmit ring that is drained by
+*  the UDRE (data register empty) interrupt. Whole frames are queued in
+*  one go so a data blob is either sent complete or not at all. When
+*  the link can't keep up we keep count of how long we waited for room
+*  and how many bytes had to be dropped so the host can tell when the
+*  link is the bottleneck.
+*
+*  It is a Stream so the Streaming << operators work just like they did
+*  with Serial. N.B. nothing in the firmware may touch Serial, doing so
+*  links HardwareSerial's interrupt handlers which collide with ours.
+*
+*  Counted from the layout, with the defaults ShieldPort takes 563 bytes
+*  of static RAM on an uno: the rings (384 + 64), 76 for reliable
+*  streaming (48 of it the kept batches' places), 27 for the indices and
+*  counters and 12 for Stream, plus its vtable which avr-gcc keeps in RAM
+*  too. Serial, which is no longer linked, took 157. avr-size -C on the
+*  image has the real total, ST_STATS' RAM record what is left on the
+*  board.
+*
+*  Off the AVR (e.g. a native build) the rings are pumped into the
+*  platform's Serial by poll() instead of an interrupt.
+*
+*  Reliable streaming (CMDS::MDE_RELIABLE) gathers the frames into
+*  numbered batches with a CRC. There is no room on an uno for a
+*  separate retransmit buffer so the transmit ring is the window: a
+*  batch stays in the ring after it has been sent until the host
+*  acknowledges it, and a batch the host asks for again is copied from
+*  there to the head of the ring. Only the batches' places are kept on
+*  the side.
+****************************************************************/
+#ifndef ShieldSerial_h
+#define ShieldSerial_h
+#include <Arduino.h>
+
+// size of the transmit ring, several hundred bytes is a good compromise on an uno
+#ifndef SHIELD_TX_BUFFER_SIZE
+#define SHIELD_TX_BUFFER_SIZE 384
+#endif
+// size of the receive ring, commands are short
+#ifndef SHIELD_RX_BUFFER_SIZE
+#define SHIELD_RX_BUFFER_SIZE 64
+#endif
+// longest a droppable frame will wait for room before it is thrown away (μs)
+#ifndef SHIELD_TX_STALL_LIMIT_US
+#define SHIELD_TX_STALL_LIMIT_US 500
+#endif
+// reliable streaming: a batch is closed once its frames come to this many bytes
+#ifndef SHIELD_BATCH_BYTES
+#define SHIELD_BATCH_BYTES 48
+#endif
+// or once it has been open this long (μs)
+#ifndef SHIELD_BATCH_US
+#define SHIELD_BATCH_US 2000
+#endif
+// most batches waiting for the host to acknowledge them, a power of 2 up to 16
+#ifndef SHIELD_RETX_BATCHES
+#define SHIELD_RETX_BATCHES 16
+#endif
+// ring space new batches leave free so a batch can always be sent again,
+// more than the largest batch
+#ifndef SHIELD_RETX_RESERVE
+#define SHIELD_RETX_RESERVE 96
+#endif
+// every batch still waiting is sent again after this long without an acknowledgement (ms)
+#ifndef SHIELD_RETX_TIMEOUT_MS
+#define SHIELD_RETX_TIMEOUT_MS 100
+#endif
+
+class ShieldSerial : public Stream {
+
+public:
+   ShieldSerial();
+
+   void begin( unsigned long baud );
+   void end();
+
+   // Stream interface
+   virtual int available();
+   virtual int peek();
+   virtual int read();
+   virtual int availableForWrite();
+   virtual void flush();      // wait until everything queued is on the wire
+   virtual size_t write( uint8_t c );
+   virtual size_t write( const uint8_t* buffer, size_t size );
+   using Print::write;
+
+   // Queue a complete frame or nothing at all. Waits no longer than
+   // SHIELD_TX_STALL_LIMIT_US for room, then drops the frame.
+   // In reliable mode the frame goes into the open batch.
+   bool writeFrame( const uint8_t* frame, uint8_t len );
+
+   // reliable streaming, batches are numbered from 0 each time it is turned on
+   void setReliable( bool on );
+   bool isReliable() { return _reliable; }
+   void acknowledge( uint16_t next );             // the host has every batch before next
+   void resend( uint16_t first, uint8_t count );  // the host is missing these
+   void service();  // call from loop(): closes a batch that has been open too long, resends
+
+   // move bytes between the rings and the hardware when there are no interrupts
+   void poll();
+
+   // backpressure accounting
+   unsigned long getStallMicros() { return _stallMicros; }
+   unsigned long getDroppedBytes() { return _droppedBytes; }
+   unsigned long getDroppedFrames() { return _droppedFrames; }
+   unsigned int  getHighWater() { return _highWater; }
+   unsigned int  getTxSize() { return SHIELD_TX_BUFFER_SIZE; }
+   unsigned int  getTxQueued();  // bytes not sent yet
+   unsigned long getResent() { return _resent; }    // batches sent again
+   unsigned long getExpired() { return _expired; }  // batches given up on before the host had them
+   unsigned int  getRxErrors();  // framing errors and overruns
+   unsigned long getRxMicros();  // micros() when the last byte arrived
+   void          clearCounters();
+
+   // interrupt service, not for general use
+   void _rxComplete();
+   void _txReady();
+
+private:
+   bool     enqueue( const uint8_t* buffer, uint16_t size, bool mayDrop );
+   bool     waitForRoom( uint16_t size, uint16_t limit, bool mayDrop );
+   void     dropFrame( uint16_t size );
+   void     publish( uint16_t head );
+   uint16_t txUsed();
+   void     kickTx();
+
+   bool     batchFrame( const uint8_t* frame, uint8_t len );
+   void     closeBatch();
+   bool     copyBatch( uint16_t seq );
+   void     sendResends();
+   void     expireOldest();
+   void     updateKeep();
+   uint8_t  batchesOut() { return (_nextSeq - _ackSeq) & 0x3FFF; }
+
+   volatile uint16_t _txHead;   // next free slot, written by loop()
+   volatile uint16_t _txTail;   // next byte to send, written by the ISR
+   volatile uint8_t  _rxHead;   // written by the ISR
+   volatile uint8_t  _rxTail;   // written by loop()
+   uint8_t           _txBuf[SHIELD_TX_BUFFER_SIZE];
+   uint8_t           _rxBuf[SHIELD_RX_BUFFER_SIZE];
+
+   unsigned long     _stallMicros;    // total time spent waiting for room
+   unsigned long     _droppedBytes;   // bytes thrown away under overload
+   unsigned long     _droppedFrames;  // frames thrown away under overload
+   uint16_t          _highWater;      // most bytes ever waiting in the ring
+   bool              _written;        // something has been sent (flush needs this)
+   volatile uint16_t _rxErrors;       // bytes received with framing errors or overruns
+   volatile unsigned long _rxMicros;  // arrival time of the last byte
+
+   // reliable streaming
+   bool          _reliable;
+   bool          _batchOpen;
+   uint16_t      _batchHead;      // end of the open batch, past _txHead where the ISR can't see it
+   unsigned long _batchStarted;   // micros() it was opened
+   uint16_t      _nextSeq;        // number of the next batch (14 bits)
+   uint16_t      _ackSeq;         // oldest batch the host hasn't acknowledged
+   uint16_t      _keep;           // first byte of the kept batch furthest behind _txHead
+   uint16_t      _resend;         // batches to send again, bit seq % SHIELD_RETX_BATCHES
+   unsigned long _ackMillis;      // millis() the host last acknowledged something
+   unsigned long _resent;
+   unsigned long _expired;
+   uint16_t      _batchAt[SHIELD_RETX_BATCHES];   // where each kept batch is in the ring
+   uint8_t       _batchLen[SHIELD_RETX_BATCHES];  // and its length
+};
+
+extern ShieldSerial ShieldPort;
+
+#endif
@@ -0,0 +1,156 @@
+/****************************************************************
+*  ShieldStats
+*  Histograms and the free RAM low water mark, see ShieldStats.h
+****************************************************************/
+
+#include <ShieldStats.h>
+#include <ShieldSerial.h>
+
+#if defined(__AVR__)
+extern char  __heap_start;
+extern char* __brkval;
+#define RAM_PAINT 0xC5
+
+// top of the heap, the stack grows down towards it
+static char* heapTop() {
+   return __brkval ? __brkval : &__heap_start;
+}
+#endif
+
+ShieldStats Stats;
+
+#if defined(SHIELD_STATS)
+/**
+ * Bucket by the bit length of us/4, halving everything when one fills
+ **/
+void
+ShieldHistogram::add( unsigned long us ) {
+   if ( us > max ) max = us;
+   uint8_t b = 0;
+   for ( unsigned long v = us >> 2; v && b < STATS::BUCKETS - 1; v >>= 1 ) b++;
+   if ( count[b] == 0xFFFF ) {
+      for ( uint8_t i = 0; i < STATS::BUCKETS; i++ ) count[i] >>= 1;
+   }
+   count[b]++;
+}
+
+void
+ShieldHistogram::clear() {
+   memset( count, 0, sizeof(count) );
+   max = 0L;
+}
+
+#endif
+
+ShieldStats::ShieldStats() {
+#if defined(SHIELD_STATS)
+   _lastLoop = 0L;
+#endif
+}
+
+/**
+ * Paint from the top of the heap to just below where the stack is now
+ * and set Timer1 free running at F_CPU/8 (0.5μs a tick on an uno)
+ **/
+void
+ShieldStats::begin() {
+#if defined(__AVR__)
+   char here;
+   for ( char* p = heapTop(); p < &here - 32; p++ ) *p = RAM_PAINT;
+   TCCR1A = 0;
+   TCCR1B = _BV(CS11);
+   TIMSK1 = 0;
+#endif
+}
+
+#if defined(SHIELD_STATS)
+void
+ShieldStats::loopStart() {
+   unsigned long now = micros();
+   if ( _lastLoop ) _loop.add( now - _lastLoop );
+   _lastLoop = now;
+}
+
+void
+ShieldStats::poll( int src, uint16_t start ) {
+   _poll[src - SOURCES::DIG1].add( (uint16_t)(ticks() - start) >> 1 );
+}
+#endif
+
+unsigned int
+ShieldStats::freeRam() {
+#if defined(__AVR__)
+   char here;
+   return &here - heapTop();
+#else
+   return 0;
+#endif
+}
+
+/**
+ * The paint left untouched above the heap
+ **/
+unsigned int
+ShieldStats::freeRamLow() {
+#if defined(__AVR__)
+   char here;
+   char* p = heapTop();
+   while ( p < &here && *p == (char)RAM_PAINT ) p++;
+   return p - heapTop();
+#else
+   return 0;
+#endif
+}
+
+/**
+ * 0xAF id len, then for a histogram the max (4 bytes) and the buckets
+ * (2 bytes each), for the RAM record free now and the low water mark
+ * (2 bytes each). All big endian. The RAM record comes last.
+ **/
+void
+ShieldStats::send() {
+#if defined(SHIELD_STATS)
+   sendHistogram( STATS::LOOP, _loop );
+   sendHistogram( STATS::STALL, _stall );
+   sendHistogram( STATS::COMMAND, _command );
+   for ( int src = SOURCES::DIG1; src <= SOURCES::ANA210; src++ )
+      sendHistogram( STATS::POLL | src, _poll[src - SOURCES::DIG1] );
+#endif
+
+   unsigned int now = freeRam();
+   unsigned int low = freeRamLow();
+   uint8_t record[7] = { (uint8_t)RECORDS::STATS, STATS::RAM, 4,
+                         (uint8_t)(now >> 8), (uint8_t)now, (uint8_t)(low >> 8), (uint8_t)low };
+   ShieldPort.write( record, sizeof(record) );
+}
+
+#if defined(SHIELD_STATS)
+void
+ShieldStats::sendHistogram( uint8_t id, const ShieldHistogram& h ) {
+   uint8_t record[3 + 4 + 2 * STATS::BUCKETS];
+   int len = 0;
+   record[len++] = RECORDS::STATS;
+   record[len++] = id;
+   record[len++] = sizeof(record) - 3;
+   record[len++] = (uint8_t)(h.max >> 24);
+   record[len++] = (uint8_t)(h.max >> 16);
+   record[len++] = (uint8_t)(h.max >> 8);
+   record[len++] = (uint8_t)h.max;
+   for ( uint8_t i = 0; i < STATS::BUCKETS; i++ ) {
+      record[len++] = (uint8_t)(h.count[i] >> 8);
+      record[len++] = (uint8_t)h.count[i];
+   }
+   ShieldPort.write( record, len );
+}
+#endif
+
+void
+ShieldStats::clear() {
+#if defined(SHIELD_STATS)
+   _loop.clear();
+   _stall.clear();
+   _command.clear();
+   for ( uint8_t i = 0; i < 6; i++ ) _poll[i].clear();
+   _lastLoop = 0L;
+#endif
+}
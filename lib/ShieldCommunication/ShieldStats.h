@@ -0,0 +1,94 @@
+/****************************************************************
+*  ShieldStats
+*  Instrumentation cheap enough to leave in the firmware so a capture
+*  that lost samples can be looked into from the host (ST_STATS).
+*
+*  The histograms take 256 bytes of RAM, an eighth of an uno's, so they
+*  are only built with -D SHIELD_STATS ([env:uno_stats], and always in
+*  the native build). Without it the calls are nothing at all and
+*  ST_STATS answers with just the RAM record.
+*
+*  Each quantity is kept as a histogram of STATS::BUCKETS log2 buckets
+*  and the largest value seen:
+*     loop period       time between the starts of two passes of loop()
+*     poll cost         each port's pollPort() (and nothing it sends)
+*     TX stall          each wait for room in the transmit ring
+*     command latency   last byte received to the handler finished
+*  Bucket 0 holds anything under 4μs, bucket b 2^(b+1)..2^(b+2)-1 μs and
+*  the last one 4096μs and up. A bucket that fills halves them all, so
+*  the shape survives a long run.
+*
+*  begin() also paints the free RAM between the heap and the stack; the
+*  paint still intact later is the least free RAM there has ever been.
+*
+*  On the AVR the poll costs are timed off Timer1, free running at 0.5μs
+*  a tick, reading it is one 16 bit register load where micros() takes
+*  a few μs. Nothing else in the firmware uses Timer1 (analogWrite() on
+*  pins 9 and 10 would).
+****************************************************************/
+#ifndef ShieldStats_h
+#define ShieldStats_h
+#include <Arduino.h>
+#include <ShieldCommunicationCmds.h>
+
+class ShieldHistogram {
+
+public:
+   ShieldHistogram() { clear(); }
+
+   void add( unsigned long us );
+   void clear();
+
+   uint16_t      count[STATS::BUCKETS];
+   unsigned long max;   // μs
+};
+
+class ShieldStats {
+
+public:
+   ShieldStats();
+
+   void begin();   // first thing in setup(): paints the free RAM, starts Timer1
+
+   // 0.5μs ticks, wraps every 32.768ms
+   static uint16_t ticks() {
+#if defined(__AVR__)
+      return TCNT1;
+#else
+      return (uint16_t)(micros() << 1);
+#endif
+   }
+
+#if defined(SHIELD_STATS)
+   void loopStart();                       // top of loop()
+   void poll( int src, uint16_t start );   // after pollPort(), start from ticks()
+   void stall( unsigned long us ) { _stall.add( us ); }
+   void command( unsigned long us ) { _command.add( us ); }
+#else
+   void loopStart() {}
+   void poll( int, uint16_t ) {}
+   void stall( unsigned long ) {}
+   void command( unsigned long ) {}
+#endif
+
+   unsigned int freeRam();      // between the heap and the stack right now
+   unsigned int freeRamLow();   // least there has been since begin()
+
+   void send();    // one STATS record per histogram, then the RAM record
+   void clear();   // empty the histograms (the RAM low water mark stays)
+
+#if defined(SHIELD_STATS)
+private:
+   void sendHistogram( uint8_t id, const ShieldHistogram& h );
+
+   ShieldHistogram _loop;
+   ShieldHistogram _stall;
+   ShieldHistogram _command;
+   ShieldHistogram _poll[6];    // by SOURCES, DIG1..ANA210
+   unsigned long   _lastLoop;
+#endif
+};
+
+extern ShieldStats Stats;
+
+#endif
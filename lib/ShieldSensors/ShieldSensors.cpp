@@ -0,0 +1,139 @@
+/****************************************************************
+*  ShieldSensors
+*  The registry of the sensor ports, see ShieldSensors.h
+****************************************************************/
+
+#include <ShieldSensors.h>
+
+#define NONE 0xFF
+
+ShieldSensors Sensors;
+
+ShieldSensors::ShieldSensors()
+   : _table( nullptr ), _count( 0 ), _analog( 0 ), _digital( 0 ), _armed( 0 ) {
+   memset( _index, NONE, sizeof(_index) );
+}
+
+void
+ShieldSensors::setPorts( const PortEntry* table, uint8_t count ) {
+   _table = table;
+   _count = count;
+   _analog = _digital = _armed = 0;
+   memset( _index, NONE, sizeof(_index) );
+   for ( uint8_t i = 0; i < count; i++ ) {
+      PortEntry e;
+      memcpy_P( &e, &table[i], sizeof(PortEntry) );
+      if ( e.src == 0 || e.src >= sizeof(_index) ) continue;
+      _index[e.src] = i;
+      if ( e.analog ) _analog |= bit(e.src-1);
+      else            _digital |= bit(e.src-1);
+   }
+}
+
+bool
+ShieldSensors::entry( uint8_t src, PortEntry& e ) const {
+   if ( src >= sizeof(_index) || _index[src] == NONE ) return false;
+   memcpy_P( &e, &_table[_index[src]], sizeof(PortEntry) );
+   return true;
+}
+
+/**
+ * In SOURCES order, whatever order the table is in
+ **/
+uint8_t
+ShieldSensors::next( uint8_t mask, uint8_t src ) const {
+   mask &= getPorts();
+   for ( src++; src < sizeof(_index); src++ )
+      if ( mask & bit(src-1) ) return src;
+   return 0;
+}
+
+void
+ShieldSensors::arm( uint8_t mask ) {
+   mask &= getPorts();
+   for ( uint8_t src = next( mask ); src; src = next( mask, src ) ) {
+      PortEntry e;
+      entry( src, e );
+      if ( e.analog ) e.analog->armPort();
+      else            e.digital->armPort();
+   }
+   _armed |= mask;
+}
+
+void
+ShieldSensors::halt( uint8_t mask ) {
+   for ( uint8_t src = next( mask ); src; src = next( mask, src ) ) {
+      PortEntry e;
+      entry( src, e );
+      if ( e.analog ) e.analog->haltPort();
+      else            e.digital->haltPort();
+   }
+   _armed &= ~mask;
+}
+
+void
+ShieldSensors::sync( unsigned long syncTime ) {
+   for ( uint8_t src = next( 0xFF ); src; src = next( 0xFF, src ) ) {
+      PortEntry e;
+      entry( src, e );
+      if ( e.analog ) e.analog->sync( syncTime );
+      else            e.digital->sync( syncTime );
+   }
+   _armed &= ~_analog;
+}
+
+/**
+ * Down the table as long as there are armed ports in mask left to visit,
+ * only the poll function is read from flash for each
+ **/
+void
+ShieldSensors::poll( uint8_t mask ) {
+   uint8_t due = _armed & mask;
+   if ( !due ) return;
+   DigitalSnapshot gates;
+   for ( uint8_t i = 0; due && i < _count; i++ ) {
+      uint8_t b = bit( pgm_read_byte( &_table[i].src ) - 1 );
+      if ( !(due & b) ) continue;
+      due &= ~b;
+      PortPoll poll = (PortPoll)pgm_read_ptr( &_table[i].poll );
+      if ( !poll( gates ) ) _armed &= ~b;
+   }
+}
+
+VernierAnalogSensor*
+ShieldSensors::analog( uint8_t src ) const {
+   PortEntry e;
+   return entry( src, e ) ? e.analog : nullptr;
+}
+
+VernierDigitalSensor*
+ShieldSensors::digital( uint8_t src ) const {
+   PortEntry e;
+   return entry( src, e ) ? e.digital : nullptr;
+}
+
+int
+ShieldSensors::read( uint8_t src ) const {
+   PortEntry e;
+   return entry( src, e ) ? e.read() : 0;
+}
+
+unsigned long
+ShieldSensors::getCount( uint8_t src ) const {
+   PortEntry e;
+   if ( !entry( src, e ) ) return 0L;
+   return e.analog ? e.analog->getCount() : e.digital->getCount();
+}
+
+unsigned long
+ShieldSensors::getCurrentTime( uint8_t src ) const {
+   PortEntry e;
+   if ( !entry( src, e ) ) return 0L;
+   return e.analog ? e.analog->getCurrentTime() : e.digital->getCurrentTime();
+}
+
+const __FlashStringHelper*
+ShieldSensors::getKey( uint8_t src ) const {
+   PortEntry e;
+   return entry( src, e ) ? reinterpret_cast<const __FlashStringHelper*>( e.key ) : nullptr;
+}
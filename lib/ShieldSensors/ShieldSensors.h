@@ -0,0 +1,89 @@
+/****************************************************************
+*  ShieldSensors
+*  The registry of the sensor ports, by SOURCES id. The firmware lists
+*  its ports in a PROGMEM table of PortEntry, each with the sensor
+*  object and a poll function made for that port (so the compile time
+*  pins of VernierAnalogSensorT and VernierDigitalSensorT are kept),
+*  and commands fan out through here instead of naming every port.
+*
+*  The registry keeps a bitmask of the armed ports, bit SOURCES-1 as in
+*  the masks on the wire. poll() only visits the bits that are set, so
+*  a halted port costs nothing in loop(). A port that halts itself (an
+*  analog stop count, a changed sample rate or trigger) drops out of
+*  the mask the next time it is polled, which is always before the
+*  beacon reads it in the same pass.
+*
+*     Sensors.setPorts( PORTS, sizeof(PORTS)/sizeof(PORTS[0]) );
+*     Sensors.arm( mask );
+*     Sensors.poll();   // in loop()
+*     for ( uint8_t src = Sensors.next( mask ); src; src = Sensors.next( mask, src ) )
+*             Sensors.analog( src )->setSampleRate( rate );
+****************************************************************/
+#ifndef ShieldSensors_h
+#define ShieldSensors_h
+#include <Arduino.h>
+#include <VernierAnalogSensor.h>
+#include <VernierDigitalSensor.h>
+
+// pollPort() and send whatever it took, false once the port has halted.
+// Gates polled in one call of poll() share the snapshot.
+typedef bool (*PortPoll)( DigitalSnapshot& gates );
+// an immediate reading
+typedef int  (*PortRead)();
+
+// One port in the registry. The table lives in PROGMEM.
+struct PortEntry {
+   uint8_t               src;       // SOURCES id
+   VernierAnalogSensor*  analog;    // one of the two, the other nullptr
+   VernierDigitalSensor* digital;
+   PortPoll              poll;
+   PortRead              read;
+   const char*           key;       // PROGMEM, opens its ST_PORTS string e.g. "\"BTA01_5V\":"
+};
+
+class ShieldSensors {
+
+public:
+   ShieldSensors();
+
+   // register the port table (in PROGMEM), ports are polled in table order
+   void setPorts( const PortEntry* table, uint8_t count );
+
+   // bit SOURCES-1 of the ports
+   uint8_t getPorts() const { return _analog | _digital; }
+   uint8_t getAnalog() const { return _analog; }
+   uint8_t getDigital() const { return _digital; }
+   uint8_t getArmed() const { return _armed; }
+
+   // the next port after src (0 for the first) in mask, 0 when there are no more
+   uint8_t next( uint8_t mask, uint8_t src = 0 ) const;
+
+   void arm( uint8_t mask );
+   void halt( uint8_t mask = 0xFF );
+   void sync( unsigned long syncTime );   // analog ports halt on a sync
+
+   // the armed ports in mask, called from loop()
+   void poll( uint8_t mask = 0xFF );
+
+   // one port, nullptr or 0 if src isn't one
+   VernierAnalogSensor*       analog( uint8_t src ) const;
+   VernierDigitalSensor*      digital( uint8_t src ) const;
+   int                        read( uint8_t src ) const;
+   unsigned long              getCount( uint8_t src ) const;
+   unsigned long              getCurrentTime( uint8_t src ) const;
+   const __FlashStringHelper* getKey( uint8_t src ) const;
+
+private:
+   bool entry( uint8_t src, PortEntry& e ) const;
+
+   const PortEntry* _table;    // PROGMEM
+   uint8_t          _count;
+   uint8_t          _index[8]; // table index by SOURCES id, 0xFF none
+   uint8_t          _analog;
+   uint8_t          _digital;
+   uint8_t          _armed;
+};
+
+extern ShieldSensors Sensors;
+
+#endif
@@ -0,0 +1,80 @@
+/****************************************************************
+*  ShieldTrace
+*  The trace ring and its dump, see ShieldTrace.h
+****************************************************************/
+
+#include <ShieldTrace.h>
+#include <ShieldSerial.h>
+
+ShieldTrace Trace;
+
+#if defined(SHIELD_TRACE) && defined(__AVR__)
+ISR(TIMER1_OVF_vect) {
+   Trace.wraps++;
+}
+#endif
+
+ShieldTrace::ShieldTrace() {
+   clear();
+}
+
+/**
+ * Timer1 is already free running (ShieldStats::begin()), count its
+ * overflows for the top 8 bits of the clock
+ **/
+void
+ShieldTrace::begin() {
+#if defined(SHIELD_TRACE) && defined(__AVR__)
+   wraps = 0;
+   TIFR1 = _BV(TOV1);
+   TIMSK1 |= _BV(TOIE1);
+#endif
+}
+
+void
+ShieldTrace::clear() {
+#if defined(SHIELD_TRACE)
+   _total = 0;
+#endif
+}
+
+/**
+ * 0xA8 n total(2) micros(4) clock(3), then n points of id and clock(3),
+ * oldest first. All big endian.
+ **/
+void
+ShieldTrace::send() {
+   uint8_t n = 0;
+   uint32_t total = 0;
+   uint8_t header[TRACE::HEADER];
+   unsigned long us = micros();
+#if defined(SHIELD_TRACE)
+   total = _total;
+   n = total < SHIELD_TRACE_SIZE ? total : SHIELD_TRACE_SIZE;
+   Point now;
+   stamp( now );
+#else
+   struct { uint8_t hi; uint16_t lo; } now = { 0, 0 };
+#endif
+   int len = 0;
+   header[len++] = RECORDS::TRACE;
+   header[len++] = n;
+   header[len++] = (uint8_t)(total >> 8);
+   header[len++] = (uint8_t)total;
+   header[len++] = (uint8_t)(us >> 24);
+   header[len++] = (uint8_t)(us >> 16);
+   header[len++] = (uint8_t)(us >> 8);
+   header[len++] = (uint8_t)us;
+   header[len++] = now.hi;
+   header[len++] = (uint8_t)(now.lo >> 8);
+   header[len++] = (uint8_t)now.lo;
+   ShieldPort.write( header, len );
+
+#if defined(SHIELD_TRACE)
+   for ( uint32_t i = total - n; i != total; i++ ) {
+      const Point& p = _ring[i & (SHIELD_TRACE_SIZE - 1)];
+      uint8_t point[4] = { p.id, p.hi, (uint8_t)(p.lo >> 8), (uint8_t)p.lo };
+      ShieldPort.write( point, sizeof(point) );
+   }
+#endif
+}
@@ -0,0 +1,85 @@
+/****************************************************************
+*  ShieldTrace
+*  Trace points for the hot paths. Built with -D SHIELD_TRACE
+*  ([env:uno_trace]) each TRACE_POINT stores its id and the time in a
+*  small ring in RAM, 4 bytes and a couple of μs, with no formatting
+*  and nothing sent. ST_TRACE dumps the ring as one record and
+*  host/shieldtrace turns it into a timeline, so the time between two
+*  points can be seen without printing it in between (the prints cost
+*  more than most of what they were timing).
+*
+*  Without SHIELD_TRACE the points are nothing at all and ST_TRACE
+*  answers with an empty record.
+*
+*     if ( _trigState==STATE::TS_HALT ) return false;
+*     TRACE_POINT( TRACE::A_POLL );
+*
+*  The clock is Timer1 (0.5μs a tick, started by ShieldStats::begin())
+*  with its overflows counted in an interrupt for 24 bits, 8.39s. The
+*  ring keeps the last TRACE_SIZE points, -D SHIELD_TRACE_SIZE=64 for
+*  more (a power of two, 4 bytes of RAM each).
+****************************************************************/
+#ifndef ShieldTrace_h
+#define ShieldTrace_h
+#include <Arduino.h>
+#include <ShieldCommunicationCmds.h>
+
+#ifndef SHIELD_TRACE_SIZE
+#define SHIELD_TRACE_SIZE 32
+#endif
+
+class ShieldTrace;
+extern ShieldTrace Trace;
+
+class ShieldTrace {
+
+public:
+   ShieldTrace();
+
+   void begin();   // in setup() after Stats.begin(): counts the Timer1 overflows
+   void send();    // the trace record, oldest point first
+   void clear();   // empty the ring
+
+#if defined(SHIELD_TRACE)
+   void add( uint8_t id ) {
+      Point& p = _ring[_total++ & (SHIELD_TRACE_SIZE - 1)];
+      p.id = id;
+      stamp( p );
+   }
+
+   volatile uint8_t wraps;   // Timer1 overflows, bits 16..23 of the clock
+
+private:
+   struct Point {
+      uint8_t  id;
+      uint8_t  hi;   // 0.5μs ticks, 24 bits
+      uint16_t lo;
+   };
+
+   static void stamp( Point& p ) {
+#if defined(__AVR__)
+      uint8_t sreg = SREG;
+      cli();
+      p.lo = TCNT1;
+      p.hi = Trace.wraps;
+      if ( (TIFR1 & _BV(TOV1)) && p.lo < 0x8000 ) p.hi++;  // overflowed, the interrupt hasn't run yet
+      SREG = sreg;
+#else
+      uint32_t t = micros() << 1;
+      p.lo = t;
+      p.hi = t >> 16;
+#endif
+   }
+
+   uint32_t _total;   // points since the ring was emptied
+   Point    _ring[SHIELD_TRACE_SIZE];
+#endif
+};
+
+#if defined(SHIELD_TRACE)
+#define TRACE_POINT(id) Trace.add( id )
+#else
+#define TRACE_POINT(id)
+#endif
+
+#endif
@@ -15,7 +15,7 @@
 ****************************************************************/
 #include <Arduino.h>
 #include <VernierAnalogSensor.h>
-//#include <Streaming.h> // DEBUG
+#include <ShieldTrace.h>
 
 /** Constructor
  *    setup channels and initialize values.
@@ -40,7 +40,7 @@ VernierAnalogSensor::VernierAnalogSensor( int channel )
  */
 int
 VernierAnalogSensor::readPort() {
-        _absTime  = micros()-_start_us;
+        stamp();
         return analogRead(_channel);
 }
 
@@ -50,26 +50,36 @@ VernierAnalogSensor::readPort() {
  */
 bool
 VernierAnalogSensor::pollPort() {
-
-        // unsigned long dbg_st = micros(); // DEBUG
+        BENCH_SCOPE( BENCH::ANALOG_POLL );
 
         // we aren't ready, don't do anything  exp. Takes <4μs
         if ( _trigState==STATE::TS_HALT ) return false;
 
-        // Serial << "    1:" << ( micros() - dbg_st ) << endl; // DEBUG  4μS
-        //               dbg_st = micros();
+        switch ( nextPoll() ) {
+        case POLL_TRIGGER: return trigger( analogRead(_channel) );
+        case POLL_READ:    return record( analogRead(_channel) );
+        }
+        return false;
+}
+
+/**
+ * everything pollPort() decides before it reads: whether a trigger level
+ * has to be checked, the stop condition and whether a reading is due
+ */
+uint8_t
+VernierAnalogSensor::nextPoll() {
+        TRACE_POINT( TRACE::A_POLL );
 
         // montor channels to see if trigger conditions are met. Takes <4μs
         if ( _trigState == STATE::TS_ARMED ) {
+                if ( _trigCond == ATRIGCOND::TS_RISE_ABOVE || _trigCond == ATRIGCOND::TS_FALL_BELOW ) return POLL_TRIGGER;
                 if ( _trigCond == ATRIGCOND::TS_IMMEDIATE ) _trigState = STATE::TS_RUN;
-                else if ( _trigCond == ATRIGCOND::TS_RISE_ABOVE && readPort()>_trigLevel ) _trigState = STATE::TS_RUN;
-                else if ( _trigCond == ATRIGCOND::TS_FALL_BELOW && readPort()<_trigLevel ) _trigState = STATE::TS_RUN;
                 _nextRead = micros()+_sampPeriod;
-                return false;
+                TRACE_POINT( TRACE::A_ARMED );
+                return POLL_NONE;
         }
 
-        // Serial << "    2:" << ( micros() - dbg_st ) << endl; // DEBUG
-        //               dbg_st = micros();                     // DEBUG
+        TRACE_POINT( TRACE::A_RUN );
 
         // test stop conditions. Takes 4μs
         // Simplified. We only limit by count
@@ -86,37 +96,53 @@ VernierAnalogSensor::pollPort() {
                 // }
         }
 
-        // Serial << "    3:" << ( micros() - dbg_st ) << endl; // DEBUG
-        //               dbg_st = micros();                     // DEBUG
+        TRACE_POINT( TRACE::A_STOP );
 
         // take data based on timing conditions  Takes 4-8μs for non-read, 128-136μs for a read (automatic)
+        unsigned long now = micros();
         if ( _sampPeriod==0L ) { // act on a button press.
                 // If button hit then report state
                 if ( _btn.buttonIsDown() ) {
                         // trick for waiting unitl slow meat lets go.
                         while( _btn.buttonIsDown() ) ;
-                        _rawReading = readPort();
-                        _absTime  = micros()-_start_us;
-                        _nextRead = micros()+_sampPeriod;
-                        _count++;
-                        return true;
+                        return POLL_READ;
                 }
-        } else if ( micros()>_nextRead ) {
-                _rawReading = readPort();
-                _absTime  = micros()-_start_us;
-                _nextRead = micros()+_sampPeriod;
-                _count++;
-
-                // Serial << "    4r:" << ( micros() - dbg_st ) << endl; // DEBUG
-
-                return true;
+        } else if ( now>_nextRead ) {
+                // whole periods that went by without a reading, the loop was held up
+                // elsewhere. FASTEST has no period to miss.
+                if ( _sampPeriod>1L && now-_nextRead >= _sampPeriod ) _missed += (now-_nextRead)/_sampPeriod;
+                return POLL_READ;
         }
 
-        // Serial << "    4nr:" << ( micros() - dbg_st ) << endl; // DEBUG
+        TRACE_POINT( TRACE::A_IDLE );
+        return POLL_NONE;
+}
 
+/**
+ * armed with a level: start running once the reading is past it
+ */
+bool
+VernierAnalogSensor::trigger( int raw ) {
+        if ( _trigCond == ATRIGCOND::TS_RISE_ABOVE && raw>_trigLevel ) _trigState = STATE::TS_RUN;
+        else if ( _trigCond == ATRIGCOND::TS_FALL_BELOW && raw<_trigLevel ) _trigState = STATE::TS_RUN;
+        _nextRead = micros()+_sampPeriod;
+        TRACE_POINT( TRACE::A_ARMED );
         return false;
 }
 
+/**
+ * a reading was due and this is it
+ */
+bool
+VernierAnalogSensor::record( int raw ) {
+        _rawReading = raw;
+        _absTime  = micros()-_start_us;
+        _nextRead = micros()+_sampPeriod;
+        _count++;
+        TRACE_POINT( TRACE::A_READ );
+        return true;
+}
+
 /**
  * set sample time.  A small accident revealed the fastest time the Arduino
  * can sample is 1528us (~1.5ms) per call. The input is a flag to set the
@@ -206,6 +232,7 @@ VernierAnalogSensor::sync( unsigned long syncTime ) {
         _start_us = syncTime > 0 ? syncTime : micros();
         _nextRead = _start_us + _sampPeriod;
         _count = 0L;
+        _missed = 0L;
         _trigState = STATE::TS_HALT;
         _absTime = 0L;
 }
@@ -215,34 +242,34 @@ VernierAnalogSensor::getCurrentTime() {
         return micros() - _start_us;
 }
 
-/** getStatus()
- * @returns String object with information
+/** printStatus()
+ * Writes the status JSON directly to the stream. Nothing is built up in
+ * memory so it is safe to call during a capture.
+ * @param {out} where the text goes (normally ShieldPort)
+ * @param {open} flash string that opens the object e.g. F("\"BTA01_5V\":")
  */
-String
-VernierAnalogSensor::getStatus( const char* open ) {
-        String msg(open);
-        msg += "{";
-        msg += "\"state\":";
+void
+VernierAnalogSensor::printStatus( Print& out, const __FlashStringHelper* open ) {
+        out.print(open);
+        out.print(F("{\"state\":"));
         switch( _trigState ) {
-                case STATE::TS_ARMED: msg += "\"A\""; break;
-                case STATE::TS_RUN:   msg += "\"R\""; break;
-                case STATE::TS_HALT:  msg += "\"H\""; break;
+                case STATE::TS_ARMED: out.print(F("\"A\"")); break;
+                case STATE::TS_RUN:   out.print(F("\"R\"")); break;
+                case STATE::TS_HALT:  out.print(F("\"H\"")); break;
                 }
 
-        msg += ",\"period\":";    msg += _sampPeriod;   //msg += "µs ";
+        out.print(F(",\"period\":"));  out.print(_sampPeriod);   //"µs "
 
-        msg += ",\"trigger\":";
+        out.print(F(",\"trigger\":"));
         switch( _trigCond ) {
-                case ATRIGCOND::TS_IMMEDIATE:   msg += "\"I\""; break;
-                case ATRIGCOND::TS_FALL_BELOW:  msg += "\"F("; msg += _trigLevel; msg += ")\""; break;
-                case ATRIGCOND::TS_RISE_ABOVE:  msg += "\"R("; msg += _trigLevel; msg += ")\""; break;
+                case ATRIGCOND::TS_IMMEDIATE:   out.print(F("\"I\"")); break;
+                case ATRIGCOND::TS_FALL_BELOW:  out.print(F("\"F(")); out.print(_trigLevel); out.print(F(")\"")); break;
+                case ATRIGCOND::TS_RISE_ABOVE:  out.print(F("\"R(")); out.print(_trigLevel); out.print(F(")\"")); break;
                 }
 
-        msg += ",\"stop\":"; msg += _stopCond;  //msg += _stopMethod ? "µs" : "#";
-        msg += ",\"units\":"; msg += "\""; msg += _units; msg += "\"";
-        msg += ",\"name\":"; msg += "\""; msg += _name; msg += "\"";
-        msg += ",\"shortname\":"; msg += "\""; msg += _shortname; msg += "\"";
-
-        msg += "}";
-        return msg;
+        out.print(F(",\"stop\":")); out.print(_stopCond);
+        out.print(F(",\"units\":\"")); out.print(_units);
+        out.print(F("\",\"name\":\"")); out.print(_name);
+        out.print(F("\",\"shortname\":\"")); out.print(_shortname);
+        out.print(F("\"}"));
 }
@@ -33,11 +33,16 @@ TODO: Provide an identification object to determine calibrations based on I2C
 	PBeeken ByramHills High School 9.1.2016
 
 	17 Oct 2016- P. Beeken, Byram Hils High School
+
+   VernierAnalogSensorT<PIN> fixes the channel at compile time, its reads
+   set the ADC mux and collect the result straight from the registers
+   rather than mapping the pin in analogRead() on every conversion.
 ****************************************************************/
 #ifndef VernierAnalogSensor_h
 #define VernierAnalogSensor_h
 #include <Arduino.h>
 #include <VernierButton.h>
+#include <ShieldBench.h>
 
 // Sample Rates 32 values available (bottom 5 bits of first parameter)
 namespace SAMPLERATES {
@@ -115,15 +120,20 @@ class VernierAnalogSensor
       unsigned long getAbsTime() { return _absTime; }
       int           getLastRead() { return _rawReading; }
       unsigned long getCount() { return _count; }
+      unsigned long getMissed() { return _missed; } // sample periods skipped since sync
       unsigned long getCurrentTime();
       float         getMeasurement() { return applyCalibration(_rawReading); }
       const char*   getUnits() { return _units; } // return sensor's units
-      // int           getState() { return _trigState; } // return current trigger state
-      // unsigned long getRate()  { return _sampPeriod; } // return the actual sample period
-      // int           getLevel() { return _trigLevel; }
-      // int           getCond()  { return _trigCond; }
+      int           getState() { return _trigState; } // return current trigger state
+      unsigned long getRate()  { return _sampPeriod; } // return the actual sample period
+      int           getLevel() { return _trigLevel; }
+      int           getCond()  { return _trigCond; }
+      unsigned long getStopCondition() { return _stopCond; }
+      const char*   getName() { return _name; }
+      const char*   getShortname() { return _shortname; }
 
-      String        getStatus( const char* open );
+      // write the status as a JSON object straight to a stream (no heap)
+      void          printStatus( Print& out, const __FlashStringHelper* open );
 
 
 	     // constants for 10 bit channels [0-1024]
@@ -136,6 +146,14 @@ class VernierAnalogSensor
 
 	// elements for subclassing
   protected:
+      // the steps of pollPort() either side of the conversion, so that
+      // VernierAnalogSensorT can do the conversion its own way
+      enum { POLL_NONE, POLL_TRIGGER, POLL_READ };
+      uint8_t nextPoll();          // what this pass needs, the port isn't halted
+      bool    trigger( int raw );  // armed: run once raw crosses the level
+      bool    record( int raw );   // running: keep the reading
+      void    stamp() { _absTime = micros()-_start_us; }
+
     	// default linear calibration
       virtual float applyCalibration( int adcValue );
       // default quantities for subclasses
@@ -155,6 +173,7 @@ class VernierAnalogSensor
       unsigned long _nextRead;     // time to take next reading
       unsigned long _start_us;     // marker for start sequence
       unsigned long _count;        // count of values
+      unsigned long _missed;       // periods that went by without a reading
 
       unsigned long _stopCond;     // could be count or time
 //      bool          _stopMethod;   // if true then time, false then count.
@@ -164,4 +183,53 @@ class VernierAnalogSensor
       int           _trigLevel;    // level that can cause trigger
 };
 
+/**
+ * An analog pin of the Uno (A0-A5, 14-19) fixed at compile time. read()
+ * does what analogRead() does with the DEFAULT (AVcc) reference: set the
+ * mux, start a conversion, wait for it and read ADC. Off the AVR it is
+ * analogRead().
+ **/
+template<int PIN> struct AnalogPin {
+      static_assert( PIN >= 14 && PIN < 20, "not an analog pin on the Uno" );
+
+#if defined(__AVR__)
+      static int read() {
+              ADMUX = _BV(REFS0) | (PIN - 14);
+              ADCSRA |= _BV(ADSC);
+              while ( ADCSRA & _BV(ADSC) ) ;
+              return ADC;
+      }
+#else
+      static int read() { return analogRead( PIN ); }
+#endif
+};
+
+/**
+ * VernierAnalogSensor with the channel fixed at compile time, e.g.
+ *    VernierAnalogSensorT<VernierAnalogSensor::BTA01_5V> ana105;
+ * readPort() and pollPort() convert through AnalogPin, the triggers,
+ * timing and stop condition are VernierAnalogSensor's.
+ **/
+template<int PIN>
+class VernierAnalogSensorT : public VernierAnalogSensor
+{
+  public:
+      VernierAnalogSensorT() : VernierAnalogSensor( PIN ) {}
+
+      int readPort() {
+              stamp();
+              return AnalogPin<PIN>::read();
+      }
+
+      bool pollPort() {
+              BENCH_SCOPE( BENCH::ANALOG_POLL );
+              if ( getState()==STATE::TS_HALT ) return false;
+              switch ( nextPoll() ) {
+              case POLL_TRIGGER: return trigger( AnalogPin<PIN>::read() );
+              case POLL_READ:    return record( AnalogPin<PIN>::read() );
+              }
+              return false;
+      }
+};
+
 #endif
@@ -23,7 +23,6 @@
 ****************************************************************/
 #include <Arduino.h>
 #include <VernierDigitalSensor.h>
-// #include <Streaming.h>  // DEBUG
 
 
 /** Constructor
@@ -43,27 +42,33 @@ VernierDigitalSensor::VernierDigitalSensor( int channel ) {
  *    loop() stub.  This is non-blocking. It returns true if a trigger
  *    condition illicited a data update.  Unlike analog ports digital
  *    gates are either armed or halted.  Total trip through here can
- *    be from 8-12μS
+ *    be from 8-12μS, most of it digitalRead() and micros(). Now micros()
+ *    is only read on a change and VernierDigitalSensorT reads the pin
+ *    register directly.
  */
 bool
 VernierDigitalSensor::pollPort() {
-
-        // unsigned long dbg_st = micros(); // DEBUG
+        BENCH_SCOPE( BENCH::DIGITAL_POLL );
 
         if ( _trigState==0 ) return false;  // if we are halted we leave
 
-        //  Serial << "    1:" << ( micros() - dbg_st ) << endl; // DEBUG  <4μS
-        //                dbg_st = micros();                     // DEBUG
+        TRACE_POINT( TRACE::D_POLL );
 
-        // get the current state and time.  ~10μS
+        // get the current state, the time only if it changed.
         bool currState = readPort();
-        unsigned long currTime = (unsigned long)micros()-_start_us;  // time relative to sync
 
-        // Serial << "    2:" << ( micros() - dbg_st ) << endl; // DEBUG  <12μS
-        //               dbg_st = micros();                     // DEBUG
+        TRACE_POINT( TRACE::D_READ );
+
+        return changed( currState ) && edge( currState, micros() );
+}
 
-        // has the state hasn't changed do nothing.
-        if ( currState == _lastState ) return false;
+/** edge
+ *    the state has changed: decide whether it is a trigger condition
+ *    and record it. now is micros() as close to the read as we can get.
+ */
+bool
+VernierDigitalSensor::edge( bool currState, unsigned long now ) {
+        unsigned long currTime = now-_start_us;  // time relative to sync
 
         switch( _trigger ) { // decisions based on the _trigger we are looking for.
         case DTRIGCOND::ANY:  // Any change of state.
@@ -93,9 +98,7 @@ VernierDigitalSensor::pollPort() {
         _deltaTime = (unsigned long)currTime - _absTime; // time since last read
         _absTime = (unsigned long)currTime; // record the time since last sync
 
-        // Serial << "    3:" << ( micros() - dbg_st ) << endl; // DEBUG  <8μS
-        //               dbg_st = micros();                     // DEBUG
-
+        TRACE_POINT( TRACE::D_FIRED );
         return true; // successful detection of trigger condition.
 }
 
@@ -146,24 +149,23 @@ VernierDigitalSensor::getCurrentTime() {
         return micros() - _start_us;
 }
 
-/**
- *
+/** printStatus
+ *    Writes the status JSON directly to the stream. Nothing is built up in
+ *    memory so it is safe to call during a capture.
  */
-String
-VernierDigitalSensor::getStatus( const char* open ) {
-        String msg(open);
-        msg += "{";
-        msg += "\"state\": ";
-        msg += _trigState==0 ? "\"H\"" : "\"R\"";
-
-        msg += ",\"trigger\": ";
+void
+VernierDigitalSensor::printStatus( Print& out, const __FlashStringHelper* open ) {
+        out.print(open);
+        out.print(F("{\"state\": "));
+        out.print(_trigState ? F("\"R\"") : F("\"H\""));
+
+        out.print(F(",\"trigger\": "));
         switch( _trigger ) {
-                case DTRIGCOND::UNDETERMINED:   msg += "\"U\""; break;
-                case DTRIGCOND::HIGH2LOW:       msg += "\"F\""; break;
-                case DTRIGCOND::LOW2HIGH:       msg += "\"R\""; break;
-                case DTRIGCOND::ANY:            msg += "\"A\""; break;
+                case DTRIGCOND::UNDETERMINED:   out.print(F("\"U\"")); break;
+                case DTRIGCOND::HIGH2LOW:       out.print(F("\"F\"")); break;
+                case DTRIGCOND::LOW2HIGH:       out.print(F("\"R\"")); break;
+                case DTRIGCOND::ANY:            out.print(F("\"A\"")); break;
         }
 
-        msg += "}";
-        return msg;
+        out.print(F("}"));
 }
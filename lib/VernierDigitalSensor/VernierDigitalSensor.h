@@ -41,10 +41,19 @@ VernierDigitalInput
 	PBeeken ByramHills High School 9.1.2016
 
    21 Aug 2017- P. Beeken, Byram Hils High School
+
+   digitalRead() looks the pin up in three tables and checks for a PWM
+   timer on every call, several μs on an Uno. VernierDigitalSensorT<PIN>
+   fixes the pin at compile time so a read is one instruction on its PINx
+   register, and DigitalSnapshot reads both BTD lines (D2 and D6, both on
+   PORTD) at once for the firmware's loop(). VernierDigitalSensor itself
+   still takes the pin at run time for the sketches and subclasses.
 ****************************************************************/
 #ifndef VernierDigitalSensor_h
 #define VernierDigitalSensor_h
 #include <Arduino.h>
+#include <ShieldBench.h>
+#include <ShieldTrace.h>
 
 
 // Digital trigger conditions
@@ -88,7 +97,11 @@ class VernierDigitalSensor
       char getTransitionType() { return _transitionType; }
       unsigned long getCurrentTime();
 
-      String        getStatus( const char* open );
+      int  getTrigger() { return _trigger; }
+      bool isArmed() { return _trigState; }
+
+      // write the status as a JSON object straight to a stream (no heap)
+      void printStatus( Print& out, const __FlashStringHelper* open );
 
       // constants for channels
       const static int BTD01  = 2;  // D2
@@ -96,6 +109,10 @@ class VernierDigitalSensor
 
       // elements for subclassing
   protected:
+      // the level just read differs from the last one
+      bool changed( bool level ) { return level != _lastState; }
+      // the rest of pollPort() once the level has changed, now is micros()
+      bool edge( bool level, unsigned long now );
 
 	   // exclusive to this object
   private:
@@ -112,4 +129,100 @@ class VernierDigitalSensor
 
 };
 
+/**
+ * A digital pin of the Uno fixed at compile time: D0-D7 are PORTD, D8-D13
+ * PORTB and A0-A5 (14-19) PORTC. read() is a single test of the pin's
+ * PINx bit. Unlike digitalRead() it leaves a PWM output on the pin alone,
+ * nothing drives the BTD lines. Off the AVR (the native build) the port
+ * comes from portInput().
+ **/
+template<int PIN> struct DigitalPin {
+      static_assert( PIN >= 0 && PIN < 20, "not a pin on the Uno" );
+      static const uint8_t PORT = PIN < 8 ? 0 : PIN < 14 ? 1 : 2;   // D, B, C
+      static const uint8_t MASK = 1 << (PIN < 8 ? PIN : PIN < 14 ? PIN - 8 : PIN - 14);
+
+      // every pin on the same port, read at once
+      static uint8_t port() {
+#if defined(__AVR__)
+              return PORT == 0 ? PIND : PORT == 1 ? PINB : PINC;
+#else
+              return portInput( PORT );
+#endif
+      }
+      static bool read() { return port() & MASK; }
+};
+
+/**
+ * Both BTD lines from one read of PIND, for polling the two gates in the
+ * same pass of loop(). The port is read when the first armed gate asks
+ * and the time the first time one of them sees an edge, a few cycles
+ * later. Both gates get the same ones, so edges on both in one pass come
+ * out with the same time, and a pass with nothing armed or nothing
+ * changed reads neither.
+ **/
+class DigitalSnapshot
+{
+  public:
+      DigitalSnapshot() : _read( false ), _timed( false ) {}
+
+      uint8_t pins() {   // bit n is Dn
+              if ( !_read ) {
+                      _pins = DigitalPin<VernierDigitalSensor::BTD01>::port();
+                      _read = true;
+              }
+              return _pins;
+      }
+      unsigned long time() {
+              if ( !_timed ) {
+                      _time = micros();
+                      _timed = true;
+              }
+              return _time;
+      }
+
+  private:
+      static_assert( DigitalPin<VernierDigitalSensor::BTD01>::PORT == DigitalPin<VernierDigitalSensor::BTD02>::PORT,
+                     "the BTD lines are on different ports" );
+
+      bool          _read;
+      bool          _timed;
+      uint8_t       _pins;
+      unsigned long _time;
+};
+
+/**
+ * VernierDigitalSensor with the pin fixed at compile time, e.g.
+ *    VernierDigitalSensorT<VernierDigitalSensor::BTD01> dig1;
+ * readPort() and pollPort() go straight to the PIN register, the trigger
+ * and timing are the same code as VernierDigitalSensor's.
+ **/
+template<int PIN>
+class VernierDigitalSensorT : public VernierDigitalSensor
+{
+  public:
+      VernierDigitalSensorT() : VernierDigitalSensor( PIN ) {}
+
+      bool readPort() { return DigitalPin<PIN>::read(); }
+
+      bool pollPort() {
+              BENCH_SCOPE( BENCH::DIGITAL_POLL );
+              if ( !isArmed() ) return false;
+              TRACE_POINT( TRACE::D_POLL );
+              bool level = readPort();
+              TRACE_POINT( TRACE::D_READ );
+              return changed( level ) && edge( level, micros() );
+      }
+
+      // the same from a snapshot of the BTD lines' port
+      bool pollPort( DigitalSnapshot& snap ) {
+              static_assert( DigitalPin<PIN>::PORT == DigitalPin<BTD01>::PORT, "not on the BTD lines' port" );
+              BENCH_SCOPE( BENCH::DIGITAL_POLL );
+              if ( !isArmed() ) return false;
+              TRACE_POINT( TRACE::D_POLL );
+              bool level = snap.pins() & DigitalPin<PIN>::MASK;
+              TRACE_POINT( TRACE::D_READ );
+              return changed( level ) && edge( level, snap.time() );
+      }
+};
+
 #endif
@@ -0,0 +1,98 @@
+/****************************************************************
+*  Arduino.h (native)
+*  Just enough of the Arduino core for the shield firmware and the
+*  libraries in lib/ to build and run on Linux, unchanged.
+*
+*  Nothing here touches real hardware. Time is a virtual clock that
+*  only moves when the code does something that takes time on an Uno
+*  (see HAL::Costs), the pins, the serial port, the I2C bus and the
+*  EEPROM are driven from a test or a benchmark through ArduinoHAL.h.
+****************************************************************/
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define ARDUINO 10819   // the libraries test this to pick the 1.0 API
+
+typedef bool    boolean;
+typedef uint8_t byte;
+typedef uint16_t word;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT        0x0
+#define OUTPUT       0x1
+#define INPUT_PULLUP 0x2
+
+// the Uno's pin numbers
+#define LED_BUILTIN 13
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+#define NUM_DIGITAL_PINS 20
+#define NUM_ANALOG_INPUTS 6
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define bit(b)               (1UL << (b))
+#define bitRead(value, b)    (((value) >> (b)) & 0x01)
+#define bitSet(value, b)     ((value) |= (1UL << (b)))
+#define bitClear(value, b)   ((value) &= ~(1UL << (b)))
+#define bitWrite(value, b, v) ((v) ? bitSet(value, b) : bitClear(value, b))
+#define lowByte(w)           ((uint8_t)((w) & 0xFF))
+#define highByte(w)          ((uint8_t)((w) >> 8))
+#define constrain(v, lo, hi) ((v) < (lo) ? (lo) : ((v) > (hi) ? (hi) : (v)))
+
+// flash is ordinary memory here
+#define PROGMEM
+#define PSTR(s) (s)
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper*>(s))
+#define pgm_read_byte(p)  (*(const uint8_t*)(p))
+#define pgm_read_word(p)  (*(const uint16_t*)(p))
+#define pgm_read_dword(p) (*(const uint32_t*)(p))
+#define pgm_read_ptr(p)   (*(void* const*)(p))
+#define memcpy_P memcpy
+#define strlen_P strlen
+#define strcpy_P strcpy
+
+// there is nothing to interrupt the loop
+#define interrupts()
+#define noInterrupts()
+
+unsigned long micros();
+unsigned long millis();
+void delay( unsigned long ms );
+void delayMicroseconds( unsigned int us );
+
+void pinMode( uint8_t pin, uint8_t mode );
+void digitalWrite( uint8_t pin, uint8_t level );
+int  digitalRead( uint8_t pin );
+// no registers here: a read of PIND (0), PINB (1) or PINC (2), bit n the
+// port's nth pin, for code that reads the registers on the AVR
+uint8_t portInput( uint8_t port );
+int  analogRead( uint8_t pin );
+void analogWrite( uint8_t pin, int value );
+void analogReference( uint8_t mode );
+
+// supplied by the sketch
+void setup();
+void loop();
+
+#include "Print.h"
+#include "Stream.h"
+#include "HardwareSerial.h"
+
+#endif
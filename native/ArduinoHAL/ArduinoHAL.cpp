@@ -0,0 +1,434 @@
+/****************************************************************
+*  ArduinoHAL
+*  The virtual Uno behind the native Arduino core: clock, pins and
+*  serial port. See ArduinoHAL.h.
+****************************************************************/
+
+#include "Arduino.h"
+#include "ArduinoHAL.h"
+#include <deque>
+#include <utility>
+
+#define F_CPU 16000000UL
+#define EEPROM_SIZE 1024
+
+namespace HAL {
+   void resetI2C();  // Wire.cpp
+};
+
+namespace {
+
+struct Pin {
+   uint8_t     mode;
+   int         output;   // digitalWrite / analogWrite
+   bool        driven;   // something outside sets the level
+   int         level;
+   HAL::Signal signal;
+};
+
+// a byte on the wire and the time its stop bit is done
+typedef std::pair<uint64_t, uint8_t> WireByte;
+
+struct Uno {
+   HAL::Costs           costs;
+   uint64_t             now;
+   Pin                  pins[NUM_DIGITAL_PINS];
+   unsigned long        baud;
+   uint64_t             byteNs;      // 10 bits at the baud rate
+   std::deque<WireByte> tx;          // in the UART, not yet out
+   uint64_t             txFree;      // when the transmitter is next idle
+   std::deque<WireByte> rx;          // on their way in
+   uint64_t             rxFree;
+   std::deque<uint8_t>  rxBuf;       // arrived, not read yet
+   HAL::Sink            sink;
+   uint64_t             bytesOut;
+   bool                 stopped;
+};
+
+Uno uno;
+
+/**
+ * Roughly what each of these takes on a 16MHz Uno
+ **/
+const HAL::Costs UNO_COSTS = {
+   3500,      // micros()
+   3500,      // digitalRead()
+   3500,      // digitalWrite()
+   125,       // portInput(), `in` and a bit test
+   112000,    // analogRead(), 13 ADC clocks at 125kHz less change
+   3300000,   // EEPROM write
+   1000,      // Serial.available(), availableForWrite()
+   2000,      // loop()
+};
+
+/**
+ * The baud rate the AVR really runs at: same divisor as HardwareSerial,
+ * double speed mode unless the divisor won't fit
+ **/
+unsigned long realBaud( unsigned long baud ) {
+   if ( baud == 0 ) return 0;
+   unsigned long setting = (F_CPU / 4 / baud - 1) / 2;
+   if ( baud == 57600 || setting > 4095 ) {
+      setting = (F_CPU / 8 / baud - 1) / 2;
+      return F_CPU / 16 / (setting + 1);
+   }
+   return F_CPU / 8 / (setting + 1);
+}
+
+/**
+ * Hand the bytes that have finished sending to the sink and collect the
+ * ones that have arrived. A full receive buffer loses bytes, as on the AVR.
+ **/
+void pump() {
+   uint8_t out[SERIAL_TX_BUFFER_SIZE];
+   size_t n = 0;
+   while ( !uno.tx.empty() && uno.tx.front().first <= uno.now ) {
+      out[n++] = uno.tx.front().second;
+      uno.tx.pop_front();
+   }
+   if ( n ) {
+      uno.bytesOut += n;
+      if ( uno.sink ) uno.sink( out, n );
+   }
+   while ( !uno.rx.empty() && uno.rx.front().first <= uno.now ) {
+      if ( uno.rxBuf.size() < SERIAL_RX_BUFFER_SIZE - 1 ) uno.rxBuf.push_back( uno.rx.front().second );
+      uno.rx.pop_front();
+   }
+}
+
+Pin* pinFor( uint8_t pin ) {
+   return pin < NUM_DIGITAL_PINS ? &uno.pins[pin] : nullptr;
+}
+
+int levelOf( Pin* p ) {
+   if ( !p ) return LOW;
+   if ( p->signal ) return p->signal( uno.now ) ? HIGH : LOW;
+   if ( p->driven ) return p->level ? HIGH : LOW;
+   if ( p->mode == OUTPUT ) return p->output;
+   return p->mode == INPUT_PULLUP ? HIGH : LOW;
+}
+
+}  // namespace
+
+/****************************************************************
+*  The control side
+****************************************************************/
+
+HAL::Costs&
+HAL::costs() {
+   return uno.costs;
+}
+
+uint64_t
+HAL::nowNs() {
+   return uno.now;
+}
+
+void
+HAL::advance( uint64_t ns ) {
+   uno.now += ns;
+}
+
+void
+HAL::advanceTo( uint64_t ns ) {
+   if ( ns > uno.now ) uno.now = ns;
+}
+
+void
+HAL::setAnalog( uint8_t pin, int value ) {
+   setDigital( pin < A0 ? pin + A0 : pin, value );
+}
+
+void
+HAL::setAnalog( uint8_t pin, Signal signal ) {
+   setDigital( pin < A0 ? pin + A0 : pin, signal );
+}
+
+void
+HAL::setDigital( uint8_t pin, int level ) {
+   Pin* p = pinFor( pin );
+   if ( !p ) return;
+   p->driven = true;
+   p->level = level;
+   p->signal = nullptr;
+}
+
+void
+HAL::setDigital( uint8_t pin, Signal signal ) {
+   Pin* p = pinFor( pin );
+   if ( !p ) return;
+   p->driven = true;
+   p->signal = signal;
+}
+
+void
+HAL::clearPin( uint8_t pin ) {
+   Pin* p = pinFor( pin );
+   if ( !p ) return;
+   p->driven = false;
+   p->signal = nullptr;
+}
+
+int
+HAL::getMode( uint8_t pin ) {
+   Pin* p = pinFor( pin );
+   return p ? p->mode : INPUT;
+}
+
+int
+HAL::getOutput( uint8_t pin ) {
+   Pin* p = pinFor( pin );
+   return p ? p->output : 0;
+}
+
+void
+HAL::sendToDevice( const uint8_t* data, size_t len ) {
+   uint64_t at = uno.rxFree > uno.now ? uno.rxFree : uno.now;
+   for ( size_t i = 0; i < len; i++ ) {
+      at += uno.byteNs;
+      uno.rx.push_back( WireByte( at, data[i] ) );
+   }
+   uno.rxFree = at;
+   pump();
+}
+
+void
+HAL::setSerialSink( Sink sink ) {
+   uno.sink = sink;
+}
+
+unsigned long
+HAL::getBaud() {
+   return uno.baud;
+}
+
+uint64_t
+HAL::getBytesFromDevice() {
+   pump();
+   return uno.bytesOut;
+}
+
+void
+HAL::drainSerial() {
+   if ( !uno.tx.empty() ) advanceTo( uno.tx.back().first );
+   pump();
+}
+
+void
+HAL::reset() {
+   uno.costs = UNO_COSTS;
+   uno.now = 0;
+   for ( Pin& p : uno.pins ) {
+      p.mode = INPUT;
+      p.output = 0;
+      p.driven = false;
+      p.level = 0;
+      p.signal = nullptr;
+   }
+   uno.baud = 0;
+   uno.byteNs = 0;
+   uno.tx.clear();
+   uno.txFree = 0;
+   uno.rx.clear();
+   uno.rxFree = 0;
+   uno.rxBuf.clear();
+   uno.bytesOut = 0;
+   uno.stopped = false;
+   resetI2C();
+   memset( eeprom(), 0xFF, eepromSize() );
+}
+
+void
+HAL::stop() {
+   uno.stopped = true;
+}
+
+bool
+HAL::stopped() {
+   return uno.stopped;
+}
+
+uint8_t*
+HAL::eeprom() {
+   static uint8_t memory[EEPROM_SIZE];
+   return memory;
+}
+
+size_t
+HAL::eepromSize() {
+   return EEPROM_SIZE;
+}
+
+// power on state before main() runs
+static struct PowerOn {
+   PowerOn() { HAL::reset(); }
+} powerOn;
+
+/****************************************************************
+*  The Arduino side
+****************************************************************/
+
+/**
+ * 4μs resolution, as on a 16MHz Uno
+ **/
+unsigned long
+micros() {
+   unsigned long t = (unsigned long)(uno.now / 1000) & ~3UL;
+   uno.now += uno.costs.micros;
+   return t;
+}
+
+unsigned long
+millis() {
+   unsigned long t = (unsigned long)(uno.now / 1000000);
+   uno.now += uno.costs.micros;
+   return t;
+}
+
+void
+delay( unsigned long ms ) {
+   uno.now += (uint64_t)ms * 1000000;
+}
+
+void
+delayMicroseconds( unsigned int us ) {
+   uno.now += (uint64_t)us * 1000;
+}
+
+void
+pinMode( uint8_t pin, uint8_t mode ) {
+   Pin* p = pinFor( pin );
+   if ( p ) p->mode = mode;
+}
+
+void
+digitalWrite( uint8_t pin, uint8_t level ) {
+   uno.now += uno.costs.digitalWrite;
+   Pin* p = pinFor( pin );
+   if ( p ) p->output = level ? HIGH : LOW;
+}
+
+int
+digitalRead( uint8_t pin ) {
+   uno.now += uno.costs.digitalRead;
+   return levelOf( pinFor( pin ) );
+}
+
+/**
+ * All the port's pins sampled at the same moment, as PIND, PINB and PINC
+ **/
+uint8_t
+portInput( uint8_t port ) {
+   static const uint8_t FIRST[] = { 0, 8, 14 }, COUNT[] = { 8, 6, 6 };
+   uno.now += uno.costs.portInput;
+   if ( port > 2 ) return 0;
+   uint8_t bits = 0;
+   for ( uint8_t i = 0; i < COUNT[port]; i++ )
+      if ( levelOf( pinFor( FIRST[port] + i ) ) ) bits |= 1 << i;
+   return bits;
+}
+
+/**
+ * The input is sampled as the conversion starts
+ **/
+int
+analogRead( uint8_t pin ) {
+   Pin* p = pinFor( pin < A0 ? pin + A0 : pin );
+   int value = 0;
+   if ( p && p->signal ) value = p->signal( uno.now );
+   else if ( p && p->driven ) value = p->level;
+   uno.now += uno.costs.analogRead;
+   return constrain( value, 0, 1023 );
+}
+
+void
+analogWrite( uint8_t pin, int value ) {
+   Pin* p = pinFor( pin );
+   if ( !p ) return;
+   p->mode = OUTPUT;
+   p->output = value;
+}
+
+void
+analogReference( uint8_t ) {
+}
+
+/****************************************************************
+*  The UART
+****************************************************************/
+
+HardwareSerial Serial;
+
+void
+HardwareSerial::begin( unsigned long baud, uint8_t ) {
+   pump();
+   uno.baud = realBaud( baud );
+   uno.byteNs = uno.baud ? 10000000000ULL / uno.baud : 0;
+}
+
+void
+HardwareSerial::end() {
+   flush();
+   uno.baud = 0;
+   uno.byteNs = 0;
+   uno.rxBuf.clear();
+}
+
+int
+HardwareSerial::available() {
+   uno.now += uno.costs.serial;
+   pump();
+   return (int)uno.rxBuf.size();
+}
+
+int
+HardwareSerial::peek() {
+   pump();
+   return uno.rxBuf.empty() ? -1 : uno.rxBuf.front();
+}
+
+int
+HardwareSerial::read() {
+   pump();
+   if ( uno.rxBuf.empty() ) return -1;
+   int c = uno.rxBuf.front();
+   uno.rxBuf.pop_front();
+   return c;
+}
+
+/**
+ * Costs a little like available(), so code spinning on it for room
+ * sees the bytes go out
+ **/
+int
+HardwareSerial::availableForWrite() {
+   uno.now += uno.costs.serial;
+   pump();
+   return SERIAL_TX_BUFFER_SIZE - 1 - (int)uno.tx.size();
+}
+
+/**
+ * Wait for the last byte to go out
+ **/
+void
+HardwareSerial::flush() {
+   HAL::drainSerial();
+}
+
+/**
+ * Waits for room like the AVR core does, the byte goes out once the
+ * ones ahead of it have
+ **/
+size_t
+HardwareSerial::write( uint8_t c ) {
+   pump();
+   if ( uno.tx.size() >= SERIAL_TX_BUFFER_SIZE - 1 ) {
+      HAL::advanceTo( uno.tx.front().first );
+      pump();
+   }
+   uint64_t start = uno.txFree > uno.now ? uno.txFree : uno.now;
+   uno.txFree = start + uno.byteNs;
+   uno.tx.push_back( WireByte( uno.txFree, c ) );
+   pump();
+   return 1;
+}
@@ -0,0 +1,82 @@
+/****************************************************************
+*  ArduinoHAL
+*  The other side of the native Arduino core: the virtual clock, the
+*  signals on the pins, the host end of the serial port, the devices on
+*  the I2C bus and the EEPROM. Tests and benchmarks drive the firmware
+*  through here, the firmware itself only sees Arduino.h.
+*
+*  The clock starts at 0 and only moves when something that takes time
+*  on an Uno happens: micros(), analogRead(), delay() and so on each
+*  cost what they cost on the board (HAL::costs()) and main() charges a
+*  little for every pass of loop(). Runs are repeatable to the
+*  microsecond and a minute of acquisition takes well under a second.
+****************************************************************/
+#ifndef ArduinoHAL_h
+#define ArduinoHAL_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+
+namespace HAL {
+
+   // what things cost on a 16MHz Uno, in ns of virtual time
+   struct Costs {
+      uint32_t micros;        // micros() and millis()
+      uint32_t digitalRead;
+      uint32_t digitalWrite;
+      uint32_t portInput;     // portInput(), a read of a PINx register
+      uint32_t analogRead;    // one ADC conversion
+      uint32_t eepromWrite;
+      uint32_t serial;        // Serial.available() and availableForWrite()
+      uint32_t loop;          // the overhead of one pass of loop()
+   };
+   Costs& costs();
+
+   // the virtual clock
+   uint64_t nowNs();
+   void     advance( uint64_t ns );
+   void     advanceTo( uint64_t ns );   // never goes backwards
+
+   // a signal on a pin, called with the time (ns) each time the pin is read
+   typedef std::function<int( uint64_t ns )> Signal;
+
+   // analog inputs by pin (A0..A5) or channel (0..5), 0..1023
+   void setAnalog( uint8_t pin, int value );
+   void setAnalog( uint8_t pin, Signal signal );
+   // digital inputs, a pin nothing drives reads HIGH with INPUT_PULLUP and LOW otherwise
+   void setDigital( uint8_t pin, int level );
+   void setDigital( uint8_t pin, Signal signal );
+   void clearPin( uint8_t pin );
+   // what the firmware did with a pin
+   int  getMode( uint8_t pin );
+   int  getOutput( uint8_t pin );   // digitalWrite() or analogWrite() value
+
+   // host end of the serial port. Bytes sent to the device arrive one
+   // after another at the baud rate starting now, bytes from the device
+   // go to the sink as they leave the UART.
+   typedef std::function<void( const uint8_t* data, size_t len )> Sink;
+   void          sendToDevice( const uint8_t* data, size_t len );
+   void          setSerialSink( Sink sink );   // none: the bytes are counted and dropped
+   unsigned long getBaud();                    // 0 until Serial.begin()
+   uint64_t      getBytesFromDevice();
+   void          drainSerial();                // finish sending what the UART holds
+
+   // an I2C device: memory read and written through a register pointer,
+   // the first byte of each write sets the pointer (as the AutoID EEPROM)
+   void setI2CDevice( uint8_t address, const uint8_t* memory, size_t size );
+   void removeI2CDevice( uint8_t address );
+
+   // the 1K of EEPROM, erased to 0xFF
+   uint8_t* eeprom();
+   size_t   eepromSize();
+
+   // power on: clock, pins, serial, I2C and EEPROM back to the start
+   void reset();
+
+   // main() runs loop() until this is called or the time is up
+   void stop();
+   bool stopped();
+};
+
+#endif
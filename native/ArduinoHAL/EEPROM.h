@@ -0,0 +1,35 @@
+/****************************************************************
+*  EEPROM (native)
+*  The AVR EEPROM library's interface over HAL::eeprom(). Each byte
+*  written costs HAL::costs().eepromWrite.
+****************************************************************/
+#ifndef EEPROM_h
+#define EEPROM_h
+
+#include <stdint.h>
+#include <string.h>
+#include "ArduinoHAL.h"
+
+struct EEPROMClass {
+   uint8_t  read( int idx ) { return HAL::eeprom()[idx]; }
+   void     write( int idx, uint8_t val ) {
+      HAL::advance( HAL::costs().eepromWrite );
+      HAL::eeprom()[idx] = val;
+   }
+   void     update( int idx, uint8_t val ) { if ( read( idx ) != val ) write( idx, val ); }
+   uint16_t length() { return (uint16_t)HAL::eepromSize(); }
+
+   template<typename T> T& get( int idx, T& t ) {
+      memcpy( &t, HAL::eeprom() + idx, sizeof(T) );
+      return t;
+   }
+   template<typename T> const T& put( int idx, const T& t ) {
+      const uint8_t* p = (const uint8_t*)&t;
+      for ( size_t i = 0; i < sizeof(T); i++ ) update( idx + i, p[i] );
+      return t;
+   }
+};
+
+static EEPROMClass EEPROM;
+
+#endif
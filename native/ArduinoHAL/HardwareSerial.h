@@ -0,0 +1,42 @@
+/****************************************************************
+*  HardwareSerial (native)
+*  The Uno's UART as seen from the firmware. Bytes leave and arrive at
+*  the baud rate on the virtual clock, with the same 64 byte transmit
+*  buffer as the AVR core, so a link that can't keep up backs up the
+*  way it does on the board. The other end is HAL::sendToDevice() and
+*  HAL::setSerialSink().
+****************************************************************/
+#ifndef HardwareSerial_h
+#define HardwareSerial_h
+
+#include "Stream.h"
+
+#define SERIAL_TX_BUFFER_SIZE 64
+#define SERIAL_RX_BUFFER_SIZE 64
+#define SERIAL_8N1 0x06
+
+class HardwareSerial : public Stream {
+
+public:
+   void begin( unsigned long baud ) { begin( baud, SERIAL_8N1 ); }
+   void begin( unsigned long baud, uint8_t config );
+   void end();
+
+   virtual int    available();
+   virtual int    peek();
+   virtual int    read();
+   virtual int    availableForWrite();
+   virtual void   flush();
+   virtual size_t write( uint8_t c );
+   inline size_t write( unsigned long n ) { return write( (uint8_t)n ); }
+   inline size_t write( long n ) { return write( (uint8_t)n ); }
+   inline size_t write( unsigned int n ) { return write( (uint8_t)n ); }
+   inline size_t write( int n ) { return write( (uint8_t)n ); }
+   using Print::write;
+
+   operator bool() { return true; }
+};
+
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,129 @@
+/****************************************************************
+*  Print (native)
+*  Number formatting follows the Arduino core exactly.
+****************************************************************/
+
+#include "Arduino.h"
+
+size_t
+Print::write( const uint8_t* buffer, size_t size ) {
+   size_t n = 0;
+   while ( size-- ) {
+      if ( !write( *buffer++ ) ) break;
+      n++;
+   }
+   return n;
+}
+
+size_t
+Print::print( const __FlashStringHelper* str ) {
+   return write( reinterpret_cast<const char*>( str ) );
+}
+
+size_t
+Print::print( const char* str ) {
+   return write( str );
+}
+
+size_t
+Print::print( char c ) {
+   return write( (uint8_t)c );
+}
+
+size_t
+Print::print( unsigned char n, int base ) {
+   return print( (unsigned long)n, base );
+}
+
+size_t
+Print::print( int n, int base ) {
+   return print( (long)n, base );
+}
+
+size_t
+Print::print( unsigned int n, int base ) {
+   return print( (unsigned long)n, base );
+}
+
+/**
+ * int and long are 16 and 32 bits on the Uno, print the same digits here
+ **/
+size_t
+Print::print( long n, int base ) {
+   int32_t v = (int32_t)n;
+   if ( base == 0 ) return write( (uint8_t)v );
+   if ( base == 10 && v < 0 ) {
+      size_t t = print( '-' );
+      return t + printNumber( (unsigned long)(-(int64_t)v), 10 );
+   }
+   return printNumber( (uint32_t)v, base );
+}
+
+size_t
+Print::print( unsigned long n, int base ) {
+   if ( base == 0 ) return write( (uint8_t)n );
+   return printNumber( (uint32_t)n, base );
+}
+
+size_t
+Print::print( double n, int digits ) {
+   return printFloat( n, digits );
+}
+
+size_t
+Print::println() {
+   return write( "\r\n" );
+}
+
+size_t Print::println( const __FlashStringHelper* str ) { size_t n = print( str ); return n + println(); }
+size_t Print::println( const char* str )                { size_t n = print( str ); return n + println(); }
+size_t Print::println( char c )                         { size_t n = print( c ); return n + println(); }
+size_t Print::println( unsigned char v, int base )      { size_t n = print( v, base ); return n + println(); }
+size_t Print::println( int v, int base )                { size_t n = print( v, base ); return n + println(); }
+size_t Print::println( unsigned int v, int base )       { size_t n = print( v, base ); return n + println(); }
+size_t Print::println( long v, int base )               { size_t n = print( v, base ); return n + println(); }
+size_t Print::println( unsigned long v, int base )      { size_t n = print( v, base ); return n + println(); }
+size_t Print::println( double v, int digits )           { size_t n = print( v, digits ); return n + println(); }
+
+size_t
+Print::printNumber( unsigned long n, uint8_t base ) {
+   char buf[8 * sizeof(long) + 1];
+   char* str = &buf[sizeof(buf) - 1];
+   *str = '\0';
+   if ( base < 2 ) base = 10;
+   do {
+      char c = n % base;
+      n /= base;
+      *--str = c < 10 ? c + '0' : c + 'A' - 10;
+   } while ( n );
+   return write( str );
+}
+
+size_t
+Print::printFloat( double number, uint8_t digits ) {
+   if ( isnan( number ) ) return print( "nan" );
+   if ( isinf( number ) ) return print( "inf" );
+   if ( number > 4294967040.0 ) return print( "ovf" );
+   if ( number < -4294967040.0 ) return print( "ovf" );
+
+   size_t n = 0;
+   if ( number < 0.0 ) {
+      n += print( '-' );
+      number = -number;
+   }
+   double rounding = 0.5;
+   for ( uint8_t i = 0; i < digits; ++i ) rounding /= 10.0;
+   number += rounding;
+
+   unsigned long whole = (unsigned long)number;
+   double remainder = number - (double)whole;
+   n += print( whole );
+   if ( digits > 0 ) n += print( '.' );
+   while ( digits-- > 0 ) {
+      remainder *= 10.0;
+      unsigned int digit = (unsigned int)remainder;
+      n += print( digit );
+      remainder -= digit;
+   }
+   return n;
+}
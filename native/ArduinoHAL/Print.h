@@ -0,0 +1,54 @@
+/****************************************************************
+*  Print (native)
+*  The Arduino Print class, formatting included, so Streaming and the
+*  printStatus() methods produce the same bytes as on the Uno.
+****************************************************************/
+#ifndef Print_h
+#define Print_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+class __FlashStringHelper;
+
+class Print {
+
+public:
+   virtual ~Print() {}
+
+   virtual size_t write( uint8_t c ) = 0;
+   virtual size_t write( const uint8_t* buffer, size_t size );
+   size_t write( const char* str ) { return str ? write( (const uint8_t*)str, strlen( str ) ) : 0; }
+   size_t write( const char* buffer, size_t size ) { return write( (const uint8_t*)buffer, size ); }
+
+   virtual int  availableForWrite() { return 0; }
+   virtual void flush() {}
+
+   size_t print( const __FlashStringHelper* str );
+   size_t print( const char* str );
+   size_t print( char c );
+   size_t print( unsigned char n, int base=10 );
+   size_t print( int n, int base=10 );
+   size_t print( unsigned int n, int base=10 );
+   size_t print( long n, int base=10 );
+   size_t print( unsigned long n, int base=10 );
+   size_t print( double n, int digits=2 );
+
+   size_t println();
+   size_t println( const __FlashStringHelper* str );
+   size_t println( const char* str );
+   size_t println( char c );
+   size_t println( unsigned char n, int base=10 );
+   size_t println( int n, int base=10 );
+   size_t println( unsigned int n, int base=10 );
+   size_t println( long n, int base=10 );
+   size_t println( unsigned long n, int base=10 );
+   size_t println( double n, int digits=2 );
+
+private:
+   size_t printNumber( unsigned long n, uint8_t base );
+   size_t printFloat( double n, uint8_t digits );
+};
+
+#endif
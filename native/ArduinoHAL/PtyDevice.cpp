@@ -0,0 +1,258 @@
+/****************************************************************
+*  PtyDevice
+*  Serves the native firmware on a pseudo-terminal, see PtyDevice.h
+****************************************************************/
+
+#include "PtyDevice.h"
+#include "Arduino.h"
+#include "ArduinoHAL.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#if defined(__linux__)
+#include <sys/prctl.h>
+#endif
+
+namespace {
+
+// most bytes held for a host that isn't reading, after that they are lost
+// (the USB bridge on an Uno does the same)
+const size_t MAX_PENDING = 65536;
+// sleep when the firmware is this far ahead of real time
+const uint64_t AHEAD_NS = 200000;
+
+volatile sig_atomic_t interrupted = 0;
+
+void onSignal( int ) {
+   interrupted = 1;
+}
+
+double wallSeconds() {
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+}  // namespace
+
+PtyDevice::PtyDevice() : _master( -1 ), _link( nullptr ), _errorRate( 0 ), _errorSeed( 1 ) {
+   _name[0] = 0;
+}
+
+void
+PtyDevice::setLinkErrors( double rate, uint64_t seed ) {
+   _errorRate = rate;
+   _errorSeed = seed ? seed : 1;
+}
+
+PtyDevice::~PtyDevice() {
+   char target[sizeof(_name)];
+   ssize_t len = _link ? readlink( _link, target, sizeof(target) - 1 ) : -1;
+   if ( len > 0 ) {
+      target[len] = 0;
+      if ( !strcmp( target, _name ) ) unlink( _link );  // unless another one has taken it over
+   }
+   if ( _master >= 0 ) close( _master );
+}
+
+/**
+ * The slave is opened once to make it raw and closed again, which also
+ * leaves the master reporting a hang up until the host opens it
+ **/
+bool
+PtyDevice::open( const char* link ) {
+   _master = posix_openpt( O_RDWR | O_NOCTTY );
+   if ( _master < 0 || grantpt( _master ) < 0 || unlockpt( _master ) < 0 ) {
+      perror( "pty" );
+      return false;
+   }
+   fcntl( _master, F_SETFL, fcntl( _master, F_GETFL ) | O_NONBLOCK );
+   fcntl( _master, F_SETFD, FD_CLOEXEC );
+   snprintf( _name, sizeof(_name), "%s", ptsname( _master ) );
+
+   int slave = ::open( _name, O_RDWR | O_NOCTTY );
+   if ( slave < 0 ) {
+      perror( _name );
+      return false;
+   }
+   struct termios tio;
+   tcgetattr( slave, &tio );
+   cfmakeraw( &tio );
+   tcsetattr( slave, TCSANOW, &tio );
+   close( slave );
+
+   if ( link ) {
+      struct stat st;
+      if ( lstat( link, &st ) == 0 && S_ISLNK( st.st_mode ) ) unlink( link );
+      if ( symlink( _name, link ) < 0 ) {
+         perror( link );
+         return false;
+      }
+      _link = link;
+   }
+   return true;
+}
+
+int
+PtyDevice::serve( double seconds, FILE* record, bool quiet ) {
+   struct sigaction sa;
+   memset( &sa, 0, sizeof(sa) );
+   sa.sa_handler = onSignal;   // no SA_RESTART, the waits below have to see it
+   sigaction( SIGINT, &sa, nullptr );
+   sigaction( SIGTERM, &sa, nullptr );
+
+   double deadline = seconds > 0 ? wallSeconds() + seconds : 0;
+   while ( waitForHost( deadline ) ) {
+      if ( record ) fflush( record );
+      pid_t board = fork();
+      if ( board < 0 ) {
+         perror( "fork" );
+         return 1;
+      }
+      if ( board == 0 ) {
+         signal( SIGINT, SIG_DFL );
+         signal( SIGTERM, SIG_DFL );
+#if defined(__linux__)
+         prctl( PR_SET_PDEATHSIG, SIGTERM );
+#endif
+         exit( runBoard( deadline, record, quiet ) );
+      }
+      int status;
+      while ( waitpid( board, &status, 0 ) < 0 ) {
+         if ( errno != EINTR ) return 1;
+         if ( interrupted ) kill( board, SIGTERM );
+      }
+      if ( interrupted ) break;
+      if ( WIFSIGNALED( status ) ) {
+         fprintf( stderr, "board died: %s\n", strsignal( WTERMSIG( status ) ) );
+         return 1;
+      }
+      if ( deadline && wallSeconds() >= deadline ) break;
+   }
+   return 0;
+}
+
+/**
+ * The master reports a hang up for as long as nothing has the slave open
+ **/
+bool
+PtyDevice::waitForHost( double deadline ) {
+   while ( !interrupted ) {
+      struct pollfd p = { _master, POLLIN, 0 };
+      if ( poll( &p, 1, 0 ) >= 0 && !(p.revents & POLLHUP) ) return true;
+      if ( deadline && wallSeconds() >= deadline ) return false;
+      usleep( 20000 );
+   }
+   return false;
+}
+
+/**
+ * One connection: setup() then loop(), paced to the wall clock, until
+ * the host hangs up
+ **/
+int
+PtyDevice::runBoard( double deadline, FILE* record, bool quiet ) {
+   std::vector<uint8_t> pending;
+   uint64_t in = 0;
+   uint64_t lost = 0;
+   uint64_t damaged = 0;
+   uint64_t rng = _errorSeed * 0x9E3779B97F4A7C15ULL;  // spread a small seed over the bits (splitmix64)
+   rng = (rng ^ (rng >> 30)) * 0xBF58476D1CE4E5B9ULL;
+   rng = (rng ^ (rng >> 27)) * 0x94D049BB133111EBULL;
+   rng ^= rng >> 31;
+   const uint64_t threshold = (uint64_t)(_errorRate * 18446744073709551615.0);
+   HAL::setSerialSink( [&]( const uint8_t* data, size_t len ) {
+      if ( record ) fwrite( data, 1, len, record );
+      for ( size_t i = 0; i < len; i++ ) {
+         if ( pending.size() >= MAX_PENDING ) {
+            lost += len - i;
+            break;
+         }
+         uint8_t c = data[i];
+         if ( threshold ) {
+            rng ^= rng << 13;  // xorshift64
+            rng ^= rng >> 7;
+            rng ^= rng << 17;
+            if ( rng < threshold ) {
+               damaged++;
+               if ( rng & 0x100 ) continue;   // lost
+               c ^= 1 << ((rng >> 9) & 7);    // or a bit flipped
+            }
+         }
+         pending.push_back( c );
+      }
+   } );
+
+   double start = wallSeconds();
+   if ( !quiet ) fprintf( stderr, "host connected\n" );
+   setup();
+
+   // a real Uno is in its bootloader and then setup() for this long and
+   // what the host sends meanwhile is lost, so it is here too
+   uint64_t ignored = 0;
+   bool connected = true;
+   for ( double ready = start + HAL::nowNs() / 1e9; connected; ) {
+      uint8_t buf[256];
+      ssize_t got;
+      while ( (got = read( _master, buf, sizeof(buf) )) > 0 ) ignored += got;
+      if ( got == 0 || (got < 0 && errno != EAGAIN && errno != EINTR) ) connected = false;
+      double now = wallSeconds();
+      if ( now >= ready || (deadline && now >= deadline) ) break;
+      struct pollfd p = { _master, POLLIN, 0 };
+      poll( &p, 1, (int)((ready - now) * 1000) + 1 );
+   }
+
+   while ( connected ) {
+      loop();
+      HAL::advance( HAL::costs().loop );
+
+      uint8_t buf[256];
+      ssize_t got;
+      while ( (got = read( _master, buf, sizeof(buf) )) > 0 ) {
+         HAL::sendToDevice( buf, got );
+         in += got;
+      }
+      if ( got == 0 || (got < 0 && errno != EAGAIN && errno != EINTR) ) connected = false;  // EIO: hung up
+
+      if ( !pending.empty() ) {
+         ssize_t put = write( _master, pending.data(), pending.size() );
+         if ( put > 0 ) pending.erase( pending.begin(), pending.begin() + put );
+      }
+
+      double now = wallSeconds();
+      if ( deadline && now >= deadline ) break;
+      int64_t ahead = (int64_t)HAL::nowNs() - (int64_t)((now - start) * 1e9);
+      if ( ahead > (int64_t)AHEAD_NS ) {
+         struct pollfd p = { _master, (short)(POLLIN | (pending.empty() ? 0 : POLLOUT)), 0 };
+#if defined(__linux__)
+         struct timespec wait = { (time_t)(ahead / 1000000000), (long)(ahead % 1000000000) };
+         int ready = ppoll( &p, 1, &wait, nullptr );
+#else
+         int ready = poll( &p, 1, (int)(ahead / 1000000) );
+#endif
+         if ( ready > 0 && (p.revents & POLLHUP) ) connected = false;
+      }
+   }
+
+   HAL::drainSerial();
+   if ( record ) fflush( record );
+   if ( !quiet ) {
+      fprintf( stderr, "host closed after %.1fs, %llu bytes in, %llu out at %lu baud",
+               wallSeconds() - start, (unsigned long long)in, (unsigned long long)HAL::getBytesFromDevice(),
+               HAL::getBaud() );
+      if ( ignored ) fprintf( stderr, ", %llu ignored during setup()", (unsigned long long)ignored );
+      if ( lost ) fprintf( stderr, ", %llu lost unread", (unsigned long long)lost );
+      if ( damaged ) fprintf( stderr, ", %llu damaged on the way", (unsigned long long)damaged );
+      fprintf( stderr, "\n" );
+   }
+   return 0;
+}
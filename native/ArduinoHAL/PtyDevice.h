@@ -0,0 +1,57 @@
+/****************************************************************
+*  PtyDevice
+*  The native firmware behind a pseudo-terminal, so the Python client,
+*  shieldcap or anything else that opens a serial port can talk to it
+*  as it would to a board on /dev/ttyACM0.
+*
+*  The virtual clock is held to the wall clock: loop() runs as fast as
+*  it can until the firmware is ahead of real time, then sleeps until it
+*  isn't or the host sends something. The bytes still go through the
+*  modelled UART (see ArduinoHAL.h) so they come and go at the link
+*  speed the firmware has set, whatever the host asks the pty for.
+*
+*  Opening the port resets the board, as the DTR line does on an Uno:
+*  each connection runs in a fresh copy of the process (fork()) from
+*  setup(), with the boot message, and ends when the host closes the
+*  port. What the host sends before setup() is done (in virtual time,
+*  held to the wall clock) is thrown away, as it is by a real Uno still
+*  in its bootloader. Inputs attached beforehand carry over to each one.
+*
+*  setLinkErrors() makes the link as unreliable as a busy laptop's USB
+*  serial: that fraction of the bytes to the host is damaged on the way,
+*  half of them lost and half with a bit flipped.
+****************************************************************/
+#ifndef PtyDevice_h
+#define PtyDevice_h
+
+#include <stdint.h>
+#include <stdio.h>
+
+class PtyDevice {
+
+public:
+   PtyDevice();
+   ~PtyDevice();
+
+   // a new pty, its slave in raw mode, and a symlink to it if link isn't null
+   bool open( const char* link );
+   const char* name() const { return _name; }
+   // damage this fraction of the bytes sent to the host (0 for none)
+   void setLinkErrors( double rate, uint64_t seed );
+
+   // one connection after another until seconds of wall time (0 for ever)
+   // or a signal. Everything the firmware sends is copied to record too.
+   int serve( double seconds, FILE* record, bool quiet );
+
+private:
+   bool waitForHost( double deadline );
+   int  runBoard( double deadline, FILE* record, bool quiet );
+
+   int         _master;
+   char        _name[64];
+   const char* _link;
+   double      _errorRate;
+   uint64_t    _errorSeed;
+};
+
+#endif
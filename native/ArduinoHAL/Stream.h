@@ -0,0 +1,18 @@
+/****************************************************************
+*  Stream (native)
+*  The part of the Arduino Stream class the libraries use.
+****************************************************************/
+#ifndef Stream_h
+#define Stream_h
+
+#include "Print.h"
+
+class Stream : public Print {
+
+public:
+   virtual int available() = 0;
+   virtual int read() = 0;
+   virtual int peek() = 0;
+};
+
+#endif
@@ -0,0 +1,125 @@
+/****************************************************************
+*  Wire (native)
+*  I2C devices are plain memory behind a register pointer, see
+*  HAL::setI2CDevice(). At 100kHz each byte on the bus costs 90μs.
+****************************************************************/
+
+#include "Wire.h"
+#include "ArduinoHAL.h"
+#include <map>
+#include <vector>
+
+#define I2C_BYTE_NS 90000   // 9 clocks at 100kHz
+
+namespace {
+
+struct Device {
+   std::vector<uint8_t> memory;
+   size_t               pointer;
+};
+
+// built on first use, HAL::reset() runs before main()
+std::map<uint8_t, Device>& devices() {
+   static std::map<uint8_t, Device> bus;
+   return bus;
+}
+
+}  // namespace
+
+namespace HAL {
+   void resetI2C() { devices().clear(); }
+};
+
+void
+HAL::setI2CDevice( uint8_t address, const uint8_t* memory, size_t size ) {
+   Device& d = devices()[address];
+   d.memory.assign( memory, memory + size );
+   d.pointer = 0;
+}
+
+void
+HAL::removeI2CDevice( uint8_t address ) {
+   devices().erase( address );
+}
+
+TwoWire Wire;
+
+TwoWire::TwoWire() : _address( 0 ), _txLen( 0 ), _rxLen( 0 ), _rxPos( 0 ) {
+}
+
+void
+TwoWire::begin() {
+   _txLen = _rxLen = _rxPos = 0;
+}
+
+void
+TwoWire::end() {
+}
+
+void
+TwoWire::beginTransmission( uint8_t address ) {
+   _address = address;
+   _txLen = 0;
+}
+
+size_t
+TwoWire::write( uint8_t c ) {
+   if ( _txLen >= BUFFER_LENGTH ) return 0;
+   _txBuf[_txLen++] = c;
+   return 1;
+}
+
+size_t
+TwoWire::write( const uint8_t* data, size_t quantity ) {
+   size_t n = 0;
+   while ( n < quantity && write( data[n] ) ) n++;
+   return n;
+}
+
+/**
+ * The first byte moves the device's pointer, the rest are stored from there
+ **/
+uint8_t
+TwoWire::endTransmission( bool ) {
+   HAL::advance( (uint64_t)(_txLen + 1) * I2C_BYTE_NS );
+   auto found = devices().find( _address );
+   if ( found == devices().end() ) return 2;
+   Device& d = found->second;
+   if ( _txLen > 0 ) d.pointer = _txBuf[0];
+   for ( uint8_t i = 1; i < _txLen; i++ ) {
+      if ( d.pointer < d.memory.size() ) d.memory[d.pointer] = _txBuf[i];
+      d.pointer++;
+   }
+   _txLen = 0;
+   return 0;
+}
+
+uint8_t
+TwoWire::requestFrom( uint8_t address, uint8_t quantity, bool ) {
+   if ( quantity > BUFFER_LENGTH ) quantity = BUFFER_LENGTH;
+   _rxLen = _rxPos = 0;
+   HAL::advance( (uint64_t)(quantity + 1) * I2C_BYTE_NS );
+   auto found = devices().find( address );
+   if ( found == devices().end() ) return 0;
+   Device& d = found->second;
+   while ( _rxLen < quantity ) {
+      _rxBuf[_rxLen++] = d.pointer < d.memory.size() ? d.memory[d.pointer] : 0xFF;
+      d.pointer++;
+   }
+   return _rxLen;
+}
+
+int
+TwoWire::available() {
+   return _rxLen - _rxPos;
+}
+
+int
+TwoWire::read() {
+   return _rxPos < _rxLen ? _rxBuf[_rxPos++] : -1;
+}
+
+int
+TwoWire::peek() {
+   return _rxPos < _rxLen ? _rxBuf[_rxPos] : -1;
+}
@@ -0,0 +1,49 @@
+/****************************************************************
+*  Wire (native)
+*  The I2C master the AutoID code uses. The devices on the bus are set
+*  up with HAL::setI2CDevice().
+****************************************************************/
+#ifndef TwoWire_h
+#define TwoWire_h
+
+#include "Stream.h"
+
+#define BUFFER_LENGTH 32
+
+class TwoWire : public Stream {
+
+public:
+   TwoWire();
+
+   void    begin();
+   void    end();
+   void    setClock( uint32_t ) {}
+   void    beginTransmission( uint8_t address );
+   void    beginTransmission( int address ) { beginTransmission( (uint8_t)address ); }
+   uint8_t endTransmission( bool sendStop=true );   // 0 ok, 2 no device at the address
+   uint8_t requestFrom( uint8_t address, uint8_t quantity, bool sendStop=true );
+   uint8_t requestFrom( int address, int quantity ) { return requestFrom( (uint8_t)address, (uint8_t)quantity ); }
+
+   virtual size_t write( uint8_t c );
+   virtual size_t write( const uint8_t* data, size_t quantity );
+   virtual int    available();
+   virtual int    read();
+   virtual int    peek();
+   inline size_t write( unsigned long n ) { return write( (uint8_t)n ); }
+   inline size_t write( long n ) { return write( (uint8_t)n ); }
+   inline size_t write( unsigned int n ) { return write( (uint8_t)n ); }
+   inline size_t write( int n ) { return write( (uint8_t)n ); }
+   using Print::write;
+
+private:
+   uint8_t _address;
+   uint8_t _txBuf[BUFFER_LENGTH];
+   uint8_t _txLen;
+   uint8_t _rxBuf[BUFFER_LENGTH];
+   uint8_t _rxLen;
+   uint8_t _rxPos;
+};
+
+extern TwoWire Wire;
+
+#endif
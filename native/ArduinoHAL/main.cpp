@@ -0,0 +1,167 @@
+/****************************************************************
+*  main (native)
+*  Runs the sketch on the virtual Uno: setup() once, then loop() until
+*  the virtual time is up or something calls HAL::stop().
+*
+*  usage: program [-t seconds] [-c "hex bytes"]... [-i pin=signal]... [-S seed] [-o file] [-q]
+*         program -p [-l link] [-e rate] [-t seconds] [-i pin=signal]... [-S seed] [-o file] [-q]
+*     -t  virtual seconds to run, default 10 (with -p real seconds, default for ever)
+*     -c  bytes sent to the firmware once setup() has run, e.g. -c d0
+*         -c "85 0c" (repeatable, sent in order at the link speed)
+*     -i  drive an input from a synthetic source (see Signals.h), e.g.
+*         -i A0=sine:1,2,2.5 -i D2=pendulum:2,0.02 (repeatable)
+*     -S  seed for the noisy sources, default 1
+*     -o  write everything the firmware sends to a file
+*     -q  no summary
+*     -p  run in real time behind a pseudo-terminal instead (see PtyDevice.h),
+*         its name goes to stdout
+*     -l  and make a symlink to it, e.g. -l /tmp/ttyShield
+*     -e  damage that fraction of the bytes to the host, e.g. -e 1e-4
+*         (half lost, half with a bit flipped, seeded by -S)
+*  The summary on stderr gives the virtual time, the passes of loop(),
+*  the bytes sent and how long it took for real.
+****************************************************************/
+
+#include "Arduino.h"
+#include "ArduinoHAL.h"
+#include "PtyDevice.h"
+#include "Signals.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+static bool parseHex( const char* arg, std::vector<uint8_t>& out ) {
+   while ( *arg ) {
+      if ( *arg == ' ' || *arg == ',' ) {
+         arg++;
+         continue;
+      }
+      char* end;
+      unsigned long v = strtoul( arg, &end, 16 );
+      if ( end == arg || v > 0xFF ) return false;
+      out.push_back( (uint8_t)v );
+      arg = end;
+   }
+   return true;
+}
+
+/**
+ * "A0=sine:1,2,2.5" onto the pin. A1 and A3 are the BTA ±10V inputs,
+ * the other analog pins 0..5V, anything else a digital level.
+ **/
+static bool attachInput( const char* arg, uint64_t seed ) {
+   const char* eq = strchr( arg, '=' );
+   if ( !eq ) return false;
+   int pin;
+   char* end;
+   if ( arg[0] == 'A' ) pin = A0 + strtol( arg + 1, &end, 10 );
+   else pin = strtol( arg[0] == 'D' ? arg + 1 : arg, &end, 10 );
+   if ( end != eq || pin < 0 || pin >= NUM_DIGITAL_PINS ) return false;
+
+   SIGNALS::Wave wave = SIGNALS::parse( eq + 1, seed );
+   if ( !wave ) return false;
+   if ( pin == A1 || pin == A3 ) HAL::setAnalog( pin, SIGNALS::analog10V( wave ) );
+   else if ( pin >= A0 ) HAL::setAnalog( pin, SIGNALS::analog5V( wave ) );
+   else HAL::setDigital( pin, SIGNALS::digital( wave ) );
+   return true;
+}
+
+static double wallSeconds() {
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main( int argc, char** argv ) {
+   double seconds = 10;
+   std::vector<uint8_t> commands;
+   std::vector<const char*> inputs;
+   uint64_t seed = 1;
+   const char* output = nullptr;
+   bool quiet = false;
+   bool pty = false;
+   bool timed = false;
+   const char* link = nullptr;
+   double errors = 0;
+
+   int opt;
+   while ( (opt = getopt( argc, argv, "t:c:i:S:o:qpl:e:" )) != -1 ) {
+      switch ( opt ) {
+         case 't': seconds = atof( optarg ); timed = true; break;
+         case 'c':
+            if ( !parseHex( optarg, commands ) ) {
+               fprintf( stderr, "%s: bad command bytes '%s'\n", argv[0], optarg );
+               return 2;
+            }
+            break;
+         case 'i': inputs.push_back( optarg ); break;
+         case 'S': seed = strtoull( optarg, nullptr, 0 ); break;
+         case 'o': output = optarg; break;
+         case 'q': quiet = true; break;
+         case 'p': pty = true; break;
+         case 'l': link = optarg; pty = true; break;
+         case 'e': errors = atof( optarg ); pty = true; break;
+         default:
+            fprintf( stderr, "usage: %s [-t seconds] [-c \"hex bytes\"]... [-i pin=signal]... [-S seed] [-o file] [-q]\n", argv[0] );
+            fprintf( stderr, "       %s -p [-l link] [-e rate] [-t seconds] [-i pin=signal]... [-S seed] [-o file] [-q]\n", argv[0] );
+            return 2;
+      }
+   }
+   if ( pty && !commands.empty() ) {
+      fprintf( stderr, "%s: -c doesn't go with -p, the host sends the commands\n", argv[0] );
+      return 2;
+   }
+
+   for ( const char* in : inputs ) {
+      if ( !attachInput( in, seed ) ) {
+         fprintf( stderr, "%s: bad input '%s'\n", argv[0], in );
+         return 2;
+      }
+   }
+
+   FILE* out = nullptr;
+   if ( output ) {
+      out = fopen( output, "wb" );
+      if ( !out ) {
+         perror( output );
+         return 1;
+      }
+      HAL::setSerialSink( [out]( const uint8_t* data, size_t len ) { fwrite( data, 1, len, out ); } );
+   }
+
+   if ( pty ) {
+      PtyDevice device;
+      if ( !device.open( link ) ) return 1;
+      device.setLinkErrors( errors, seed );
+      printf( "%s\n", device.name() );
+      fflush( stdout );
+      int result = device.serve( timed ? seconds : 0, out, quiet );
+      if ( out ) fclose( out );
+      return result;
+   }
+
+   double start = wallSeconds();
+   uint64_t end = (uint64_t)(seconds * 1e9);
+   uint64_t passes = 0;
+
+   setup();
+   if ( !commands.empty() ) HAL::sendToDevice( commands.data(), commands.size() );
+   while ( !HAL::stopped() && HAL::nowNs() < end ) {
+      loop();
+      HAL::advance( HAL::costs().loop );
+      passes++;
+   }
+   HAL::drainSerial();
+
+   double wall = wallSeconds() - start;
+   if ( out ) fclose( out );
+   if ( !quiet ) {
+      double virt = HAL::nowNs() / 1e9;
+      fprintf( stderr, "%.3fs virtual in %.3fs (x%.0f), %llu passes of loop() (%.1fμs each), %llu bytes out at %lu baud\n",
+               virt, wall, wall > 0 ? virt / wall : 0.0, (unsigned long long)passes,
+               passes ? virt * 1e6 / passes : 0.0, (unsigned long long)HAL::getBytesFromDevice(), HAL::getBaud() );
+   }
+   return 0;
+}
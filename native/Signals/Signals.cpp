@@ -0,0 +1,250 @@
+/****************************************************************
+*  Signals
+*  Synthetic input sources, see Signals.h
+****************************************************************/
+
+#include "Signals.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace {
+
+/**
+ * splitmix64, a good 64 bit mix. Random numbers are a hash of the seed
+ * and an index (a time slot or a pass of the pendulum) so they come out
+ * the same whatever order they are asked for in.
+ **/
+uint64_t mix( uint64_t x ) {
+   x += 0x9E3779B97F4A7C15ull;
+   x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+   x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+   return x ^ (x >> 31);
+}
+
+// (0, 1]
+double uniform( uint64_t seed, uint64_t i ) {
+   return ((mix( seed ^ mix( i ) ) >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+// standard normal (Box-Muller)
+double gaussian( uint64_t seed, int64_t i ) {
+   double u1 = uniform( seed, 2 * (uint64_t)i );
+   double u2 = uniform( seed, 2 * (uint64_t)i + 1 );
+   return sqrt( -2.0 * log( u1 ) ) * cos( 2.0 * M_PI * u2 );
+}
+
+int toCounts( double pinVolts ) {
+   double c = floor( pinVolts * 1024.0 / 5.0 );   // as the ADC: Vin * 1024 / Vref
+   return c < 0 ? 0 : c > 1023 ? 1023 : (int)c;
+}
+
+// Steinhart-Hart for the Vernier stainless probe, as VernierThermistor
+const double SH_A = 0.00102119;
+const double SH_B = 0.000222468;
+const double SH_C = 0.000000133342;
+const double DIVIDER = 15000.0;   // Ω, from the input to 5V
+
+/**
+ * Thermistor resistance at a temperature: the cubic in ln R solved
+ * with Cardano (it has one real root)
+ **/
+double thermistorOhms( double celsius ) {
+   double p = SH_B / SH_C;
+   double q = (SH_A - 1.0 / (celsius + 273.15)) / SH_C;
+   double s = sqrt( q * q / 4 + p * p * p / 27 );
+   return exp( cbrt( -q / 2 + s ) + cbrt( -q / 2 - s ) );
+}
+
+}  // namespace
+
+SIGNALS::Wave
+SIGNALS::constant( double v ) {
+   return [v]( double ) { return v; };
+}
+
+SIGNALS::Wave
+SIGNALS::sine( double amplitude, double hz, double offset, double phase ) {
+   double rad = phase * M_PI / 180;
+   return [=]( double t ) { return offset + amplitude * sin( 2 * M_PI * hz * t + rad ); };
+}
+
+SIGNALS::Wave
+SIGNALS::step( double before, double after, double at ) {
+   return [=]( double t ) { return t < at ? before : after; };
+}
+
+SIGNALS::Wave
+SIGNALS::ramp( double from, double to, double start, double duration ) {
+   return [=]( double t ) {
+      if ( t <= start ) return from;
+      if ( t >= start + duration ) return to;
+      return from + (to - from) * (t - start) / duration;
+   };
+}
+
+SIGNALS::Wave
+SIGNALS::square( double low, double high, double hz, double duty ) {
+   return [=]( double t ) {
+      double cycle = t * hz;
+      return cycle - floor( cycle ) < duty ? high : low;
+   };
+}
+
+SIGNALS::Wave
+SIGNALS::cooling( double fromC, double ambientC, double tau, double start ) {
+   return [=]( double t ) {
+      double c = t < start ? fromC : ambientC + (fromC - ambientC) * exp( -(t - start) / tau );
+      double r = thermistorOhms( c );
+      return 5.0 * r / (r + DIVIDER);
+   };
+}
+
+SIGNALS::Wave
+SIGNALS::noise( Wave base, double sigma, uint64_t seed, double hz ) {
+   return [=]( double t ) { return base( t ) + sigma * gaussian( seed, (int64_t)floor( t * hz ) ); };
+}
+
+/**
+ * Released from the top of the swing at t = 0 so the first pass is a
+ * quarter period in
+ **/
+SIGNALS::Wave
+SIGNALS::pendulum( double period, double blocked, double jitter, uint64_t seed ) {
+   return [=]( double t ) {
+      double half = period / 2;
+      int64_t k = llround( (t - period / 4) / half );
+      for ( int64_t j = k - 1; j <= k + 1; j++ ) {
+         double pass = period / 4 + j * half;
+         if ( jitter > 0 ) pass += jitter * gaussian( seed, j );
+         if ( fabs( t - pass ) < blocked / 2 ) return 0.0;
+      }
+      return 1.0;
+   };
+}
+
+SIGNALS::Wave
+SIGNALS::picketFence( double start, double spacing, double band, int bands, double v0, double g ) {
+   return [=]( double t ) {
+      if ( t < start ) return 1.0;
+      double dt = t - start;
+      double x = v0 * dt + g * dt * dt / 2;   // how far the fence has fallen past the beam
+      double i = floor( x / spacing );
+      return i < bands && x - i * spacing < band ? 0.0 : 1.0;
+   };
+}
+
+SIGNALS::Wave
+SIGNALS::quadrature( double countsPerRev, double revPerSec, int channel ) {
+   return [=]( double t ) {
+      double c = countsPerRev * revPerSec * t - 0.25 * channel;
+      return c - floor( c ) < 0.5 ? 1.0 : 0.0;
+   };
+}
+
+SIGNALS::Pin
+SIGNALS::analog5V( Wave volts ) {
+   return [volts]( uint64_t ns ) { return toCounts( volts( ns * 1e-9 ) ); };
+}
+
+SIGNALS::Pin
+SIGNALS::analog10V( Wave volts ) {
+   return [volts]( uint64_t ns ) { return toCounts( 2.5 + volts( ns * 1e-9 ) / 4 ); };
+}
+
+SIGNALS::Pin
+SIGNALS::digital( Wave level ) {
+   return [level]( uint64_t ns ) { return level( ns * 1e-9 ) >= 0.5 ? 1 : 0; };
+}
+
+/**
+ * name:arg,arg...[~sigma]
+ *    const:v                      sine:amplitude,hz,offset[,phase]
+ *    step:before,after,at         ramp:from,to,start,duration
+ *    square:low,high,hz[,duty]    cooling:fromC,ambientC,tau[,start]
+ *    pendulum:period,blocked[,jitter]
+ *    picket:start,spacing,band,bands[,v0]
+ *    quadA:counts/rev,rev/s       quadB:counts/rev,rev/s
+ * ~sigma adds gaussian noise (volts)
+ **/
+SIGNALS::Wave
+SIGNALS::parse( const char* spec, uint64_t seed ) {
+   const char* colon = strchr( spec, ':' );
+   if ( !colon ) return Wave();
+   size_t nameLen = colon - spec;
+
+   double a[6];
+   int n = 0;
+   const char* p = colon + 1;
+   while ( n < 6 ) {
+      char* end;
+      a[n] = strtod( p, &end );
+      if ( end == p ) return Wave();
+      n++;
+      p = end;
+      if ( *p != ',' ) break;
+      p++;
+   }
+   double sigma = 0;
+   if ( *p == '~' ) {
+      char* end;
+      sigma = strtod( p + 1, &end );
+      if ( end == p + 1 ) return Wave();
+      p = end;
+   }
+   if ( *p ) return Wave();
+
+   struct Shape { const char* name; int min, max; };
+   static const Shape SHAPES[] = {
+      { "const", 1, 1 }, { "sine", 3, 4 }, { "step", 3, 3 }, { "ramp", 4, 4 }, { "square", 3, 4 },
+      { "cooling", 3, 4 }, { "pendulum", 2, 3 }, { "picket", 4, 5 }, { "quadA", 2, 2 }, { "quadB", 2, 2 },
+   };
+   int shape = -1;
+   for ( size_t i = 0; i < sizeof(SHAPES) / sizeof(SHAPES[0]); i++ )
+      if ( strlen( SHAPES[i].name ) == nameLen && !strncmp( spec, SHAPES[i].name, nameLen ) ) shape = i;
+   if ( shape < 0 || n < SHAPES[shape].min || n > SHAPES[shape].max ) return Wave();
+
+   Wave w;
+   switch ( shape ) {
+      case 0: w = constant( a[0] ); break;
+      case 1: w = sine( a[0], a[1], a[2], n > 3 ? a[3] : 0 ); break;
+      case 2: w = step( a[0], a[1], a[2] ); break;
+      case 3: w = ramp( a[0], a[1], a[2], a[3] ); break;
+      case 4: w = square( a[0], a[1], a[2], n > 3 ? a[3] : 0.5 ); break;
+      case 5: w = cooling( a[0], a[1], a[2], n > 3 ? a[3] : 0 ); break;
+      case 6: w = pendulum( a[0], a[1], n > 2 ? a[2] : 0, seed ); break;
+      case 7: w = picketFence( a[0], a[1], a[2], (int)a[3], n > 4 ? a[4] : 0 ); break;
+      case 8: w = quadrature( a[0], a[1], 0 ); break;
+      case 9: w = quadrature( a[0], a[1], 1 ); break;
+   }
+   // noise gets its own stream so adding it doesn't change the pendulum's jitter
+   if ( sigma > 0 ) w = noise( w, sigma, mix( seed + 1 ) );
+   return w;
+}
+
+/**
+ * Step through at resolution, then halve the step down to 1ns around
+ * each change. Two changes closer together than resolution are missed.
+ **/
+std::vector<double>
+SIGNALS::edges( const Wave& level, double from, double to, double resolution ) {
+   std::vector<double> out;
+   bool last = level( from ) >= 0.5;
+   for ( double t = from; t < to; ) {
+      double next = t + resolution < to ? t + resolution : to;
+      bool now = level( next ) >= 0.5;
+      if ( now != last ) {
+         double lo = t;
+         double hi = next;
+         while ( hi - lo > 1e-9 ) {
+            double mid = (lo + hi) / 2;
+            if ( (level( mid ) >= 0.5) == now ) hi = mid;
+            else lo = mid;
+         }
+         out.push_back( hi );
+         last = now;
+      }
+      t = next;
+   }
+   return out;
+}
@@ -0,0 +1,73 @@
+/****************************************************************
+*  Signals
+*  Synthetic sources for the simulated BTA/BTD inputs, so triggers,
+*  gate timing and throughput can be checked without a probe wired up
+*  and against a known answer.
+*
+*  A Wave is a quantity over time: volts for the analog shapes, 1 (open)
+*  or 0 (blocked) for the gate shapes. analog5V(), analog10V() and
+*  digital() turn one into what a pin reads at a time in ns, which is
+*  what HAL::setAnalog()/HAL::setDigital() take. shieldbench drives
+*  simavr's pins from the same functions.
+*
+*  Everything is a pure function of the time and the seed: no state is
+*  kept between calls, so the firmware can read a pin as often or as
+*  rarely as it likes and the same seed always gives the same run.
+*
+*     HAL::setAnalog( A0, SIGNALS::analog5V( SIGNALS::noise( SIGNALS::sine( 1, 2, 2.5 ), 0.01, 42 ) ) );
+*     HAL::setDigital( 2, SIGNALS::digital( SIGNALS::pendulum( 2.0, 0.02 ) ) );
+*
+*  parse() builds the same from a short text spec (see native/readme.md)
+*  for the -i options of the native build and shieldbench.
+****************************************************************/
+#ifndef Signals_h
+#define Signals_h
+
+#include <stdint.h>
+#include <functional>
+#include <vector>
+
+namespace SIGNALS {
+
+   // a quantity at t seconds since the start of the run
+   typedef std::function<double( double t )> Wave;
+   // what a pin reads at a time in ns, the same as HAL::Signal
+   typedef std::function<int( uint64_t ns )> Pin;
+
+   // analog shapes, in volts
+   Wave constant( double v );
+   Wave sine( double amplitude, double hz, double offset, double phase = 0 );   // phase in degrees
+   Wave step( double before, double after, double at );
+   Wave ramp( double from, double to, double start, double duration );        // holds before and after
+   Wave square( double low, double high, double hz, double duty = 0.5 );
+   // a stainless temperature probe (Vernier TMP-BTA) in water cooling from
+   // fromC towards ambientC with time constant tau, as the voltage its 15K
+   // divider gives (see VernierThermistor::applyCalibration)
+   Wave cooling( double fromC, double ambientC, double tau, double start = 0 );
+   // gaussian noise with sd sigma on top of base, a new value every 1/hz s
+   Wave noise( Wave base, double sigma, uint64_t seed, double hz = 10000 );
+
+   // gate shapes, 1 open, 0 blocked
+   // a pendulum bob through a gate at the bottom of its swing: blocked for
+   // `blocked` s around t = k*period/2, each pass moved by gaussian jitter (sd, s)
+   Wave pendulum( double period, double blocked, double jitter = 0, uint64_t seed = 0 );
+   // a picket fence dropped through a gate at `start`: `bands` opaque bands
+   // `band` m wide every `spacing` m, the leading edge at the beam moving at v0
+   Wave picketFence( double start, double spacing, double band, int bands, double v0 = 0, double g = 9.81 );
+   // a quadrature encoder turning at revPerSec, channel 0 is A, 1 is B (90° behind)
+   Wave quadrature( double countsPerRev, double revPerSec, int channel );
+
+   // onto a pin
+   Pin analog5V( Wave volts );    // 0..5V -> 0..1023 (BTA pin 6, A0 and A2)
+   Pin analog10V( Wave volts );   // ±10V  -> 0..1023 (BTA pin 1, A1 and A3)
+   Pin digital( Wave level );     // HIGH at 0.5 and above
+
+   // "sine:1,2,2.5~0.01" -> the Wave, an empty one if the spec is bad
+   Wave parse( const char* spec, uint64_t seed );
+
+   // the times in [from, to) where the level of a gate shape changes,
+   // to the ns. The ground truth for timing tests.
+   std::vector<double> edges( const Wave& level, double from, double to, double resolution = 1e-5 );
+};
+
+#endif
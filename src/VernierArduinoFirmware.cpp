@@ -45,6 +45,10 @@
 #include <VernierDigitalSensor.h>
 #include <VernierAnalogSensor.h>
 #include <VernierBlinker.h>
+#include <ShieldSensors.h>
+#include <ShieldBench.h>
+#include <ShieldStats.h>
+#include <ShieldTrace.h>
 
 /**
  * ShieldControl shield objects
@@ -58,290 +62,533 @@
 VernierBlinker theLED;
 VernierButton theBtn;
 
-// DA Sensor Objects
-VernierDigitalSensor dig1(VernierDigitalSensor::BTD01);
-VernierDigitalSensor dig2(VernierDigitalSensor::BTD02);
-VernierAnalogSensor ana105(VernierAnalogSensor::BTA01_5V);
-VernierAnalogSensor ana110(VernierAnalogSensor::BTA01_10V);
-VernierAnalogSensor ana205(VernierAnalogSensor::BTA02_5V);
-VernierAnalogSensor ana210(VernierAnalogSensor::BTA02_10V);
+// DA Sensor Objects, their pins fixed at compile time so the polls and
+// reads go straight to the port and ADC registers
+VernierDigitalSensorT<VernierDigitalSensor::BTD01> dig1;
+VernierDigitalSensorT<VernierDigitalSensor::BTD02> dig2;
+VernierAnalogSensorT<VernierAnalogSensor::BTA01_5V> ana105;
+VernierAnalogSensorT<VernierAnalogSensor::BTA01_10V> ana110;
+VernierAnalogSensorT<VernierAnalogSensor::BTA02_5V> ana205;
+VernierAnalogSensorT<VernierAnalogSensor::BTA02_10V> ana210;
 
 ShieldCommunication comm;
 
+/**
+ * pollPort() with its cost going into the stats
+ */
+template<class PORT, class... ARGS> inline bool polled( PORT& port, int src, ARGS&... args ) {
+        uint16_t start = ShieldStats::ticks();
+        bool fired = port.pollPort( args... );
+        Stats.poll( src, start );
+        return fired;
+}
+
+/**
+ * The ports for the registry (ShieldSensors). Each one's poll function
+ * sends what its pollPort() took and says whether it is still armed,
+ * the read function is the immediate read. Both are made for the port's
+ * own class so its pins stay fixed at compile time. The table is the
+ * order they are polled in, the gates first.
+ */
+template<class PORT, PORT& port, int SRC> bool pollAnalog( DigitalSnapshot& ) {
+        if( polled( port, SRC ) ) {
+                comm.sendDataBlob(port.getCount(), port.getAbsTime(), port.getLastRead(), SRC);
+        }
+        return port.getState()!=STATE::TS_HALT;
+}
+
+template<class PORT, PORT& port, int SRC> bool pollDigital( DigitalSnapshot& gates ) {
+        if( polled( port, SRC, gates ) ) {  // a bit test unless it changed
+                comm.sendDigitalEvent(port.getCount(), port.getAbsTime(), port.getDeltaTime(), port.getTransitionType(), SRC);
+        }
+        return port.isArmed();
+}
+
+template<class PORT, PORT& port> int readNow() {
+        return port.readPort();
+}
+
+#define ANALOG_PORT( port, src, key )  { src, &port, nullptr, pollAnalog<decltype(port), port, src>, readNow<decltype(port), port>, key }
+#define DIGITAL_PORT( port, src, key ) { src, nullptr, &port, pollDigital<decltype(port), port, src>, readNow<decltype(port), port>, key }
+
+const char KEY_BTD01[] PROGMEM     = "\"BTD01\":";
+const char KEY_BTD02[] PROGMEM     = "\"BTD02\":";
+const char KEY_BTA01_5V[] PROGMEM  = "\"BTA01_5V\":";
+const char KEY_BTA02_5V[] PROGMEM  = "\"BTA02_5V\":";
+const char KEY_BTA01_10V[] PROGMEM = "\"BTA01_10V\":";
+const char KEY_BTA02_10V[] PROGMEM = "\"BTA02_10V\":";
+
+const PortEntry PORTS[] PROGMEM = {
+        DIGITAL_PORT( dig1,   SOURCES::DIG1,   KEY_BTD01 ),
+        DIGITAL_PORT( dig2,   SOURCES::DIG2,   KEY_BTD02 ),
+        ANALOG_PORT(  ana105, SOURCES::ANA105, KEY_BTA01_5V ),
+        ANALOG_PORT(  ana205, SOURCES::ANA205, KEY_BTA02_5V ),
+        ANALOG_PORT(  ana110, SOURCES::ANA110, KEY_BTA01_10V ),
+        ANALOG_PORT(  ana210, SOURCES::ANA210, KEY_BTA02_10V ),
+};
+
+// polled on their own so commands are checked again after at most two analog reads
+const uint8_t FIRST_PORTS = bit(SOURCES::ANA105-1) | bit(SOURCES::ANA205-1);
+
 const char BOOT_MSG[] = "*HELLO*";
 const char MAJOR_REV[] = "1";
-const char MINOR_REV[] = "03";
+const char MINOR_REV[] = "04";
 
 /**
  * Synchronize clocks.  This makes sure that the inputs share 
  * the same starting point. Is this perfect? No. but it is 
- * close enough.  We also zero the data count while we are at it.
+ * close enough.
  */
-uint32_t dataCount = 0;
+unsigned long syncMicros = 0L;  // micros() at the last SYNC, the zero of every timestamp
+
+// time beacons (see checkBeacon)
+unsigned int  clockWraps = 0;     // times micros()-syncMicros has wrapped
+unsigned long lastClock = 0L;     // micros()-syncMicros the last time we looked
+unsigned long lastBeacon = 0L;    // millis() the last beacon went out
+char          beaconMask = -1;    // ports in the last beacon, -1 sends one straight away
 
 void syncClocks() {
-        dataCount = 0L;
         unsigned long matchClocks = micros();
-        dig1.sync(matchClocks);
-        dig2.sync(matchClocks);
-        ana105.sync(matchClocks);
-        ana110.sync(matchClocks);
-        ana205.sync(matchClocks);
-        ana210.sync(matchClocks);
+        syncMicros = matchClocks;
+        Sensors.sync(matchClocks);
         theBtn.sync(matchClocks);
+        comm.resetEventAnchors();
+        comm.clearDropped();
+        clockWraps = 0;
+        lastClock = 0L;
+        beaconMask = -1;
 }
 
-
 /**
- * Setup the Arduino before we enter the endless loop
+ * Keep count of the clock wraps and send a beacon with the wraps and the
+ * counts of the armed ports every BEACON::ARMED_MS while anything is armed
+ * (every BEACON::IDLE_MS otherwise) and straight away when the set of armed
+ * ports changes. Called once a pass from loop() after the ports are polled
+ * so the counts match the last blobs sent.
  */
-void setup() {
-        Serial.begin(4*115200);  // We are talking over USB. 115200  We may be able to push this up to 1E6
-        theLED.setBlinkPeriod(200);
-        theLED.blinkFor(3);
-        syncClocks();
-        Serial << BOOT_MSG << " ver:" << MAJOR_REV << "." << MINOR_REV << endl; // send boot message
+void checkBeacon() {
+        BENCH_SCOPE( BENCH::BEACON );
+        unsigned long now = micros() - syncMicros;
+        if ( now < lastClock ) clockWraps++;
+        lastClock = now;
+
+        char mask = Sensors.getArmed();
+        unsigned long period = mask ? BEACON::ARMED_MS : BEACON::IDLE_MS;
+        if ( mask==beaconMask && millis()-lastBeacon < period ) return;
+
+        unsigned long counts[8] = {0};
+        for ( uint8_t src = Sensors.next( 0xFF ); src; src = Sensors.next( 0xFF, src ) )
+                counts[src] = Sensors.getCount( src );
+        if ( comm.sendBeacon( mask, clockWraps, now, counts ) ) {
+                lastBeacon = millis();
+                beaconMask = mask;
+        }
 }
 
-// this turns the SOURCES index into a bit to test
-#define SRC_BITLOC(src) (1<<(src-1))
+
 
 /**
- * Run the loop repeatedly
+ * MDE_CONFIG: set up every port in one go. The whole frame is checked
+ * and staged first, if anything is wrong nothing is touched. Then all
+ * the ports are halted, configured and (optionally) synced and armed
+ * together so no port ever runs under a half applied setup.
  */
-void loop() {
-
-        // Poll the ports first. Many of these calls take next to no time if the port is flagged as HALTed
-        if( ana105.pollPort() ) {  // Only takes <~4μS if off
-                comm.sendDataBlob(ana105.getCount(), ana105.getAbsTime(), ana105.getLastRead(), SOURCES::ANA105);
+struct AnalogSetup {
+        bool    used;
+        char    rate;
+        int     stop;
+        int     trigType;
+        int     trigLevel;
+};
+
+bool configureExperiment( const uint8_t* cfg, int len ) {
+        if ( len < 2 ) return false;
+        int  flags = cfg[0];
+        char armMask = cfg[1];
+        AnalogSetup ana[4] = {};          // ANA105, ANA205, ANA110, ANA210
+        int  dig[2] = { -1, -1 };         // DIG1, DIG2, -1 leave alone
+
+        // check and stage
+        for ( int i=2; i<len; ) {
+                int src = cfg[i];
+                if ( src>=SOURCES::ANA105 && src<=SOURCES::ANA210 ) {
+                        if ( i+6 > len ) return false;
+                        AnalogSetup& a = ana[src-SOURCES::ANA105];
+                        a.used = true;
+                        a.rate = cfg[i+1];
+                        a.stop = (cfg[i+2]<<7) + cfg[i+3];
+                        int trig = (cfg[i+4]<<7) + cfg[i+5];
+                        a.trigType = (trig>>12)&0x3;
+                        a.trigLevel = trig&0x3FF;
+                        if ( a.rate>=16 || a.trigType>ATRIGCOND::TS_RISE_ABOVE ) return false;
+                        i += 6;
+                } else if ( src==SOURCES::DIG1 || src==SOURCES::DIG2 ) {
+                        if ( i+2 > len ) return false;
+                        dig[src-SOURCES::DIG1] = cfg[i+1];
+                        if ( cfg[i+1] > DTRIGCOND::ANY ) return false;
+                        i += 2;
+                } else
+                        return false;
         }
-        if( ana205.pollPort() ) {  // Only takes <~4μS
-                comm.sendDataBlob(ana205.getCount(), ana205.getAbsTime(), ana205.getLastRead(), SOURCES::ANA205);
-        }
-        if( ana110.pollPort() ) {  // Only takes <~4μS
-                comm.sendDataBlob(ana110.getCount(), ana110.getAbsTime(), ana110.getLastRead(), SOURCES::ANA110);
-        }
-        if( ana210.pollPort() ) {  // Only takes <~4μS
-                comm.sendDataBlob(ana210.getCount(), ana210.getAbsTime(), ana210.getLastRead(), SOURCES::ANA210);
+
+        // apply
+        Sensors.halt();
+        for ( uint8_t src = Sensors.next( Sensors.getAnalog() ); src; src = Sensors.next( Sensors.getAnalog(), src ) ) {
+                AnalogSetup& a = ana[src-SOURCES::ANA105];
+                if ( !a.used ) continue;
+                VernierAnalogSensor* port = Sensors.analog( src );
+                port->setSampleRate( a.rate );
+                port->setStopCondition( a.stop );
+                port->setTrigger( a.trigType, a.trigLevel );
         }
-        if( dig1.pollPort() ) {  // Only takes <~4μS
-                comm.sendDataBlob(dig1.getCount(), dig1.getDeltaTime(), dig1.getTransitionType(), SOURCES::DIG1);
+        for ( uint8_t src = Sensors.next( Sensors.getDigital() ); src; src = Sensors.next( Sensors.getDigital(), src ) ) {
+                if ( dig[src-SOURCES::DIG1]>=0 ) Sensors.digital( src )->setTrigger( dig[src-SOURCES::DIG1] );
         }
-        if( dig2.pollPort() ) {  // Only takes <~4μS
-                comm.sendDataBlob(dig2.getCount(), dig2.getDeltaTime(), dig2.getTransitionType(), SOURCES::DIG2);
+        comm.setEventEncoding( flags & EXTCMD::F_COMPACT ? DEVENTENC::COMPACT : DEVENTENC::BLOB );
+        if ( flags & EXTCMD::F_SYNC ) syncClocks();
+        if ( flags & EXTCMD::F_ARM ) {
+                Sensors.arm( armMask );
+                comm.resetEventAnchors();
         }
+        return true;
+}
 
+/**
+ * Binary status records for ST_PORTSB
+ */
+void sendAnalogStatus( VernierAnalogSensor& port, int src ) {
+        ShieldStatusRecord rec( src );
+        rec.add( STATUSTAG::STATE, port.getState(), 1 );
+        rec.add( STATUSTAG::PERIOD, port.getRate(), 4 );
+        rec.add( STATUSTAG::TRIGGER, port.getCond(), 1 );
+        rec.add( STATUSTAG::LEVEL, port.getLevel(), 2 );
+        rec.add( STATUSTAG::STOP, port.getStopCondition(), 4 );
+        rec.add( STATUSTAG::COUNT, port.getCount(), 4 );
+        rec.add( STATUSTAG::DROPPED, comm.getDropped( src ), 4 );
+        rec.add( STATUSTAG::MISSED, port.getMissed(), 4 );
+        rec.add( STATUSTAG::UNITS, port.getUnits() );
+        rec.add( STATUSTAG::SHORTNAME, port.getShortname() );
+        rec.send();
 }
 
+void sendDigitalStatus( VernierDigitalSensor& port, int src ) {
+        ShieldStatusRecord rec( src );
+        rec.add( STATUSTAG::STATE, port.isArmed(), 1 );
+        rec.add( STATUSTAG::TRIGGER, port.getTrigger(), 1 );
+        rec.add( STATUSTAG::COUNT, port.getCount(), 4 );
+        rec.add( STATUSTAG::DROPPED, comm.getDropped( src ), 4 );
+        rec.send();
+}
 
 /**
-   Like setup() and loop() this is a predeclared function that is triggered
-   whenever there is a character in the serial port. You can put whatever
-   you want in this routine but it should concern itself with processing
-   the characters in the buffer.  It is run right after the loop() stub
- **/
-void serialEvent() {
-        // see if we have a character waiting.
-        if( comm.isReadyToBuild() )
-                comm.collectCommand();
-
-        // See if we have a completed command.
-        // We enter this piece if a command is complete and parameters are all in place
-        if( comm.isCommandComplete() ) {
-                switch( comm.getCommand() ) {
-                // use the SOURCES index to mark the bits to set.
-                // arm the channels to get ready for data acquisition
-                case CMDS::ARM:
-                        if ( comm.getParameter(1) & bit(SOURCES::ANA105-1) )  ana105.armPort();
-                        if ( comm.getParameter(1) & bit(SOURCES::ANA205-1) )  ana205.armPort();
-                        if ( comm.getParameter(1) & bit(SOURCES::ANA110-1) )  ana110.armPort();
-                        if ( comm.getParameter(1) & bit(SOURCES::ANA210-1) )  ana210.armPort();
-                        if ( comm.getParameter(1) & bit(SOURCES::DIG1-1) )    dig1.armPort();
-                        if ( comm.getParameter(1) & bit(SOURCES::DIG2-1) )    dig2.armPort();
-                        comm.commandSuccessful();
-                        break;
-
-                // stop the data ports
-                case CMDS::HALT:
-                        comm.commandSuccessful();
-                        ana105.haltPort();
-                        ana110.haltPort();
-                        ana205.haltPort();
-                        ana210.haltPort();
-                        dig1.haltPort();
-                        dig2.haltPort();
-                        break;
-
-                // blink the led based on parameters
-                case CMDS::BLINKLED: {
-                        comm.commandSuccessful();
-                        int blinks = (comm.getParameter() & 0xF0)>>4;
-                        unsigned long timing = (unsigned long)(comm.getParameter() & 0x0F)<<7;
-                        if (timing > 0) theLED.setBlinkPeriod(timing);
-                        theLED.blinkFor(blinks);
-                        }
-                        break;
-
-                // read the current button state
-                case CMDS::IMM_BUTSTATE:
-                        comm.commandSuccessful();
-                        comm.sendDataBlob( dataCount++, theBtn.getCurrentTime(), (int)theBtn.buttonIsDown(), SOURCES::BTN );
-                        break;
-
-                // read the current digital gate 1
-                case CMDS::IMM_DIG1:
-                        comm.commandSuccessful();
-                        comm.sendDataBlob( dataCount++, dig1.getCurrentTime(), (int)dig1.readPort(), SOURCES::DIG1 );
-                        break;
-
-                // read the current digital gate 2
-                case CMDS::IMM_DIG2:
-                        comm.commandSuccessful();
-                        comm.sendDataBlob( dataCount++, dig2.getCurrentTime(), (int)dig2.readPort(), SOURCES::DIG2 );
-                        break;
-
-                // read the current analog 5V channel 1
-                case CMDS::IMM_AN051:
-                        comm.commandSuccessful();
-                        comm.sendDataBlob( dataCount++, ana105.getCurrentTime(), ana105.readPort(), SOURCES::ANA105 );
-                        break;
-
-                // read the current analog 10V channel 1
-                case CMDS::IMM_AN101:
-                        comm.commandSuccessful();
-                        comm.sendDataBlob( dataCount++, ana110.getCurrentTime(), ana110.readPort(), SOURCES::ANA110 );
-                        break;
-
-                // read the current analog 5V channel 2
-                case CMDS::IMM_AN052:
-                        comm.commandSuccessful();
-                        comm.sendDataBlob( dataCount++, ana205.getCurrentTime(), ana205.readPort(), SOURCES::ANA205 );
-                        break;
-
-                // read the current analog 10V channel 2
-                case CMDS::IMM_AN102:
-                        comm.commandSuccessful();
-                        comm.sendDataBlob( dataCount++, ana210.getCurrentTime(), ana210.readPort(), SOURCES::ANA210 );
-                        break;
-
-                // Synchronize the clocks
-                case CMDS::MDE_SYNC:
-                        comm.commandSuccessful();
-                        syncClocks();
-                        break;
-
-                // Set the sample rate,
-                // by default we use 10Hz (relevant to analog ports)
-                // TODO: can consider allowing different sampling rates for the ADCs
-                case CMDS::MDE_ASAMPTIME:
-                        if ( comm.getParameter(1)<16 ) {
-                                ana105.setSampleRate(comm.getParameter(1));
-                                ana110.setSampleRate(comm.getParameter(1));
-                                ana205.setSampleRate(comm.getParameter(1));
-                                ana210.setSampleRate(comm.getParameter(1));
-                                comm.commandSuccessful();
-                        }
-                        else
-                                comm.badCommand();
-                        break;
-
-                // Set up the triggers,
-                // set the conditions for which sampling actually starts. parameter is uint16 (2 7bit bytes)
-                // high 2 bits the trigger type 0: immediate, 2: rising above threshhold on port
-                //                              2: falling below threshhold on port, 3: button press
-                // next 2 bits is the port to control 1: Ch1 or 2: Ch2
-                // lowest 10 bits is threshhold for analog values,
-                case CMDS::MDE_ATRIG: {
-                                int type = (comm.getParameter()>>12)&0x3;
-                                int chan = (comm.getParameter()>>10)&0x3;
-                                if ( chan&0x1 ) {    // trigger conditions for channel 1
-                                        ana105.setTrigger( type, comm.getParameter()&0x3FF );
-                                        ana110.setTrigger( type, comm.getParameter()&0x3FF );
-                                }
-                                if ( chan&0x2 ) {    // trigger conditions for channel 2
-                                        ana205.setTrigger( type, comm.getParameter()&0x3FF );
-                                        ana210.setTrigger( type, comm.getParameter()&0x3FF );
-                                }
-                                comm.commandSuccessful();
-                        }
-                        break;
-
-                // Set the stop condition,
-                // set the conditions for which sampling stops and readings returns to HALT
-                // parameter is simply the number of points.
-                case CMDS::MDE_ASTOP: {
-                                // bool useTime = (comm.getParameter(2) & 0x040) != 0; // 14th bit (#13 with zero offset) is time/flag count
-                                int data = comm.getParameter() & 0x03FFF; // everything else is the data (time or count)
-                                ana105.setStopCondition( data );
-                                ana205.setStopCondition( data );
-                                ana110.setStopCondition( data );
-                                ana210.setStopCondition( data );
-                                comm.commandSuccessful();
-                        }
-                        break;
-
-                // Set the digital port signal transitions
-                // high nibble of param: port 1 settings: 1: L2H, 2: H2L, 3: ANY transition
-                // low nibble of param: port 2 settings: L2H, 2: H2L, 3: ANY transition
-                // digital ports trigger when something happens and send a datablob at the
-                // moment something the conditions warrant. Since all data has a signature as
-                // to where it came from you can easily sort the results with the client.
-                // N.B. with vernier photogates it is possible to chain multiple gates together
-                // on one port. With this configuration there is no way to distinguish which gate
-                // triggered the event.
-                case CMDS::MDE_DTRIG:
-                        dig1.setTrigger( comm.getParameter()&0xF );
-                        dig2.setTrigger( comm.getParameter()>>4 );
-                        comm.commandSuccessful();
-                        break;
-
-                // Status messages.
-                case CMDS::ST_VERS: {
-                                comm.commandSuccessful();
-                                String msg("v:");
-                                msg += MAJOR_REV;
-                                msg += ".";
-                                msg += MINOR_REV;
-                                comm.sendString( msg.begin() );
-                        }
-                        break;
-
-                case CMDS::ST_PORTS: { // report status
-                                comm.commandSuccessful();
-                                if ( comm.getParameter(1) & bit(SOURCES::ANA105-1) ) { // BTA01_5V
-                                        String msg = ana105.getStatus("\"BTA01_5V\":");
-                                        comm.sendString( msg.begin() );
-                                        }
-                                if ( comm.getParameter(1) & bit(SOURCES::ANA205-1) ) { // BTA02_5V
-                                        String msg = ana205.getStatus("\"BTA02_5V\":");
-                                        comm.sendString( msg.begin() );
-                                        }
-                                if ( comm.getParameter(1) & bit(SOURCES::ANA110-1) ) { // BTA01_10V
-                                        String msg = ana110.getStatus("\"BTA01_10V\":");
-                                        comm.sendString( msg.begin() );
-                                        }
-                                if ( comm.getParameter(1) & bit(SOURCES::ANA210-1) ) { // BTA02_10V
-                                        String msg = ana210.getStatus("\"BTA02_10V\":");
-                                        comm.sendString( msg.begin() );
-                                        }
-                                if ( comm.getParameter(1) & bit(SOURCES::DIG1-1) ) { // BTD01
-                                        String msg = dig1.getStatus("\"BTD01\":");
-                                        comm.sendString( msg.begin() );
-                                        }
-                                if ( comm.getParameter(1) & bit(SOURCES::DIG2-1) ) { // BTD02
-                                        String msg = dig2.getStatus("\"BTD02\":");
-                                        comm.sendString( msg.begin() );
-                                        }
-                                if ( comm.getParameter(1) & bit(SOURCES::BTN-1) ) { // BTN
-                                        String msg = "\"BTN\":";
-                                        if (theBtn.buttonIsDown()) msg += "true";
-                                        else                       msg += "false";
-                                        comm.sendString( msg.begin() );
-                                        }                        }
-                        break;
-                        // Set the digital port signal transitions
+ * Command handlers. Each one is listed in the COMMANDS table below with
+ * the number of parameter bytes it takes and flags that say when the
+ * ACK goes out (see CMDF). Handlers without flags return true for an ACK
+ * and false for a NAK. Adding a command means writing a handler and adding
+ * a line to the table.
+ */
 
-                }
+// use the SOURCES index to mark the bits to set.
+// arm the channels to get ready for data acquisition
+bool cmdArm() {
+        Sensors.arm( comm.getParameter(1) );
+        comm.resetEventAnchors();
+        return true;
+}
+
+// stop the data ports
+bool cmdHalt() {
+        Sensors.halt();
+        return true;
+}
+
+// blink the led based on parameters
+bool cmdBlink() {
+        int blinks = (comm.getParameter() & 0xF0)>>4;
+        unsigned long timing = (unsigned long)(comm.getParameter() & 0x0F)<<7;
+        if (timing > 0) theLED.setBlinkPeriod(timing);
+        theLED.blinkFor(blinks);
+        return true;
+}
+
+// read the current button state, immediate reads carry seq# 0
+bool cmdImmButton() {
+        comm.sendDataBlob( 0L, theBtn.getCurrentTime(), (int)theBtn.buttonIsDown(), SOURCES::BTN );
+        return true;
+}
+
+// read the current level of a digital gate or analog channel
+template<int SRC> bool cmdImmediate() {
+        comm.sendDataBlob( 0L, Sensors.getCurrentTime( SRC ), Sensors.read( SRC ), SRC );
+        return true;
+}
+
+// read every port in the mask at once, the digital lines and the button
+// are read first since the conversions take ~100μs apiece. Stamped on the
+// same clock as the beacons and pings, not any one port's.
+bool cmdSnapshot() {
+        char mask = comm.getParameter(1);
+        int raw[8] = {0};
+        unsigned long when = micros() - syncMicros;
+        uint8_t dig = mask & Sensors.getDigital(), ana = mask & Sensors.getAnalog();
+        for ( uint8_t src = Sensors.next( dig ); src; src = Sensors.next( dig, src ) ) raw[src] = Sensors.read( src );
+        if ( mask & bit(SOURCES::BTN-1) ) raw[SOURCES::BTN] = theBtn.buttonIsDown();
+        for ( uint8_t src = Sensors.next( ana ); src; src = Sensors.next( ana, src ) ) raw[src] = Sensors.read( src );
+        comm.sendSnapshot( mask, when, raw );
+        return true;
+}
+
+// Clock ping: when the command arrived and when the answer went into the ring
+bool cmdPing() {
+        unsigned long rxTime = ShieldPort.getRxMicros() - syncMicros;
+        comm.sendPing( comm.getParameter(), rxTime, micros() - syncMicros );
+        return true;
+}
+
+// Synchronize the clocks
+bool cmdSync() {
+        syncClocks();
+        return true;
+}
+
+// Set the sample rate,
+// by default we use 10Hz (relevant to analog ports)
+// TODO: can consider allowing different sampling rates for the ADCs
+bool cmdSampleTime() {
+        char rate = comm.getParameter(1);
+        if ( rate>=16 ) return false;
+        uint8_t ana = Sensors.getAnalog();
+        for ( uint8_t src = Sensors.next( ana ); src; src = Sensors.next( ana, src ) ) Sensors.analog( src )->setSampleRate(rate);
+        return true;
+}
+
+// Set up the triggers,
+// set the conditions for which sampling actually starts. parameter is uint16 (2 7bit bytes)
+// high 2 bits the trigger type 0: immediate, 2: rising above threshhold on port
+//                              2: falling below threshhold on port, 3: button press
+// next 2 bits is the port to control 1: Ch1 or 2: Ch2
+// lowest 10 bits is threshhold for analog values,
+bool cmdAnalogTrigger() {
+        unsigned long param = comm.getParameter();
+        int type = (param>>12)&0x3;
+        int chan = (param>>10)&0x3;
+        uint8_t mask = 0;
+        if ( chan&0x1 ) mask |= bit(SOURCES::ANA105-1) | bit(SOURCES::ANA110-1);  // channel 1
+        if ( chan&0x2 ) mask |= bit(SOURCES::ANA205-1) | bit(SOURCES::ANA210-1);  // channel 2
+        mask &= Sensors.getAnalog();
+        for ( uint8_t src = Sensors.next( mask ); src; src = Sensors.next( mask, src ) ) Sensors.analog( src )->setTrigger( type, param&0x3FF );
+        return true;
+}
+
+// Set the stop condition,
+// set the conditions for which sampling stops and readings returns to HALT
+// parameter is simply the number of points.
+bool cmdAnalogStop() {
+        int data = comm.getParameter() & 0x03FFF; // everything else is the data (time or count)
+        uint8_t ana = Sensors.getAnalog();
+        for ( uint8_t src = Sensors.next( ana ); src; src = Sensors.next( ana, src ) ) Sensors.analog( src )->setStopCondition( data );
+        return true;
+}
+
+// Set the digital port signal transitions
+// high nibble of param: port 1 settings: 1: L2H, 2: H2L, 3: ANY transition
+// low nibble of param: port 2 settings: L2H, 2: H2L, 3: ANY transition
+// digital ports trigger when something happens and send a datablob at the
+// moment something the conditions warrant. Since all data has a signature as
+// to where it came from you can easily sort the results with the client.
+// N.B. with vernier photogates it is possible to chain multiple gates together
+// on one port. With this configuration there is no way to distinguish which gate
+// triggered the event.
+bool cmdDigitalTrigger() {
+        dig1.setTrigger( comm.getParameter()&0xF );
+        dig2.setTrigger( comm.getParameter()>>4 );
+        return true;
+}
+
+// Configure every port at once (variable length, see CMDS::MDE_CONFIG)
+bool cmdConfig() {
+        const uint8_t* cfg;
+        int len = comm.getExtended( &cfg );
+        return len>=0 && configureExperiment( cfg, len );
+}
+
+// Set how the digital transitions are sent
+// param: 0: 8 byte data blobs, 1: compact varint events
+bool cmdDigitalEncoding() {
+        return comm.setEventEncoding( comm.getParameter(1) );
+}
+
+// Change the link speed. ACK at the old speed then switch.
+// param: 0: 460800, 1: 1M, 2: 2M baud
+bool cmdLinkSpeed() {
+        int speed = comm.getParameter(1);
+        if ( speed >= LINKSPEED::COUNT ) {
+                comm.badCommand();
+                return false;
         }
+        comm.commandSuccessful();
+        comm.changeLinkSpeed( speed );
+        return true;
+}
+
+// Echo the parameters back, the host uses this to confirm a new link speed
+bool cmdLinkEcho() {
+        comm.confirmLink();
+        // the parameters are stored last byte first, send them back in the order they came
+        comm.startString() << "{\"echo\":[" << _DEC(comm.getParameter(2)) << "," << _DEC(comm.getParameter(1))
+                           << "],\"baud\":" << comm.getLinkBaud() << "}";
+        comm.endString();
+        return true;
+}
+
+// Status messages.
+bool cmdLinkStatus() {
+        comm.sendLinkStatus();
+        return true;
+}
+
+// Loop and latency histograms and the free RAM, param 1 empties them afterwards
+bool cmdStats() {
+        Stats.send();
+        if ( comm.getParameter(1) & 0x01 ) Stats.clear();
+        return true;
+}
+
+// The trace ring oldest point first (empty without SHIELD_TRACE), param 1 empties it afterwards
+bool cmdTrace() {
+        Trace.send();
+        if ( comm.getParameter(1) & 0x01 ) Trace.clear();
+        return true;
+}
+
+// Reliable streaming, param 1 on, 0 off. Batches are numbered from 0 again either way.
+bool cmdReliable() {
+        char on = comm.getParameter(1);
+        if ( on > 1 ) return false;
+        ShieldPort.setReliable( on );
+        return true;
+}
+
+// The host has every batch before the 14 bit param
+bool cmdBatchAck() {
+        ShieldPort.acknowledge( comm.getParameter() );
+        return true;
+}
+
+// The host is missing batches, params: first (14 bits) then how many
+bool cmdBatchNak() {
+        unsigned long param = comm.getParameter();
+        ShieldPort.resend( param >> 7, param & 0x7F );
+        return true;
+}
+
+bool cmdVersion() {
+        comm.startString() << "v:" << MAJOR_REV << "." << MINOR_REV;
+        comm.endString();
+        return true;
+}
+
+// report status, written straight into the transmit ring
+bool cmdPortStatus() {
+        char mask = comm.getParameter(1);
+        for ( uint8_t src = Sensors.next( mask ); src; src = Sensors.next( mask, src ) ) {
+                if ( Sensors.analog( src ) ) Sensors.analog( src )->printStatus( comm.startString(), Sensors.getKey( src ) );
+                else                         Sensors.digital( src )->printStatus( comm.startString(), Sensors.getKey( src ) );
+                comm.endString();
+                }
+        if ( mask & bit(SOURCES::BTN-1) ) { // BTN
+                comm.startString() << F("\"BTN\":") << (theBtn.buttonIsDown() ? F("true") : F("false"));
+                comm.endString();
+                }
+        return true;
+}
+
+// binary status records, one per port
+bool cmdPortStatusBinary() {
+        char mask = comm.getParameter(1);
+        for ( uint8_t src = Sensors.next( mask ); src; src = Sensors.next( mask, src ) ) {
+                if ( Sensors.analog( src ) ) sendAnalogStatus( *Sensors.analog( src ), src );
+                else                         sendDigitalStatus( *Sensors.digital( src ), src );
+                }
+        if ( mask & bit(SOURCES::BTN-1) ) {
+                ShieldStatusRecord rec( SOURCES::BTN );
+                rec.add( STATUSTAG::BUTTON, theBtn.buttonIsDown(), 1 );
+                rec.send();
+                }
+        return true;
+}
+
+/**
+ * The command table: predicate, parameter bytes, flags, handler
+ */
+const CommandEntry COMMANDS[] PROGMEM = {
+        { CMDS::HALT,          0, CMDF::ACK_FIRST, cmdHalt },
+        { CMDS::ARM,           1, 0,               cmdArm },
+        { CMDS::BLINKLED,      1, CMDF::ACK_FIRST, cmdBlink },
+        { CMDS::IMM_DIG1,      0, CMDF::ACK_FIRST, cmdImmediate<SOURCES::DIG1> },
+        { CMDS::IMM_DIG2,      0, CMDF::ACK_FIRST, cmdImmediate<SOURCES::DIG2> },
+        { CMDS::IMM_AN051,     0, CMDF::ACK_FIRST, cmdImmediate<SOURCES::ANA105> },
+        { CMDS::IMM_AN101,     0, CMDF::ACK_FIRST, cmdImmediate<SOURCES::ANA110> },
+        { CMDS::IMM_AN052,     0, CMDF::ACK_FIRST, cmdImmediate<SOURCES::ANA205> },
+        { CMDS::IMM_AN102,     0, CMDF::ACK_FIRST, cmdImmediate<SOURCES::ANA210> },
+        { CMDS::IMM_BUTSTATE,  0, CMDF::ACK_FIRST, cmdImmButton },
+        { CMDS::IMM_SNAP,      1, CMDF::ACK_FIRST, cmdSnapshot },
+        { CMDS::MDE_SYNC,      0, CMDF::ACK_FIRST, cmdSync },
+        { CMDS::CLK_PING,      2, CMDF::NO_ACK,    cmdPing },
+        { CMDS::MDE_ASAMPTIME, 1, 0,               cmdSampleTime },
+        { CMDS::MDE_ASTOP,     2, 0,               cmdAnalogStop },
+        { CMDS::MDE_ATRIG,     2, 0,               cmdAnalogTrigger },
+        { CMDS::MDE_DTRIG,     1, 0,               cmdDigitalTrigger },
+        { CMDS::MDE_DEVENT,    1, 0,               cmdDigitalEncoding },
+        { CMDS::MDE_LINK,      1, CMDF::SELF_ACK,  cmdLinkSpeed },
+        { CMDS::LINK_ECHO,     2, CMDF::ACK_FIRST, cmdLinkEcho },
+        { CMDS::MDE_CONFIG,    1, CMDF::EXTENDED,  cmdConfig },
+        { CMDS::ST_VERS,       0, CMDF::ACK_FIRST, cmdVersion },
+        { CMDS::ST_PORTS,      1, CMDF::ACK_FIRST, cmdPortStatus },
+        { CMDS::ST_PORTSB,     1, CMDF::ACK_FIRST, cmdPortStatusBinary },
+        { CMDS::ST_LINK,       0, CMDF::ACK_FIRST, cmdLinkStatus },
+        { CMDS::ST_STATS,      1, CMDF::ACK_FIRST, cmdStats },
+        { CMDS::ST_TRACE,      1, CMDF::ACK_FIRST, cmdTrace },
+        { CMDS::MDE_RELIABLE,  1, 0,               cmdReliable },
+        { CMDS::RTX_ACK,       2, CMDF::NO_ACK,    cmdBatchAck },
+        { CMDS::RTX_NAK,       3, CMDF::NO_ACK,    cmdBatchNak },
+};
+
+/**
+ * Setup the Arduino before we enter the endless loop
+ */
+void setup() {
+        Stats.begin();  // before anything has used the stack
+        Trace.begin();
+        comm.setCommands( COMMANDS, sizeof(COMMANDS)/sizeof(COMMANDS[0]) );
+        Sensors.setPorts( PORTS, sizeof(PORTS)/sizeof(PORTS[0]) );
+        comm.beginLink();  // We are talking over USB at 4*115200. MDE_LINK can push this up to 1E6 or 2E6
+        theLED.setBlinkPeriod(200);
+        theLED.blinkFor(3);
+        syncClocks();
+        ShieldPort << BOOT_MSG << " ver:" << MAJOR_REV << "." << MINOR_REV << endl; // send boot message
+}
+
+/**
+ * Run the loop repeatedly. Commands are checked before each group of
+ * ports so HALT and the immediate reads never wait for more than a
+ * couple of analog reads.
+ */
+void loop() {
+        BENCH_SCOPE( BENCH::LOOP );
+        Stats.loopStart();
+        TRACE_POINT( TRACE::LOOP );
+
+        comm.processCommands();
+
+        // Poll the armed ports, the halted ones cost nothing
+        Sensors.poll( FIRST_PORTS );
+
+        comm.processCommands();
+
+        Sensors.poll( ~FIRST_PORTS );
 
+        checkBeacon();     // clock wraps and full counts for the host
+        comm.checkLink();  // fall back if a link speed change wasn't confirmed
+        ShieldPort.service();  // reliable streaming: close a batch that has waited long enough, resend
 }